@@ -77,7 +77,6 @@
 
 constexpr float pulse_tbl[] = { 0.0f, 0.01160913892f, 0.02293948084f, 0.03400094807f, 0.04480300099f, 0.05535465851f, 0.0656645298f, 0.07574082166f, 0.08559139818f, 0.09522374719f, 0.1046450436f, 0.1138621494f, 0.1228816435f, 0.1317097992f, 0.1403526366f, 0.1488159597f, 0.1571052521f, 0.1652258784f, 0.1731829196f, 0.1809812635f, 0.188625589f, 0.1961204559f, 0.2034701705f, 0.2106789351f, 0.2177507579f, 0.2246894985f, 0.2314988673f, 0.2381824702f, 0.2447437793f, 0.2511860728f, 0.2575125694f, 0.2637263834f };
 constexpr float tnd_tbl[] = { 0.0f, 0.006699823774f, 0.01334501989f, 0.01993625611f, 0.0264741797f, 0.03295944259f, 0.0393926762f, 0.04577450082f, 0.05210553482f, 0.05838638172f, 0.06461763382f, 0.07079987228f, 0.07693368942f, 0.08301962167f, 0.08905825764f, 0.09505013376f, 0.1009957939f, 0.1068957672f, 0.1127505824f, 0.1185607538f, 0.1243267879f, 0.130049184f, 0.1357284486f, 0.1413650513f, 0.1469594985f, 0.1525122225f, 0.1580237001f, 0.1634943932f, 0.1689247638f, 0.174315244f, 0.1796662807f, 0.1849783063f, 0.1902517378f, 0.1954869777f, 0.2006844729f, 0.2058446258f, 0.210967809f, 0.2160544395f, 0.2211049199f, 0.2261195928f, 0.2310988754f, 0.2360431105f, 0.2409527153f, 0.2458280027f, 0.2506693602f, 0.2554771006f, 0.2602516413f, 0.2649932802f, 0.2697023749f, 0.2743792236f, 0.2790241838f, 0.2836375833f, 0.2882197201f, 0.292770952f, 0.2972915173f, 0.3017818034f, 0.3062421083f, 0.3106726706f, 0.3150738478f, 0.3194458783f, 0.3237891197f, 0.3281037807f, 0.3323901892f, 0.3366486132f, 0.3408792913f, 0.3450825512f, 0.3492586315f, 0.3534077704f, 0.357530266f, 0.3616263568f, 0.3656963408f, 0.3697403669f, 0.3737587631f, 0.3777517378f, 0.3817195594f, 0.3856624365f, 0.3895806372f, 0.3934743702f, 0.3973438442f, 0.4011892974f, 0.4050109982f, 0.4088090658f, 0.412583828f, 0.4163354635f, 0.4200641513f, 0.4237701297f, 0.4274536073f, 0.431114763f, 0.4347538352f, 0.4383709729f, 0.4419664443f, 0.4455403984f, 0.449093014f, 0.4526245296f, 0.4561350644f, 0.4596248865f, 0.4630941153f, 0.4665429294f, 0.4699715674f, 0.4733801484f, 0.4767689407f, 0.4801379442f, 0.4834875166f, 0.4868176877f, 0.4901287258f, 0.4934206903f, 0.4966938794f, 0.4999483228f, 0.5031842589f, 0.5064018369f, 0.5096011758f, 0.5127824545f, 0.5159458518f, 0.5190914273f, 0.5222194791f, 0.5253300667f, 0.5284232497f, 0.5314993262f, 0.5345583558f, 0.5376005173f, 0.5406259298f, 0.5436347723f, 0.5466270447f, 0.549603045f, 0.5525628328f, 0.5555064678f, 0.5584343076f, 0.5613462329f, 0.5642424822f, 0.5671232343f, 0.5699884892f, 0.5728384256f, 0.5756732225f, 0.5784929395f, 0.5812976956f, 0.5840876102f, 0.5868628025f, 0.5896234512f, 0.5923695564f, 0.5951013565f, 0.5978189111f, 0.6005222797f, 0.6032115817f, 0.6058869958f, 0.6085486412f, 0.6111965775f, 0.6138308048f, 0.6164515615f, 0.6190590262f, 0.6216531396f, 0.6242340207f, 0.6268018484f, 0.6293566823f, 0.6318986416f, 0.6344277263f, 0.6369441748f, 0.6394480467f, 0.641939342f, 0.6444182396f, 0.6468848586f, 0.6493391991f, 0.6517813802f, 0.6542115211f, 0.6566297412f, 0.6590360403f, 0.6614305973f, 0.6638134122f, 0.6661846638f, 0.6685443521f, 0.6708925962f, 0.6732294559f, 0.6755550504f, 0.6778694391f, 0.6801727414f, 0.6824649572f, 0.6847462058f, 0.6870166063f, 0.6892762184f, 0.6915250421f, 0.6937633157f, 0.6959909201f, 0.698208034f, 0.7004147768f, 0.7026110888f, 0.7047972083f, 0.7069730759f, 0.7091388106f, 0.7112944722f, 0.7134401202f, 0.7155758739f, 0.7177017927f, 0.7198178768f, 0.7219242454f, 0.7240209579f, 0.7261080146f, 0.7281856537f, 0.7302538157f, 0.7323125601f, 0.7343619466f, 0.7364020944f, 0.7384331226f, 0.7404549122f, 0.7424675822f };
-constexpr uint32_t palette[] = { 0xff666666, 0xff882a00, 0xffa71214, 0xffa4003b, 0xff7e005c, 0xff40006e, 0xff00066c, 0xff001d56, 0xff003533, 0xff00480b, 0xff005200, 0xff084f00, 0xff4d4000, 0xff000000, 0xff000000, 0xff000000, 0xffadadad, 0xffd95f15, 0xffff4042, 0xfffe2775, 0xffcc1aa0, 0xff7b1eb7, 0xff2031b5, 0xff004e99, 0xff006d6b, 0xff008738, 0xff00930c, 0xff328f00, 0xff8d7c00, 0xff000000, 0xff000000, 0xff000000, 0xfffffeff, 0xffffb064, 0xffff9092, 0xffff76c6, 0xffff6af3, 0xffcc6efe, 0xff7081fe, 0xff229eea, 0xff00bebc, 0xff00d888, 0xff30e45c, 0xff82e045, 0xffdecd48, 0xff4f4f4f, 0xff000000, 0xff000000, 0xfffffeff, 0xffffdfc0, 0xffffd2d3, 0xffffc8e8, 0xffffc2fb, 0xffeac4fe, 0xffc5ccfe, 0xffa5d8f7, 0xff94e5e4, 0xff96efcf, 0xffabf4bd, 0xffccf3b3, 0xfff2ebb5, 0xffb8b8b8, 0xff000000, 0xff000000 };
 
 constexpr uint8_t duty_tbl[4][8] = {
 	{ 0, 1, 0, 0, 0, 0, 0, 0 },
@@ -91,6 +90,99 @@ constexpr uint8_t tri_tbl[] = {
 	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
 };
 
+// What the PPU does on each dot. Every line is one of four kinds, and
+// the dots of each kind always do the same things, so the sequencing is
+// worked out once here instead of from scanline and cycle on every dot.
+// Everything but dotVBlank and dotPrerender only happens with rendering on.
+enum DotActions {
+	dotPixel = 1 << 0,
+	dotShift = 1 << 1,          // tile_data moves over a pixel
+	dotFetchName = 1 << 2,
+	dotFetchAttribute = 1 << 3,
+	dotFetchLow = 1 << 4,
+	dotFetchHigh = 1 << 5,
+	dotLoadTile = 1 << 6,       // the fetched tile goes into tile_data
+	dotIncrementX = 1 << 7,
+	dotIncrementY = 1 << 8,
+	dotCopyX = 1 << 9,
+	dotCopyY = 1 << 10,
+	dotEvaluateSprites = 1 << 11,
+	dotClearSprites = 1 << 12,
+	dotVBlank = 1 << 13,
+	dotPrerender = 1 << 14,
+};
+
+enum LineKinds {
+	lineVisible = 0,
+	lineIdle = 1,      // post-render and vblank
+	lineVBlank = 2,    // 241, which sets vblank
+	linePrerender = 3
+};
+
+struct DotTable {
+	uint8_t kinds[262];
+	uint16_t actions[4][341];
+	// dots from here to the end of the line that do nothing but count,
+	// stopping short of the odd-frame skip after dot 339 of the pre-render line
+	uint16_t idle[4][341];
+};
+
+constexpr uint16_t dotActions(int kind, int cycle) {
+	const bool render = kind == lineVisible || kind == linePrerender;
+	const bool fetch = (cycle >= 1 && cycle <= 256) || (cycle >= 321 && cycle <= 336);
+	uint16_t actions = 0;
+	if (kind == lineVisible && cycle >= 1 && cycle <= 256) {
+		actions |= dotPixel;
+	}
+	if (render && fetch) {
+		actions |= dotShift;
+		switch (cycle & 7) {
+		case 1: actions |= dotFetchName; break;
+		case 3: actions |= dotFetchAttribute; break;
+		case 5: actions |= dotFetchLow; break;
+		case 7: actions |= dotFetchHigh; break;
+		case 0: actions |= dotLoadTile | dotIncrementX; break;
+		}
+	}
+	if (kind == linePrerender && cycle >= 280 && cycle <= 304) {
+		actions |= dotCopyY;
+	}
+	if (render && cycle == 256) {
+		actions |= dotIncrementY;
+	}
+	if (render && cycle == 257) {
+		actions |= dotCopyX;
+	}
+	if (cycle == 257) {
+		actions |= kind == lineVisible ? dotEvaluateSprites : dotClearSprites;
+	}
+	if (kind == lineVBlank && cycle == 1) {
+		actions |= dotVBlank;
+	}
+	if (kind == linePrerender && cycle == 1) {
+		actions |= dotPrerender;
+	}
+	return actions;
+}
+
+constexpr DotTable makeDotTable() {
+	DotTable table = {};
+	for (int line = 0; line < 262; ++line) {
+		table.kinds[line] = line < 240 ? lineVisible : line == 241 ? lineVBlank : line == 261 ? linePrerender : lineIdle;
+	}
+	for (int kind = 0; kind < 4; ++kind) {
+		int run = 0;
+		for (int cycle = 340; cycle >= 0; --cycle) {
+			table.actions[kind][cycle] = dotActions(kind, cycle);
+			run = table.actions[kind][cycle] != 0 || (kind == linePrerender && cycle == 340) ? 0 : run + 1;
+			table.idle[kind][cycle] = static_cast<uint16_t>(run);
+		}
+	}
+	return table;
+}
+
+constexpr DotTable dot_table = makeDotTable();
+
 void spritePixel(PPU* ppu, uint8_t& i, uint8_t& sprite) {
 	i = sprite = 0;
 	if (ppu->flag_show_sprites == 0) return;
@@ -105,11 +197,85 @@ void spritePixel(PPU* ppu, uint8_t& i, uint8_t& sprite) {
 	return;
 }
 
+// Moves v down a pixel row, wrapping into the next vertical nametable
+// after row 29 and back to the top from rows 30 and 31.
+static inline uint16_t incrementY(uint16_t v) {
+	if ((v & 0x7000) != 0x7000) {
+		return v + 0x1000;
+	}
+	v &= 0x8FFF;
+	uint16_t y = (v & 0x03E0) >> 5;
+	if (y == 29) {
+		y = 0;
+		v ^= 0x0800;
+	}
+	else if (y == 31) {
+		y = 0;
+	}
+	else {
+		++y;
+	}
+	return (v & 0xFC1F) | (y << 5);
+}
+
+// Address of the low pattern plane for 'row' of OAM entry 'i'.
+static inline uint16_t spriteAddress(const PPU* ppu, int i, int row) {
+	uint8_t tile = ppu->oam_tbl[4 * i + 1];
+	const uint8_t attributes = ppu->oam_tbl[4 * i + 2];
+	if (ppu->flag_sprite_size == 0) {
+		if ((attributes & 0x80) == 0x80) {
+			row = 7 - row;
+		}
+		uint8_t table = ppu->flag_sprite_tbl;
+		return (static_cast<uint16_t>(table) << 12) + (static_cast<uint16_t>(tile) << 4) + static_cast<uint16_t>(row);
+	}
+	if ((attributes & 0x80) == 0x80) {
+		row = 15 - row;
+	}
+	uint8_t table = tile & 1;
+	tile &= 0xFE;
+	if (row > 7) {
+		++tile;
+		row -= 8;
+	}
+	return (static_cast<uint16_t>(table) << 12) + (static_cast<uint16_t>(tile) << 4) + static_cast<uint16_t>(row);
+}
+
+// One row of a sprite as eight 4-bit pixels, leftmost in the top bits.
+static inline uint32_t spritePattern(uint8_t low_tile_u8, uint8_t high_tile_u8, uint8_t attributes) {
+	const uint8_t atts = (attributes & 3) << 2;
+	uint32_t sprite_pattern = 0;
+	for (int j = 0; j < 8; ++j) {
+		uint8_t p1, p2;
+		if ((attributes & 0x40) == 0x40) {
+			p1 = low_tile_u8 & 1;
+			p2 = (high_tile_u8 & 1) << 1;
+			low_tile_u8 >>= 1;
+			high_tile_u8 >>= 1;
+		}
+		else {
+			p1 = (low_tile_u8 & 0x80) >> 7;
+			p2 = (high_tile_u8 & 0x80) >> 6;
+			low_tile_u8 <<= 1;
+			high_tile_u8 <<= 1;
+		}
+		sprite_pattern <<= 4;
+		sprite_pattern |= static_cast<uint32_t>(atts | p1 | p2);
+	}
+	return sprite_pattern;
+}
+
+// With 'hooks' set, background and sprite fetches go through the mapper
+// so boards like MMC5 can substitute their own data. emulate() picks the
+// instantiation once per call, so other boards pay nothing for it.
+template <bool hooks>
 void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
+	++ppu->ticks;
 	if (ppu->nmi_delay > 0) {
 		ppu->nmi_delay--;
 		if (ppu->nmi_delay == 0 && ppu->nmi_out && ppu->nmi_occurred) {
 			cpu->interrupt = interruptNMI;
+			++nes->vblanks_seen;
 		}
 	}
 	if ((ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0) &&
@@ -132,16 +298,11 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 		}
 	}
 
+	const uint16_t actions = dot_table.actions[dot_table.kinds[ppu->scanline]][ppu->cycle];
 	const bool do_render = ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0;
-	const bool preline = ppu->scanline == 261;
-	const bool line_visible = ppu->scanline < 240;
-	const bool do_line_render = preline || line_visible;
-	const bool prefetch_cycle = ppu->cycle >= 321 && ppu->cycle <= 336;
-	const bool cycle_visible = ppu->cycle >= 1 && ppu->cycle <= 256;
-	const bool fetch_cycle = prefetch_cycle || cycle_visible;
 
 	if (do_render) {
-		if (line_visible && cycle_visible) {
+		if (actions & dotPixel) {
 			int x = ppu->cycle - 1;
 			int y = ppu->scanline;
 
@@ -188,35 +349,35 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 
 			ppu->back[(y << 8) + x] = palette[readPalette(ppu, static_cast<uint16_t>(color)) & 63];
 		}
-		if (do_line_render && fetch_cycle) {
+		if (actions & dotShift) {
 			ppu->tile_data <<= 4;
-			int pcm8 = ppu->cycle & 7;
-			if (pcm8 == 1) {
+			if (actions & dotFetchName) {
 				const uint16_t v = ppu->v;
 				const uint16_t address = 0x2000 | (v & 0x0FFF);
-				ppu->name_tbl_u8 = readPPU(nes, address);
+				ppu->name_tbl_u8 = hooks ? nes->mapper->fetchTile(nes, address) : readPPU(nes, address);
 			}
-			else if (pcm8 == 3) {
+			else if (actions & dotFetchAttribute) {
 				const uint16_t v = ppu->v;
 				const uint16_t address = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
 				const int shift = ((v >> 4) & 4) | (v & 2);
-				ppu->attrib_tbl_u8 = ((readPPU(nes, address) >> shift) & 3) << 2;
+				const uint8_t attrib = hooks ? nes->mapper->fetchAttribute(nes, address) : readPPU(nes, address);
+				ppu->attrib_tbl_u8 = ((attrib >> shift) & 3) << 2;
 			}
-			else if (pcm8 == 5) {
+			else if (actions & dotFetchLow) {
 				const uint16_t fineY = (ppu->v >> 12) & 7;
 				const uint8_t table = ppu->flag_background_tbl;
 				const uint8_t tile = ppu->name_tbl_u8;
 				const uint16_t address = (static_cast<uint16_t>(table) << 12) + (static_cast<uint16_t>(tile) << 4) + fineY;
-				ppu->low_tile_u8 = readPPU(nes, address);
+				ppu->low_tile_u8 = hooks ? nes->mapper->fetchBackground(nes, address) : readPPU(nes, address);
 			}
-			else if (pcm8 == 7) {
+			else if (actions & dotFetchHigh) {
 				const uint16_t fineY = (ppu->v >> 12) & 7;
 				const uint8_t table = ppu->flag_background_tbl;
 				const uint8_t tile = ppu->name_tbl_u8;
 				const uint16_t address = (static_cast<uint16_t>(table) << 12) + (static_cast<uint16_t>(tile) << 4) + fineY;
-				ppu->high_tile_u8 = readPPU(nes, address + 8);
+				ppu->high_tile_u8 = hooks ? nes->mapper->fetchBackground(nes, address + 8) : readPPU(nes, address + 8);
 			}
-			else if (pcm8 == 0) {
+			else if (actions & dotLoadTile) {
 				uint32_t data = 0;
 				for (int i = 0; i < 8; ++i) {
 					const uint8_t a = ppu->attrib_tbl_u8;
@@ -230,104 +391,43 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 				ppu->tile_data |= static_cast<uint64_t>(data);
 			}
 		}
-		if (preline && ppu->cycle >= 280 && ppu->cycle <= 304) {
+		if (actions & dotCopyY) {
 			ppu->v = (ppu->v & 0x841F) | (ppu->t & 0x7BE0);
 		}
-		if (do_line_render) {
-			if (fetch_cycle && (ppu->cycle & 7) == 0) {
-				if ((ppu->v & 0x001F) == 31) {
-					// coarse X = 0
-					ppu->v &= 0xFFE0;
-					// switch horizontal nametable
-					ppu->v ^= 0x0400;
-				}
-				else {
-					// increment coarse X
-					++ppu->v;
-				}
+		if (actions & dotIncrementX) {
+			if ((ppu->v & 0x001F) == 31) {
+				// coarse X = 0
+				ppu->v &= 0xFFE0;
+				// switch horizontal nametable
+				ppu->v ^= 0x0400;
 			}
-			if (ppu->cycle == 256) {
-				if ((ppu->v & 0x7000) != 0x7000) {
-					ppu->v += 0x1000;
-				}
-				else {
-					ppu->v &= 0x8FFF;
-					uint16_t y = (ppu->v & 0x03E0) >> 5;
-					if (y == 29) {
-						y = 0;
-						ppu->v ^= 0x0800;
-					}
-					else if (y == 31) {
-						y = 0;
-					}
-					else {
-						++y;
-					}
-					ppu->v = (ppu->v & 0xFC1F) | (y << 5);
-				}
-			}
-			if (ppu->cycle == 257) {
-				ppu->v = (ppu->v & 0xFBE0) | (ppu->t & 0x041F);
+			else {
+				// increment coarse X
+				++ppu->v;
 			}
 		}
-	}
+		if (actions & dotIncrementY) {
+			ppu->v = incrementY(ppu->v);
+		}
+		if (actions & dotCopyX) {
+			ppu->v = (ppu->v & 0xFBE0) | (ppu->t & 0x041F);
+		}
 
-	// sprites
-	if (do_render && ppu->cycle == 257) {
-		if (line_visible) {
+		// sprites
+		if (actions & dotEvaluateSprites) {
 			int h = ppu->flag_sprite_size != 0 ? 16 : 8;
 			int count = 0;
 			for (int i = 0; i < 64; ++i) {
 				const uint8_t y = ppu->oam_tbl[4 * i + 0];
 				const uint8_t a = ppu->oam_tbl[4 * i + 2];
 				const uint8_t x = ppu->oam_tbl[4 * i + 3];
-				int row = ppu->scanline - static_cast<int>(y);
+				const int row = ppu->scanline - static_cast<int>(y);
 				if (row < 0 || row >= h) continue;
 				if (count < 8) {
-					uint32_t sprite_pattern = 0;
-					uint8_t tile = ppu->oam_tbl[4 * i + 1];
-					const uint8_t attributes = ppu->oam_tbl[4 * i + 2];
-					uint16_t address = 0;
-					if (ppu->flag_sprite_size == 0) {
-						if ((attributes & 0x80) == 0x80) {
-							row = 7 - row;
-						}
-						uint8_t table = ppu->flag_sprite_tbl;
-						address = (static_cast<uint16_t>(table) << 12) + (static_cast<uint16_t>(tile) << 4) + static_cast<uint16_t>(row);
-					}
-					else {
-						if ((attributes & 0x80) == 0x80) {
-							row = 15 - row;
-						}
-						uint8_t table = tile & 1;
-						tile &= 0xFE;
-						if (row > 7) {
-							++tile;
-							row -= 8;
-						}
-						address = (static_cast<uint16_t>(table) << 12) + (static_cast<uint16_t>(tile) << 4) + static_cast<uint16_t>(row);
-					}
-					uint8_t atts = (attributes & 3) << 2;
-					uint8_t low_tile_u8 = readPPU(nes, address);
-					uint8_t high_tile_u8 = readPPU(nes, address + 8);
-
-					for (int j = 0; j < 8; ++j) {
-						uint8_t p1, p2;
-						if ((attributes & 0x40) == 0x40) {
-							p1 = low_tile_u8 & 1;
-							p2 = (high_tile_u8 & 1) << 1;
-							low_tile_u8 >>= 1;
-							high_tile_u8 >>= 1;
-						}
-						else {
-							p1 = (low_tile_u8 & 0x80) >> 7;
-							p2 = (high_tile_u8 & 0x80) >> 6;
-							low_tile_u8 <<= 1;
-							high_tile_u8 <<= 1;
-						}
-						sprite_pattern <<= 4;
-						sprite_pattern |= static_cast<uint32_t>(atts | p1 | p2);
-					}
+					const uint16_t address = spriteAddress(ppu, i, row);
+					const uint8_t low_tile_u8 = hooks ? nes->mapper->fetchSprite(nes, address) : readPPU(nes, address);
+					const uint8_t high_tile_u8 = hooks ? nes->mapper->fetchSprite(nes, address + 8) : readPPU(nes, address + 8);
+					const uint32_t sprite_pattern = spritePattern(low_tile_u8, high_tile_u8, a);
 					ppu->sprite_patterns[count] = sprite_pattern;
 					ppu->sprite_pos[count] = x;
 					ppu->sprite_priorities[count] = (a >> 5) & 1;
@@ -341,19 +441,22 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 			}
 			ppu->sprite_cnt = count;
 		}
-		else {
+		else if (actions & dotClearSprites) {
 			ppu->sprite_cnt = 0;
 		}
 	}
 
 	// v_blank logic
-	if (ppu->scanline == 241 && ppu->cycle == 1) {
+	if (actions & dotVBlank) {
 		// set v_blank
 		std::swap(ppu->front, ppu->back);
+		if (nes->ppu_trace != nullptr) {
+			nes->ppu_trace->frames.push_back(hashFrame(ppu->front));
+		}
 		ppu->nmi_occurred = true;
 		PPUnmiShift(ppu);
 	}
-	if (preline && ppu->cycle == 1) {
+	if (actions & dotPrerender) {
 		// clear v_blank
 		ppu->nmi_occurred = false;
 		PPUnmiShift(ppu);
@@ -363,6 +466,26 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 	}
 }
 
+// Runs the PPU for 'dots' dots, counting through stretches of dots that do
+// nothing, like most of vblank, in one go.
+template <bool hooks>
+static inline void tickPPUs(NES* nes, int dots) {
+	PPU* ppu = nes->ppu;
+	while (dots > 0) {
+		if (ppu->cycle < 340 && ppu->nmi_delay == 0) {
+			const int idle = std::min(static_cast<int>(dot_table.idle[dot_table.kinds[ppu->scanline]][ppu->cycle + 1]), dots);
+			if (idle > 0) {
+				ppu->ticks += static_cast<uint64_t>(idle);
+				ppu->cycle += idle;
+				dots -= idle;
+				continue;
+			}
+		}
+		tickPPU<hooks>(nes, nes->cpu, ppu);
+		--dots;
+	}
+}
+
 void pulseTickEnvelope(Pulse* p) {
 	if (p->envelope_start) {
 		p->envelope_vol = 15;
@@ -498,16 +621,141 @@ void triggerIRQ(CPU* cpu) {
 	}
 }
 
-void Mapper4::updateCounter(CPU* cpu) {
-	if (counter == 0) {
-		counter = reload;
+// PPU tick at which the PPU reaches (scanline, cycle) of the given frame, which
+// must not be in the past. The dot skipped at the end of odd frames is taken
+// into account assuming the current rendering state holds until then.
+uint64_t ppuTickAtFrame(PPU* ppu, uint64_t frame, int scanline, int cycle) {
+	const uint64_t frames = frame - ppu->frame;
+	uint64_t dots = frames * 262 * 341 + static_cast<uint64_t>((scanline - ppu->scanline) * 341 + (cycle - ppu->cycle));
+	if (frames > 0 && (ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0)) {
+		// odd frames alternate starting with the current one, whose skip
+		// is already behind us once the PPU sits on the last dot
+		uint64_t skips = ppu->f == 1 ? (frames + 1) / 2 : frames / 2;
+		if (ppu->f == 1 && ppu->scanline == 261 && ppu->cycle == 340) {
+			--skips;
+		}
+		dots -= skips;
 	}
-	else {
-		--counter;
-		if (counter == 0 && IRQ_enable) {
-			triggerIRQ(cpu);
+	return ppu->ticks + dots;
+}
+
+// PPU tick at which the PPU will next reach (scanline, cycle).
+uint64_t ppuTickAt(PPU* ppu, int scanline, int cycle) {
+	const bool ahead = scanline > ppu->scanline || (scanline == ppu->scanline && cycle > ppu->cycle);
+	return ppuTickAtFrame(ppu, ppu->frame + (ahead ? 0 : 1), scanline, cycle);
+}
+
+// Opaque pixels of the background tile v points at, leftmost in bit 7.
+static uint8_t backgroundMask(NES* nes, uint16_t v) {
+	const uint8_t tile = readPPU(nes, 0x2000 | (v & 0x0FFF));
+	const uint16_t address = (static_cast<uint16_t>(nes->ppu->flag_background_tbl) << 12) + (static_cast<uint16_t>(tile) << 4) + ((v >> 12) & 7);
+	return readPPU(nes, address) | readPPU(nes, address + 8);
+}
+
+// The background tiles of one line. Pixel x shows pixel x + fine x of them,
+// counting from the first of the two fetched at the end of the line before.
+// The first 'loaded' tiles already sit in tile_data, which has been shifted
+// 'shifted' times since the line started, negative during those fetches.
+struct LineTiles {
+	uint16_t v; // vertical scroll, and horizontal position of the first tile
+	int shifted;
+	int loaded;
+	uint64_t tile_data;
+};
+
+static bool backgroundOpaque(NES* nes, const LineTiles& line, int pixel) {
+	const int tile = pixel >> 3;
+	if (tile < line.loaded) {
+		return ((line.tile_data >> (60 - 4 * (pixel - line.shifted))) & 3) != 0;
+	}
+	const int position = (((line.v >> 5) & 32) | (line.v & 31)) + tile;
+	const uint16_t v = static_cast<uint16_t>((line.v & 0xFBE0) | ((position & 32) << 5) | (position & 31));
+	return ((backgroundMask(nes, v) >> (7 - (pixel & 7))) & 1) != 0;
+}
+
+// PPU tick of the next dot with sprite 0 over opaque background, which is
+// when sprite 0 hit gets set, or NO_EVENT if there is none. It looks through
+// the rest of the picture being drawn, or all of the next one once the
+// current one is done, assuming the registers, OAM, CHR and nametables stay
+// as they are. Fetches go through readPPU(), so boards with fetch hooks
+// can't use it.
+uint64_t predictSpriteZeroHit(NES* nes) {
+	PPU* ppu = nes->ppu;
+	if (ppu->flag_show_background == 0 || ppu->flag_show_sprites == 0) return NO_EVENT;
+	const bool next = ppu->scanline >= 240;
+	const int first = next ? 0 : ppu->scanline;
+	const int h = ppu->flag_sprite_size != 0 ? 16 : 8;
+	const int left = ppu->flag_show_left_background != 0 && ppu->flag_show_left_sprites != 0 ? 0 : 8;
+
+	// the pre-render line loads t into v, and every line ends moving it down
+	uint16_t vertical = next ? ppu->t : ppu->v;
+	for (int line = first; line < 240; ++line) {
+		if (line != first && (next || line > first + 1 || ppu->cycle < 256)) {
+			vertical = incrementY(vertical);
+		}
+
+		// sprites are evaluated at dot 257 of the line before
+		uint32_t pattern;
+		int sprite_x;
+		if (!next && (line == first || (line == first + 1 && ppu->cycle >= 257))) {
+			if (ppu->sprite_cnt == 0 || ppu->sprite_idx[0] != 0) continue;
+			pattern = ppu->sprite_patterns[0];
+			sprite_x = ppu->sprite_pos[0];
+		}
+		else {
+			const int row = line - 1 - static_cast<int>(ppu->oam_tbl[0]);
+			if (line == 0 || row < 0 || row >= h) continue;
+			const uint16_t address = spriteAddress(ppu, 0, row);
+			pattern = spritePattern(readPPU(nes, address), readPPU(nes, address + 8), ppu->oam_tbl[2]);
+			sprite_x = ppu->oam_tbl[3];
+		}
+
+		// the line's first two tiles are fetched at dots 321-336 of the line before
+		LineTiles tiles = { static_cast<uint16_t>((vertical & 0xFBE0) | (ppu->t & 0x041F)), 0, 0, ppu->tile_data };
+		const bool current = !next && line == first;
+		if (current || (!next && line == first + 1 && ppu->cycle >= 321)) {
+			if (current && ppu->cycle >= 255) continue;
+			tiles.shifted = current ? ppu->cycle : std::min(ppu->cycle, 336) - 336;
+			tiles.loaded = (tiles.shifted + 16) >> 3;
+			const int position = ((((ppu->v >> 5) & 32) | (ppu->v & 31)) - tiles.loaded) & 63;
+			tiles.v = static_cast<uint16_t>((ppu->v & 0xFBE0) | ((position & 32) << 5) | (position & 31));
+		}
+
+		for (int offset = 0; offset < 8; ++offset) {
+			const int x = sprite_x + offset;
+			if (x >= 255) break;
+			if (x < left || (current && x < ppu->cycle)) continue;
+			if (((pattern >> ((7 - offset) * 4)) & 3) == 0) continue;
+			if (backgroundOpaque(nes, tiles, x + ppu->x)) {
+				return ppuTickAtFrame(ppu, ppu->frame + next, line, x + 1);
+			}
+		}
+	}
+	return NO_EVENT;
+}
+
+// PPU tick at which sprite evaluation next finds more than eight sprites on
+// a line, setting sprite overflow, with the same reach and assumptions as
+// predictSpriteZeroHit().
+uint64_t predictSpriteOverflow(NES* nes) {
+	PPU* ppu = nes->ppu;
+	if (ppu->flag_show_background == 0 && ppu->flag_show_sprites == 0) return NO_EVENT;
+	const bool next = ppu->scanline >= 240;
+	const int first = next ? 0 : ppu->scanline + (ppu->cycle >= 257);
+	const int h = ppu->flag_sprite_size != 0 ? 16 : 8;
+	uint8_t counts[240] = {};
+	for (int i = 0; i < 64; ++i) {
+		const int y = ppu->oam_tbl[4 * i];
+		for (int line = std::max(y, first); line < y + h && line < 240; ++line) {
+			++counts[line];
+		}
+	}
+	for (int line = first; line < 240; ++line) {
+		if (counts[line] > 8) {
+			return ppuTickAtFrame(ppu, ppu->frame + next, line, 257);
 		}
 	}
+	return NO_EVENT;
 }
 
 void tickAPU(NES* nes, APU* apu) {
@@ -539,6 +787,9 @@ void tickAPU(NES* nes, APU* apu) {
 			if (d->cur_len > 0 && d->bit_count == 0) {
 				nes->cpu->stall += 4;
 				d->shift_reg = readByte(nes, d->cur_addr);
+				if (nes->apu_log != nullptr) {
+					nes->apu_log->record(apu->cycle, TraceRead, d->cur_addr, d->shift_reg);
+				}
 				d->bit_count = 8;
 				++d->cur_addr;
 				if (d->cur_addr == 0) {
@@ -653,59 +904,442 @@ void tickAPU(NES* nes, APU* apu) {
 		const uint8_t dOut = apu->dmc.value;
 
 		// combined outputs
-		float output[2];
-		output[1] = output[0] = tnd_tbl[(3 * tri_output) + (2 * noise_out) + dOut] + pulse_tbl[p1_output + p2_output];
+		if (apu->sample_count < apu->sample_capacity) {
+			apu->samples[apu->sample_count++] = tnd_tbl[(3 * tri_output) + (2 * noise_out) + dOut] + pulse_tbl[p1_output + p2_output];
+		}
+	}
+}
+
+// Everything but the CPU catching up on the cycles of one instruction.
+template <bool hooks>
+static inline void tickDevices(NES* nes, int cpuCycles) {
+	tickPPUs<hooks>(nes, cpuCycles * 3);
+	// the CPU only samples interrupts between instructions, so checking
+	// scheduled mapper events once per instruction is exact enough
+	if (nes->ppu->ticks >= nes->mapper_event) {
+		nes->mapper->runEvent(nes);
+	}
 
-		if (Pa_GetStreamWriteAvailable(apu->stream)) Pa_WriteStream(apu->stream, output, 1);
+	for (int i = 0; i < cpuCycles; ++i) {
+		tickAPU(nes, nes->apu);
 	}
 }
 
-void emulate(NES* nes, double seconds) {
-	int cycles = static_cast<int>(CPU_FREQ * seconds + 0.5);
-	while (cycles > 0) {
-		int cpuCycles = 0;
-		CPU* cpu = nes->cpu;
-		if (cpu->stall > 0) {
-			--cpu->stall;
-			cpuCycles = 1;
+// Short loops, such as copying a table to $2007, clearing RAM or waiting
+// on $2002, run for many iterations in a row. Once a branch has jumped back
+// to the top of one, its instructions are decoded once and rerun from that
+// decoding, skipping the opcode and operand fetches through the mapper.
+// Every instruction still executes on its own (idle loops aside, see below),
+// with the PPU and APU ticked after it exactly as in run(). It gives
+// the loop back to run() as soon as anything might break the decoding or
+// needs run() to handle it: an interrupt, a DMA stall, a write that could
+// switch banks or modify the loop itself, or leaving the loop.
+struct LoopOp {
+	const Instruction* instruction;
+	uint16_t next;    // PC after it
+	uint16_t operand; // absolute or zero page address, immediate address, or branch target
+	bool writes;      // stores to its operand address
+	bool pushes;      // pushes to the stack
+};
+
+constexpr int MAX_LOOP_BYTES = 32;
+constexpr int MAX_LOOP_OPS = 12;
+
+static bool decodeLoop(NES* nes, uint16_t start, uint16_t branch, LoopOp* ops, int* count) {
+	// code outside RAM, PRG-RAM and ROM might be a register
+	if (start >= 0x2000 && start < 0x6000) return false;
+	int n = 0;
+	uint16_t pc = start;
+	while (pc <= branch) {
+		if (n == MAX_LOOP_OPS) return false;
+		const uint8_t opcode = readByte(nes, pc);
+		const Instruction* instruction = &instructions[opcode];
+		const bool last = pc == branch;
+		if (instruction->size == 0 || instruction->mode == modeIndirect || (instruction->mode == modeRelative) != last) return false;
+		// BRK, JSR, RTI, RTS and JMP
+		if (opcode == 0x00 || opcode == 0x20 || opcode == 0x40 || opcode == 0x60 || opcode == 0x4C) return false;
+
+		LoopOp* op = &ops[n++];
+		op->instruction = instruction;
+		op->next = pc + instruction->size;
+		if (instruction->mode == modeRelative) {
+			const uint16_t offset = readByte(nes, pc + 1);
+			op->operand = pc + 2 + offset - ((offset >= 128) << 8);
+		}
+		else if (instruction->mode == modeImmediate) {
+			op->operand = pc + 1;
+		}
+		else if (instruction->size == 3) {
+			op->operand = read16(nes, pc + 1);
+		}
+		else if (instruction->size == 2) {
+			op->operand = readByte(nes, pc + 1);
 		}
 		else {
-			uint64_t startCycles = cpu->cycles;
+			op->operand = 0;
+		}
+		op->writes = writesOperand(*instruction);
+		op->pushes = pushesStack(*instruction);
+		pc = op->next;
+	}
+	*count = n;
+	return pc == branch + 2;
+}
+
+// A loop that stores nothing and comes back around in the state it started
+// in, like one polling $2002 or waiting for the NMI handler to change a
+// variable, repeats exactly until something it reads changes or an
+// interrupt arrives. Whole passes of one can then be run by ticking the
+// PPU and APU alone, up to just before the next of: the status it reads
+// changing, which is where sprite 0 hit and overflow prediction come in,
+// vblank starting, a mapper event, or the end of the cycles given.
+struct IdlePass {
+	int cycles;     // length of the pass
+	int last_poll;  // cycles into the pass of its last $2002 read, or -1
+	uint8_t status; // what the $2002 reads returned
+};
+
+static inline uint8_t peekStatus(const PPU* ppu) {
+	return static_cast<uint8_t>((ppu->reg & 0x1F) | (ppu->flag_sprite_overflow << 5) | (ppu->flag_sprite_zero_hit << 6) | (ppu->nmi_occurred ? 0x80 : 0));
+}
+
+// Skips whole passes of an idle loop that just made 'pass', returning the
+// cycles skipped. 'until' is set to the tick before which skipping again
+// would stop at the same place.
+static int skipIdle(NES* nes, const IdlePass& pass, int cycles, uint64_t* until) {
+	CPU* cpu = nes->cpu;
+	PPU* ppu = nes->ppu;
+	APU* apu = nes->apu;
+	*until = NO_EVENT;
+	// a DMC fetch stalls the CPU, and a frame IRQ interrupts it
+	if (ppu->nmi_delay > 0 || (apu->dmc.enabled && apu->dmc.cur_len > 0) || (apu->frame_IRQ && apu->frame_period == 4 && getI(cpu) == 0)) {
+		return 0;
+	}
+	uint64_t change = NO_EVENT;
+	if (pass.last_poll >= 0) {
+		if (peekStatus(ppu) != pass.status) {
+			*until = ppu->ticks;
+			return 0;
+		}
+		if (ppu->flag_sprite_zero_hit == 0) {
+			change = std::min(change, predictSpriteZeroHit(nes));
+		}
+		if (ppu->flag_sprite_overflow == 0) {
+			change = std::min(change, predictSpriteOverflow(nes));
+		}
+		if (ppu->flag_sprite_zero_hit != 0 || ppu->flag_sprite_overflow != 0) {
+			change = std::min(change, ppuTickAt(ppu, 261, 1));
+		}
+	}
+	const uint64_t end = std::min(ppuTickAt(ppu, 241, 1), nes->mapper_event);
+	*until = std::min(change, end);
+	if (end <= ppu->ticks) return 0;
+
+	// passes that end before 'end' and whose reads come before 'change'
+	const uint64_t length = 3 * static_cast<uint64_t>(pass.cycles);
+	uint64_t passes = std::min((end - 1 - ppu->ticks) / length, static_cast<uint64_t>((cycles - 1) / pass.cycles));
+	if (change != NO_EVENT) {
+		const uint64_t poll = ppu->ticks + 3 * static_cast<uint64_t>(pass.last_poll);
+		passes = change > poll ? std::min(passes, (change - 1 - poll) / length + 1) : 0;
+	}
+	if (passes < 2) return 0;
+
+	const int skipped = static_cast<int>(passes) * pass.cycles;
+	tickPPUs<false>(nes, 3 * skipped);
+	for (int i = 0; i < skipped; ++i) {
+		tickAPU(nes, apu);
+	}
+	cpu->cycles += static_cast<uint64_t>(skipped);
+	return skipped;
+}
 
-			if (cpu->interrupt == interruptNMI) {
-				push16(nes, cpu->PC);
-				php(cpu, nes, 0, 0);
-				cpu->PC = read16(nes, 0xFFFA);
-				setI(cpu, true);
-				cpu->cycles += 7;
+// Runs the loop that starts at PC for at most 'cycles' cycles, returning
+// the cycles used.
+template <bool hooks>
+static int runLoop(NES* nes, uint16_t branch, int cycles) {
+	CPU* cpu = nes->cpu;
+	const uint16_t start = cpu->PC;
+	LoopOp ops[MAX_LOOP_OPS];
+	int count;
+	if (!decodeLoop(nes, start, branch, ops, &count)) return 0;
+
+	bool idle = !hooks;
+	for (int i = 0; i < count && idle; ++i) {
+		idle = !ops[i].writes && !ops[i].pushes;
+	}
+	uint64_t retry = 0;
+
+	const int budget = cycles;
+	for (;;) {
+		const uint8_t A = cpu->A, X = cpu->X, Y = cpu->Y, SP = cpu->SP, flags = cpu->flags;
+		const uint64_t pass_start = cpu->cycles;
+		IdlePass pass = { 0, -1, 0 };
+		bool still = idle;
+		for (int i = 0; i < count; ++i) {
+			const LoopOp& op = ops[i];
+			const Instruction& instruction = *op.instruction;
+			uint16_t address = op.operand;
+			bool page_crossed = false;
+			switch (instruction.mode) {
+			case modeAbsoluteX:
+				address += cpu->X;
+				page_crossed = pagesDiffer(op.operand, address);
+				break;
+			case modeAbsoluteY:
+				address += cpu->Y;
+				page_crossed = pagesDiffer(op.operand, address);
+				break;
+			case modeIndexedIndirect:
+				address = read16_ff_bug(nes, static_cast<uint16_t>(static_cast<uint8_t>(op.operand + cpu->X)));
+				break;
+			case modeIndirectIndexed:
+				address = read16_ff_bug(nes, op.operand) + static_cast<uint16_t>(cpu->Y);
+				page_crossed = pagesDiffer(address - static_cast<uint16_t>(cpu->Y), address);
+				break;
+			case modeZeroPageX:
+				address = static_cast<uint8_t>(op.operand + cpu->X);
+				break;
+			case modeZeroPageY:
+				address = static_cast<uint8_t>(op.operand + cpu->Y);
+				break;
 			}
-			else if (cpu->interrupt == interruptIRQ) {
-				push16(nes, cpu->PC);
-				php(cpu, nes, 0, 0);
-				cpu->PC = read16(nes, 0xFFFE);
-				setI(cpu, true);
-				cpu->cycles += 7;
+
+			// RAM, PRG-RAM and ROM read back the same every pass
+			if (still && address >= 0x2000 && address < 0x6000) {
+				if (address < 0x4000 && (address & 7) == 2 && (pass.last_poll < 0 || peekStatus(nes->ppu) == pass.status)) {
+					pass.last_poll = static_cast<int>(cpu->cycles - pass_start);
+					pass.status = peekStatus(nes->ppu);
+				}
+				else {
+					still = false;
+				}
+			}
+
+			const uint64_t startCycles = cpu->cycles;
+			cpu->PC = op.next;
+			cpu->cycles += static_cast<uint64_t>(instruction.cycles);
+			if (page_crossed) {
+				cpu->cycles += static_cast<uint64_t>(instruction.page_cross_cycles);
 			}
-			cpu->interrupt = interruptNone;
-			uint8_t opcode = readByte(nes, cpu->PC);
-			execute(nes, opcode);
-			cpuCycles = static_cast<int>(cpu->cycles - startCycles);
+			instruction.dispatch(cpu, nes, address, instruction.mode);
+			const int cpuCycles = static_cast<int>(cpu->cycles - startCycles);
+			tickDevices<hooks>(nes, cpuCycles);
+			cycles -= cpuCycles;
+
+			if (cycles <= 0 || cpu->interrupt != interruptNone || cpu->stall > 0) return budget - cycles;
+			// bank switches, and stores into the loop itself
+			if (op.writes && (address >= 0x4020 || (address < 0x2000 && start < 0x2000 && ((address - start) & 0x7FF) < branch + 2 - start))) {
+				return budget - cycles;
+			}
+		}
+		if (cpu->PC != start) return budget - cycles;
+		if (still && nes->ppu->ticks >= retry && cpu->A == A && cpu->X == X && cpu->Y == Y && cpu->SP == SP && cpu->flags == flags) {
+			pass.cycles = static_cast<int>(cpu->cycles - pass_start);
+			cycles -= skipIdle(nes, pass, cycles, &retry);
 		}
+	}
+}
 
-		const int ppuCycles = cpuCycles * 3;
-		for (int i = 0; i < ppuCycles; ++i) {
-			PPU* ppu = nes->ppu;
-			tickPPU(nes, nes->cpu, ppu);
+// Runs one instruction, or a stretch of a loop it jumps back into, and
+// returns the cycles used.
+template <bool hooks>
+static int step(NES* nes, int cycles) {
+	int cpuCycles = 0;
+	CPU* cpu = nes->cpu;
+	uint16_t branch = 0;
+	if (cpu->stall > 0) {
+		--cpu->stall;
+		cpuCycles = 1;
+	}
+	else {
+		uint64_t startCycles = cpu->cycles;
 
-			if ((ppu->cycle == 280) && (ppu->scanline <= 239 || ppu->scanline >= 261) && (ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0)) {
-				nes->mapper->updateCounter(nes->cpu);
+		if (cpu->interrupt == interruptNMI) {
+			push16(nes, cpu->PC);
+			php(cpu, nes, 0, 0);
+			cpu->PC = read16(nes, 0xFFFA);
+			setI(cpu, true);
+			cpu->cycles += 7;
+		}
+		else if (cpu->interrupt == interruptIRQ) {
+			push16(nes, cpu->PC);
+			php(cpu, nes, 0, 0);
+			cpu->PC = read16(nes, 0xFFFE);
+			setI(cpu, true);
+			cpu->cycles += 7;
+		}
+		cpu->interrupt = interruptNone;
+		const uint16_t pc = cpu->PC;
+		uint8_t opcode = readByte(nes, pc);
+		execute(nes, opcode);
+		cpuCycles = static_cast<int>(cpu->cycles - startCycles);
+		// a conditional branch taken back a short way
+		if ((opcode & 0x1F) == 0x10 && cpu->PC < pc && pc - cpu->PC < MAX_LOOP_BYTES) {
+			branch = pc;
+		}
+	}
+
+	tickDevices<hooks>(nes, cpuCycles);
+
+	if (branch != 0 && cycles > cpuCycles && cpu->interrupt == interruptNone && cpu->stall == 0) {
+		cpuCycles += runLoop<hooks>(nes, branch, cycles - cpuCycles);
+	}
+	return cpuCycles;
+}
+
+template <bool hooks>
+static void run(NES* nes, int cycles) {
+	while (cycles > 0) {
+		cycles -= step<hooks>(nes, cycles);
+	}
+}
+
+// Runs a PPU trace through the PPU alone, from a freshly powered-on NES for the
+// same ROM. Finished frames are hashed into 'hashes', which has room for as
+// many frames as the trace recorded, if it isn't null.
+// Returns the number of frames finished.
+template <bool hooks>
+int replayPPUTrace(NES* nes, const PPUTrace* trace, uint64_t* hashes) {
+	PPU* ppu = nes->ppu;
+	int frames = 0;
+	uint64_t swap = ppuTickAt(ppu, 241, 1);
+	const size_t count = trace->events.size();
+	for (size_t i = 0; i <= count; ++i) {
+		const uint64_t tick = i < count ? trace->events[i].tick : trace->end_tick;
+		for (;;) {
+			const uint64_t target = tick < swap ? tick : swap;
+			if (ppu->ticks < target) {
+				tickPPUs<hooks>(nes, static_cast<int>(target - ppu->ticks));
+			}
+			while (ppu->ticks >= nes->mapper_event) {
+				nes->mapper->runEvent(nes);
+			}
+			if (ppu->ticks != swap) {
+				break;
+			}
+			if (hashes != nullptr && static_cast<size_t>(frames) < trace->frames.size()) {
+				hashes[frames] = hashFrame(ppu->front);
 			}
+			++frames;
+			swap = ppuTickAt(ppu, 241, 1);
+		}
+		if (i == count) {
+			break;
+		}
+
+		const TraceEvent& e = trace->events[i];
+		if (e.kind == TraceOAM) {
+			ppu->oam_tbl[ppu->oam_addr] = e.value;
+			++ppu->oam_addr;
+		}
+		else if (e.kind == TraceRead) {
+			readByte(nes, e.address);
+		}
+		else {
+			writeByte(nes, e.address, e.value);
+		}
+		// the write may have turned rendering on or off, which moves the odd frame skip
+		swap = ppuTickAt(ppu, 241, 1);
+	}
+	return frames;
+}
+
+template int replayPPUTrace<false>(NES* nes, const PPUTrace* trace, uint64_t* hashes);
+template int replayPPUTrace<true>(NES* nes, const PPUTrace* trace, uint64_t* hashes);
+
+void emulate(NES* nes, double seconds) {
+	emulateCycles(nes, static_cast<int>(CPU_FREQ * seconds + 0.5));
+}
+
+// Runs until the PPU next enters vertical blank, which is one whole frame
+// when called at the start of one. Frame-locked callers such as netplay
+// step with this rather than by time.
+void emulateFrame(NES* nes) {
+	emulateCycles(nes, cyclesToFrame(nes));
+}
+
+int cyclesToFrame(NES* nes) {
+	PPU* ppu = nes->ppu;
+	const uint64_t dots = ppuTickAt(ppu, 241, 1) - ppu->ticks;
+	return static_cast<int>((dots + 2) / 3);
+}
+
+// Grows the sample buffer to hold the audio of 'seconds' seconds. powerOn()
+// makes room for two frames; callers that step further at a time, like
+// fast-forward, reserve once up front so stepping never allocates.
+void reserveAudio(NES* nes, double seconds) {
+	APU* apu = nes->apu;
+	const int needed = static_cast<int>(CPU_FREQ * seconds / SAMPLE_RATE) + 2;
+	if (needed > apu->sample_capacity) {
+		delete[] apu->samples;
+		apu->samples = new float[needed];
+		apu->sample_capacity = needed;
+	}
+}
+
+// starts the audio of the next step. Samples past the capacity are dropped.
+static void startAudio(NES* nes) {
+	nes->apu->sample_count = 0;
+	nes->apu->mixed = 0;
+}
+
+void emulateCycles(NES* nes, int cycles) {
+	startAudio(nes);
+
+	if (nes->mapper->fetch_hooks) {
+		run<true>(nes, cycles);
+	}
+	else {
+		run<false>(nes, cycles);
+	}
+
+	// expansion audio for whatever is left since the last register write
+	nes->mapper->mixAudio(nes);
+}
+
+// Runs each console for its remaining cycles, an instruction at a time
+// in turn.
+template <bool hooks>
+static void interleave(NES* const* group, int* remaining, int count) {
+	bool busy = true;
+	while (busy) {
+		busy = false;
+		for (int i = 0; i < count; ++i) {
+			if (remaining[i] > 0) {
+				remaining[i] -= step<hooks>(group[i], remaining[i]);
+				busy = true;
+			}
+		}
+	}
+}
+
+// One instance on its own waits on every load of a chain like opcode fetch,
+// instruction table, mapper call. Taking turns an instruction at a time
+// between independent consoles gives the core other work to overlap those
+// stalls with.
+void emulateFrames(NES* const* consoles, int count) {
+	for (int first = 0; first < count; first += MAX_INTERLEAVE) {
+		const int n = count - first < MAX_INTERLEAVE ? count - first : MAX_INTERLEAVE;
+		NES* const* group = consoles + first;
+		int remaining[MAX_INTERLEAVE];
+		bool hooks = false;
+		for (int i = 0; i < n; ++i) {
+			remaining[i] = cyclesToFrame(group[i]);
+			startAudio(group[i]);
+			hooks = hooks || group[i]->mapper->fetch_hooks;
+		}
+
+		// step<true> is only slower, never different, for mappers without hooks
+		if (hooks) {
+			interleave<true>(group, remaining, n);
+		}
+		else {
+			interleave<false>(group, remaining, n);
 		}
 
-		for (int i = 0; i < cpuCycles; ++i) {
-			tickAPU(nes, nes->apu);
+		for (int i = 0; i < n; ++i) {
+			group[i]->mapper->mixAudio(group[i]);
 		}
-		cycles -= cpuCycles;
 	}
 }
 
@@ -75,19 +75,33 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <iostream>
-
-#include <portaudio.h>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 constexpr int INES_MAGIC = 0x1a53454e;
 constexpr double CPU_FREQ = 1789773.0;
 constexpr double FRAME_CTR_FREQ = CPU_FREQ / 240.0;
 constexpr double SAMPLE_RATE = CPU_FREQ / (44100.0);
 
+// no mapper event scheduled
+constexpr uint64_t NO_EVENT = UINT64_MAX;
+
+// frame buffer colors of the 64 palette entries
+constexpr uint32_t palette[] = { 0xff666666, 0xff882a00, 0xffa71214, 0xffa4003b, 0xff7e005c, 0xff40006e, 0xff00066c, 0xff001d56, 0xff003533, 0xff00480b, 0xff005200, 0xff084f00, 0xff4d4000, 0xff000000, 0xff000000, 0xff000000, 0xffadadad, 0xffd95f15, 0xffff4042, 0xfffe2775, 0xffcc1aa0, 0xff7b1eb7, 0xff2031b5, 0xff004e99, 0xff006d6b, 0xff008738, 0xff00930c, 0xff328f00, 0xff8d7c00, 0xff000000, 0xff000000, 0xff000000, 0xfffffeff, 0xffffb064, 0xffff9092, 0xffff76c6, 0xffff6af3, 0xffcc6efe, 0xff7081fe, 0xff229eea, 0xff00bebc, 0xff00d888, 0xff30e45c, 0xff82e045, 0xffdecd48, 0xff4f4f4f, 0xff000000, 0xff000000, 0xfffffeff, 0xffffdfc0, 0xffffd2d3, 0xffffc8e8, 0xffffc2fb, 0xffeac4fe, 0xffc5ccfe, 0xffa5d8f7, 0xff94e5e4, 0xff96efcf, 0xffabf4bd, 0xffccf3b3, 0xfff2ebb5, 0xffb8b8b8, 0xff000000, 0xff000000 };
+
 enum Buttons {
 	ButtonA = 0,
 	ButtonB = 1,
@@ -126,7 +140,8 @@ enum MirrorModes {
 	MirrorVertical = 1,
 	MirrorSingle0 = 2,
 	MirrorSingle1 = 3,
-	MirrorFour = 4
+	MirrorFour = 4,
+	MirrorMapper = 5 // nametables are mapped by the mapper
 };
 
 struct iNESHeader {
@@ -139,6 +154,22 @@ struct iNESHeader {
 	uint8_t padding[7];
 };
 
+// Consoles are saved, compared and hashed as the raw bytes of their
+// structs, so the ones that make up a console come from zeroed memory.
+// Their padding then stays zero and equal states have equal bytes. It's
+// calloc() because the compiler may drop a memset() before a constructor.
+struct ZeroedState {
+	static void* operator new(size_t size) {
+		void* p = calloc(1, size);
+		if (p == nullptr) throw std::bad_alloc();
+		return p;
+	}
+
+	static void operator delete(void* p) {
+		free(p);
+	}
+};
+
 // APU Delta Modulation Channel
 struct DMC {
 	bool enabled;
@@ -219,8 +250,13 @@ struct Noise {
 	Noise() : enabled(false), mode(false), shift_reg(0), length_enabled(false), length_val(0), timer_period(0), timer_val(0), envelope_enabled(false), envelope_loop(false), envelope_start(false), envelope_period(0), envelope_val(0), envelope_vol(0), const_vol(0) {}
 };
 
-struct APU {
-	PaStream* stream;
+struct APU : public ZeroedState {
+	// mono output at 44.1 kHz for the time covered by the last emulate() call
+	float* samples;
+	int sample_count;
+	int sample_capacity;
+	int mixed; // samples that expansion audio has been mixed into so far
+
 	Pulse pulse1;
 	Pulse pulse2;
 	Triangle triangle;
@@ -231,9 +267,168 @@ struct APU {
 	uint8_t frame_val;
 	bool frame_IRQ;
 
-	APU() : cycle(0), frame_period(0), frame_val(0), frame_IRQ(false) {}
+	APU() : samples(nullptr), sample_count(0), sample_capacity(0), mixed(0), cycle(0), frame_period(0), frame_val(0), frame_IRQ(false) {}
+};
+
+// Expansion sound chips. Rather than being clocked with the APU, each one
+// renders its channels a block of samples at a time, adding into the APU
+// output. The owning mapper brings it up to the current sample with
+// Mapper::mixAudio() before any register write that changes its output,
+// and emulate() does so once more at the end, so a block runs from one
+// register write to the next.
+struct ExpansionAudio {
+	virtual void render(float* out, int count) = 0;
+
+	// The vtable pointer differs from process to process, so saved copies
+	// of a mapper have their chip's cleared. Assigning from one leaves the
+	// live one alone.
+	void clearVtable() {
+		memset(static_cast<void*>(this), 0, sizeof(void*));
+	}
+};
+
+// VRC6 Pulse Channel
+struct VRC6Pulse {
+	bool enabled;
+	bool mode; // ignore duty, output volume constantly
+	uint8_t duty;
+	uint8_t volume;
+	uint16_t period;
+	float phase; // 0-16 duty steps
+
+	VRC6Pulse() : enabled(false), mode(false), duty(0), volume(0), period(0), phase(0.0f) {}
+};
+
+// VRC6 Sawtooth Channel
+struct VRC6Saw {
+	bool enabled;
+	uint8_t rate;
+	uint16_t period;
+	float phase; // 0-14 accumulator steps
+
+	VRC6Saw() : enabled(false), rate(0), period(0), phase(0.0f) {}
+};
+
+// Konami VRC6: two pulses and a sawtooth
+struct VRC6Audio : public ExpansionAudio {
+	VRC6Pulse pulse1;
+	VRC6Pulse pulse2;
+	VRC6Saw saw;
+	bool halt;
+	uint8_t shift; // $9003 frequency scaling
+
+	// 'address' with the board's A0/A1 swap already undone
+	void write(uint16_t address, uint8_t value);
+	void render(float* out, int count);
+
+	VRC6Audio() : halt(false), shift(0) {}
+};
+
+enum EnvelopeStates {
+	EnvelopeAttack = 0,
+	EnvelopeDecay = 1,
+	EnvelopeSustain = 2,
+	EnvelopeRelease = 3,
+	EnvelopeOff = 4
+};
+
+// VRC7 FM operator
+struct OPLLOperator {
+	uint32_t phase;     // one cycle is 1 << 27
+	float env;          // attenuation in 0.375 dB steps, 0 loudest, 127 silent
+	uint8_t env_state;
+	int out[2];         // last two outputs, for modulator feedback
+
+	OPLLOperator() : phase(0), env(127.0f), env_state(EnvelopeOff), out{ 0, 0 } {}
 };
 
+// VRC7 FM channel: a modulator and a carrier
+struct OPLLChannel {
+	uint16_t fnum;
+	uint8_t block;
+	bool key;
+	bool sustain;
+	uint8_t instrument;
+	uint8_t volume;
+	OPLLOperator mod;
+	OPLLOperator car;
+
+	OPLLChannel() : fnum(0), block(0), key(false), sustain(false), instrument(0), volume(0) {}
+};
+
+// Konami VRC7: six 2-operator FM channels, a cut-down YM2413 (OPLL)
+// with 15 fixed instruments and one custom one. Operators run off log-sine
+// and exponent tables the way the real chip does, at the output rate.
+struct VRC7Audio : public ExpansionAudio {
+	uint8_t address;
+	uint8_t custom[8]; // instrument 0
+	OPLLChannel channels[6];
+	bool silenced;
+	float am_phase;
+	float vib_phase;
+
+	void write(uint8_t value);
+	void keyOn(OPLLChannel* c);
+	void render(float* out, int count);
+
+	VRC7Audio() : address(0), custom{ 0, 0, 0, 0, 0, 0, 0, 0 }, silenced(false), am_phase(0.0f), vib_phase(0.0f) {}
+};
+
+// Namco 163: up to 8 wavetable channels playing 4-bit samples out of
+// 128 bytes of internal RAM, which also holds their registers at $40-$7F.
+// The hardware updates one channel every 15 CPU cycles; here all active
+// channels are stepped together every sample and averaged, which is what
+// the time-multiplexed output sounds like.
+struct N163Audio : public ExpansionAudio {
+	uint8_t ram[128];
+	uint8_t address;
+	bool auto_increment;
+	bool disabled;
+	uint32_t phase[8]; // wave position of each channel in samples, 8.16 fixed point
+
+	uint8_t read();
+	void writeAddress(uint8_t value);
+	void writeData(uint8_t value);
+	void render(float* out, int count);
+
+	N163Audio() : address(0), auto_increment(false), disabled(false), phase{ 0, 0, 0, 0, 0, 0, 0, 0 } {
+		memset(ram, 0, 128);
+	}
+};
+
+// Sunsoft 5B: an AY-3-8910 clone. Three square channels, a noise
+// generator and a volume envelope, all on a logarithmic volume scale.
+struct Sunsoft5BAudio : public ExpansionAudio {
+	uint8_t address;
+	uint8_t regs[16];
+	float tone_phase[3];
+	bool tone_out[3];
+	float noise_phase;
+	uint32_t noise_reg;
+	float env_phase;
+	int env_step;
+	bool env_attack;
+	bool env_holding;
+
+	void write(uint8_t value);
+	void render(float* out, int count);
+
+	Sunsoft5BAudio() : address(0), tone_phase{ 0.0f, 0.0f, 0.0f }, tone_out{ false, false, false }, noise_phase(0.0f), noise_reg(1),
+		env_phase(0.0f), env_step(0), env_attack(false), env_holding(false) {
+		memset(regs, 0, 16);
+	}
+};
+
+// 64-bit FNV-1a, continued from 'h'
+inline uint64_t hashBytes(uint64_t h, const uint8_t* data, int size) {
+	for (int i = 0; i < size; ++i) {
+		h = (h ^ data[i]) * 0x100000001B3ULL;
+	}
+	return h;
+}
+
+constexpr uint64_t HASH_SEED = 0xCBF29CE484222325ULL;
+
 struct Cartridge {
 	bool initialized;
 	uint8_t* PRG; // PRG-ROM banks
@@ -241,13 +436,18 @@ struct Cartridge {
 	uint8_t* CHR; // CHR-ROM banks
 	int chr_size;
 	uint8_t* SRAM; // Save RAM
+	int sram_size;
 	bool trainer_present;
 	uint8_t* trainer;
 	uint8_t mapper; // mapper type
 	uint8_t mirror; // mirroring mode
 	uint8_t battery_present; // battery present
+	bool chr_ram; // CHR is writable RAM rather than ROM
+	uint64_t hash; // of mapper number, PRG- and CHR-ROM. Identifies the game in anything saved to disk
+	std::atomic<int>* rom_users; // cartridges sharing PRG-ROM, CHR-ROM and the trainer
 
-	Cartridge(const char* path, const char* SRAM_path) : initialized(false) {
+	Cartridge(const char* path, const char* SRAM_path) : initialized(false), PRG(nullptr), prg_size(0), CHR(nullptr), chr_size(0),
+		SRAM(nullptr), sram_size(0), trainer_present(false), trainer(nullptr), chr_ram(false), rom_users(new std::atomic<int>(1)) {
 		FILE* fp = fopen(path, "rb");
 		if (fp == nullptr) {
 			std::cerr << "ERROR: failed to open ROM file!" << std::endl;
@@ -296,6 +496,7 @@ struct Cartridge {
 		}
 
 		chr_size = static_cast<int>(header.num_chr) << 13;
+		chr_ram = chr_size == 0;
 		if (chr_size == 0) {
 			chr_size = 8192;
 			CHR = new uint8_t[8192];
@@ -312,15 +513,23 @@ struct Cartridge {
 
 		fclose(fp);
 
-		SRAM = new uint8_t[8192];
+		hash = hashBytes(HASH_SEED, &mapper, 1);
+		hash = hashBytes(hash, PRG, prg_size);
+		if (header.num_chr != 0) {
+			hash = hashBytes(hash, CHR, chr_size);
+		}
+
+		// MMC5 banks up to 64k of PRG-RAM
+		sram_size = mapper == 5 ? 65536 : 8192;
+		SRAM = new uint8_t[sram_size];
 
-		memset(SRAM, 0, 8192);
+		memset(SRAM, 0, static_cast<size_t>(sram_size));
 		if (battery_present) {
 			// try to read saved SRAM
-			std::cout << "Attempting to read previously saved SRAM..." << std::endl;
+			std::cout << "Attempting to read previously saved SRAM...\n";
 			fp = fopen(SRAM_path, "rb");
-			if (fp == nullptr || (fread(SRAM, 8192, 1, fp) != 1)) {
-				std::cout << "WARN: failed to open SRAM file!" << std::endl;
+			if (fp == nullptr || (fread(SRAM, static_cast<size_t>(sram_size), 1, fp) != 1)) {
+				std::cout << "WARN: failed to open SRAM file!\n";
 			}
 			else {
 				fclose(fp);
@@ -328,9 +537,38 @@ struct Cartridge {
 		}
 		initialized = true;
 	}
+
+	// a copy for another console: ROM is shared, SRAM and CHR-RAM are its
+	// own (contents left for copyState() to fill in)
+	Cartridge(const Cartridge& other) : initialized(other.initialized), PRG(other.PRG), prg_size(other.prg_size),
+		CHR(other.CHR), chr_size(other.chr_size), SRAM(new uint8_t[other.sram_size]), sram_size(other.sram_size),
+		trainer_present(other.trainer_present), trainer(other.trainer), mapper(other.mapper), mirror(other.mirror),
+		battery_present(other.battery_present), chr_ram(other.chr_ram), hash(other.hash), rom_users(other.rom_users) {
+		if (chr_ram) {
+			CHR = new uint8_t[chr_size];
+		}
+		rom_users->fetch_add(1);
+	}
+
+	Cartridge& operator=(const Cartridge&) = delete;
+
+	~Cartridge() {
+		delete[] SRAM;
+		if (chr_ram) {
+			delete[] CHR;
+		}
+		if (rom_users->fetch_sub(1) == 1) {
+			delete[] PRG;
+			delete[] trainer;
+			if (!chr_ram) {
+				delete[] CHR;
+			}
+			delete rom_users;
+		}
+	}
 };
 
-struct CPU {
+struct CPU : public ZeroedState {
 	uint64_t cycles;
 	uint16_t PC;       // program counter
 	uint8_t SP;        // stack pointer
@@ -344,10 +582,11 @@ struct CPU {
 	CPU() : cycles(0), PC(0), SP(0), A(0), X(0), Y(0), flags(0), interrupt(0), stall(0) {}
 };
 
-struct PPU {
+struct PPU : public ZeroedState {
 	int cycle; // 0-340
 	int scanline; // 0-261. 0-239 is visible, 240 is postline, 241-260 is the v_blank interval, 261 is preline
 	uint64_t frame;
+	uint64_t ticks; // dots since power-on. Mapper events are scheduled on this clock
 
 	uint8_t palette_tbl[32];
 	uint8_t name_tbl[2048];
@@ -410,7 +649,7 @@ struct PPU {
 	// $2007 PPUDATA
 	uint8_t buffered_data;
 
-	PPU() : cycle(0), scanline(0), frame(0), v(0), t(0), x(0), w(0), f(0), reg(0), nmi_occurred(false), nmi_out(false), nmi_last(false),
+	PPU() : cycle(0), scanline(0), frame(0), ticks(0), v(0), t(0), x(0), w(0), f(0), reg(0), nmi_occurred(false), nmi_out(false), nmi_last(false),
 		nmi_delay(0), name_tbl_u8(0), attrib_tbl_u8(0), low_tile_u8(0), high_tile_u8(0), tile_data(0), sprite_cnt(0), flag_name_tbl(0), flag_increment(0),
 		flag_sprite_tbl(0), flag_background_tbl(0), flag_sprite_size(0), flag_rw(0), flag_gray(0), flag_show_left_background(0), flag_show_left_sprites(0),
 		flag_show_background(0), flag_show_sprites(0), flag_red_tint(0), flag_green_tint(0), flag_blue_tint(0), flag_sprite_zero_hit(0), flag_sprite_overflow(0),
@@ -429,7 +668,7 @@ struct PPU {
 void writePPUCtrl(PPU* ppu, uint8_t x);
 void writePPUMask(PPU* ppu, uint8_t x);
 
-struct Controller {
+struct Controller : public ZeroedState {
 	uint8_t buttons;
 	uint8_t index;
 	uint8_t strobe;
@@ -437,60 +676,189 @@ struct Controller {
 	Controller() : buttons(0), index(0), strobe(0) {}
 };
 
-struct Mapper {
+struct NES;
+
+struct Mapper : public ZeroedState {
+	// if set, emulate() runs the PPU instantiation that
+	// routes pattern and nametable fetches through the fetch hooks below
+	bool fetch_hooks;
+
 	virtual uint8_t read(Cartridge* cartridge, uint16_t address) = 0;
 	virtual void write(Cartridge* cartridge, uint16_t address, uint8_t value) = 0;
-	virtual void updateCounter(CPU* cpu) = 0;
+
+	// whether a CPU write to 'address' can change the mapper's state rather
+	// than only PRG-RAM. By default everything outside $6000-$7FFF does.
+	virtual bool writesRegister(uint16_t address) const {
+		return address < 0x6000 || address >= 0x8000;
+	}
+
+	// nametable access when mirroring is MirrorMapper
+	virtual uint8_t readNametable(NES* nes, uint16_t address);
+	virtual void writeNametable(NES* nes, uint16_t address, uint8_t value);
+
+	// 'schedule' sets nes->mapper_event to the PPU tick of the mapper's next event,
+	// or NO_EVENT, and is called again whenever rendering is toggled.
+	// emulate() calls 'runEvent' once that tick has been reached.
+	virtual void schedule(NES* nes);
+	virtual void runEvent(NES* nes);
+
+	// PPU fetch hooks. Background tile, attribute and pattern fetches and sprite
+	// pattern fetches. Defaults are plain readPPU() calls.
+	virtual uint8_t fetchTile(NES* nes, uint16_t address);
+	virtual uint8_t fetchAttribute(NES* nes, uint16_t address);
+	virtual uint8_t fetchBackground(NES* nes, uint16_t address);
+	virtual uint8_t fetchSprite(NES* nes, uint16_t address);
+
+	// expansion sound chip on the board, if any
+	ExpansionAudio* audio;
+
+	// renders expansion audio up to the APU's current sample
+	void mixAudio(NES* nes);
+
+	// save states: a copy of this mapper for another console with the same
+	// cartridge, overwriting this one with another mapper of the same type,
+	// and the size of that type, for sending one as raw bytes (see saveState)
+	virtual Mapper* clone(NES* nes) const = 0;
+	virtual void copyFrom(NES* nes, const Mapper* other) = 0;
+	virtual size_t stateSize() const = 0;
+
+	// points a copied mapper at its own console and sound chip,
+	// or at no console for a saved copy when 'nes' is null, in which
+	// case the sound chip's vtable pointer is cleared too
+	virtual void rebind(NES* nes) {
+		static_cast<void>(nes);
+	}
+
+	Mapper() : fetch_hooks(false), audio(nullptr) {}
+	virtual ~Mapper() {}
 };
 
-struct Mapper1 : public Mapper {
-	uint8_t shift_reg;
-	uint8_t control;
-	uint8_t prg_mode;
-	uint8_t chr_mode;
-	uint8_t prg_bank;
-	uint8_t chr_bank0;
-	uint8_t chr_bank1;
-	int prg_offsets[2];
-	int chr_offsets[2];
+// Mappers are plain data apart from what 'rebind' fixes up, so the
+// save state methods are the same for all of them.
+template <typename T>
+Mapper* cloneMapper(const T* m, NES* nes) {
+	T* copy = new T(*m);
+	copy->rebind(nes);
+	return copy;
+}
+
+template <typename T>
+void copyMapper(T* m, NES* nes, const Mapper* other) {
+	*m = *static_cast<const T*>(other);
+	m->rebind(nes);
+}
+
+// Base for mappers that bank PRG in 8k pages and CHR in 1k pages.
+// Bank numbers are wrapped with masks precomputed from the cartridge size,
+// so switching a bank is a mask and a shift, never a modulo.
+// Negative bank numbers count back from the end, so -1 is the last bank
+// whatever the size.
+struct PagedMapper : public Mapper {
+	int prg_pages[4]; // offsets into PRG of $8000, $A000, $C000, $E000
+	int chr_pages[8]; // offsets into CHR of each 1k pattern page
+	int prg_banks;    // number of 8k PRG banks
+	int chr_banks;    // number of 1k CHR banks
+	int prg_mask;
+	int chr_mask;
+
+	void initPages(Cartridge* cartridge);
+	int prgBank(int bank);
+	int chrBank(int bank);
+
+	void mapPRG8(int page, int bank) {
+		prg_pages[page] = prgBank(bank) << 13;
+	}
 
-	int prgBankOffset(Cartridge* c, int index);
-	int chrBankOffset(Cartridge* cartridge, int index);
-	void updateOffsets(Cartridge* cartridge);
-	void writeCtrl(Cartridge* cartridge, uint8_t value);
+	// 'window' 0: $8000, 1: $C000
+	void mapPRG16(int window, int bank) {
+		mapPRG8(window << 1, bank << 1);
+		mapPRG8((window << 1) | 1, (bank << 1) | 1);
+	}
+
+	void mapPRG32(int bank) {
+		for (int i = 0; i < 4; ++i) {
+			mapPRG8(i, (bank << 2) | i);
+		}
+	}
+
+	void mapCHR1(int page, int bank) {
+		chr_pages[page] = chrBank(bank) << 10;
+	}
+
+	// 'window' 0: $0000, 1: $1000
+	void mapCHR4(int window, int bank) {
+		for (int i = 0; i < 4; ++i) {
+			mapCHR1((window << 2) | i, (bank << 2) | i);
+		}
+	}
+
+	void mapCHR8(int bank) {
+		for (int i = 0; i < 8; ++i) {
+			mapCHR1(i, (bank << 3) | i);
+		}
+	}
 
 	uint8_t read(Cartridge* cartridge, uint16_t address) {
 		if (address < 0x2000) {
-			const uint16_t bank = address >> 12;
-			const uint16_t offset = address & 4095;
-			return cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)];
+			return cartridge->CHR[chr_pages[address >> 10] + static_cast<int>(address & 1023)];
 		}
 		else if (address >= 0x8000) {
-			address -= 0x8000;
-			const uint16_t bank = address >> 14;
-			const uint16_t offset = address & 16383;
-			return cartridge->PRG[prg_offsets[bank] + static_cast<int>(offset)];
+			return cartridge->PRG[prg_pages[(address >> 13) & 3] + static_cast<int>(address & 8191)];
 		}
 		else if (address >= 0x6000) {
 			return cartridge->SRAM[static_cast<int>(address) - 0x6000];
 		}
+		else if (address >= 0x4020) {
+			// expansion area, open bus
+			return 0;
+		}
 		else {
-			std::cerr << "ERROR: Mapper1 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
+			std::cerr << "ERROR: Mapper" << static_cast<int>(cartridge->mapper) << " encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
 			return 0;
 		}
 	}
 
+	// handles CHR and SRAM; mappers override this for their registers
+	// and fall through to it for everything else
 	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
 		if (address < 0x2000) {
-			const uint16_t bank = address >> 12;
-			const uint16_t offset = address & 4095;
-			cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)] = value;
+			cartridge->CHR[chr_pages[address >> 10] + static_cast<int>(address & 1023)] = value;
 		}
 		else if (address >= 0x8000) {
+			// PRG-ROM, no registers
+		}
+		else if (address >= 0x6000) {
+			cartridge->SRAM[static_cast<int>(address) - 0x6000] = value;
+		}
+		else if (address >= 0x4020) {
+			// expansion area
+		}
+		else {
+			std::cerr << "ERROR: Mapper" << static_cast<int>(cartridge->mapper) << " encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
+		}
+	}
+
+	PagedMapper() : prg_pages{ 0, 0, 0, 0 }, chr_pages{ 0, 0, 0, 0, 0, 0, 0, 0 }, prg_banks(1), chr_banks(1), prg_mask(0), chr_mask(0) {}
+};
+
+struct Mapper1 : public PagedMapper {
+	uint8_t shift_reg;
+	uint8_t control;
+	uint8_t prg_mode;
+	uint8_t chr_mode;
+	uint8_t prg_bank;
+	uint8_t chr_bank0;
+	uint8_t chr_bank1;
+
+	void updateOffsets();
+	void writeCtrl(Cartridge* cartridge, uint8_t value);
+
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+		if (address >= 0x8000) {
 			if ((value & 0x80) == 0x80) {
 				shift_reg = 0x10;
 				writeCtrl(cartridge, control | 0x0C);
-				updateOffsets(cartridge);
+				updateOffsets();
 			}
 			else {
 				const bool complete = (shift_reg & 1) == 1;
@@ -512,181 +880,63 @@ struct Mapper1 : public Mapper {
 						// PRGbank ($E000-$FFFF)
 						prg_bank = shift_reg & 0x0F;
 					}
-					updateOffsets(cartridge);
+					updateOffsets();
 					shift_reg = 0x10;
 				}
 			}
 		}
-		else if (address >= 0x6000) {
-			cartridge->SRAM[static_cast<int>(address) - 0x6000] = value;
-		}
 		else {
-			std::cerr << "ERROR: Mapper1 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
+			PagedMapper::write(cartridge, address, value);
 		}
 	}
 
-	void updateCounter(CPU* cpu) {
-		static_cast<void>(cpu);
-	}
-
-	Mapper1() : shift_reg(0), control(0), prg_mode(0), chr_mode(0), prg_bank(0), chr_bank0(0), chr_bank1(0), prg_offsets{ 0, 0 }, chr_offsets{ 0, 0 } {}
-};
-
-struct Mapper2 : public Mapper {
-	int prg_banks;
-	int prg_bank1;
-	int prg_bank2;
-
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			return cartridge->CHR[address];
-		}
-		else if (address >= 0xC000) {
-			const int index = (prg_bank2 << 14) + static_cast<int>(address - 0xC000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x8000) {
-			const int index = (prg_bank1 << 14) + static_cast<int>(address - 0x8000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			return cartridge->SRAM[index];
-		}
-		else {
-			std::cerr << "ERROR: Mapper2 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
-		}
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
 	}
 
-	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			cartridge->CHR[address] = value;
-		}
-		else if (address >= 0x8000) {
-			prg_bank1 = static_cast<int>(value) % prg_banks;
-		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			cartridge->SRAM[index] = value;
-		}
-		else {
-			std::cerr << "ERROR: Mapper2 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-		}
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
 	}
 
-	void updateCounter(CPU* cpu) {
-		static_cast<void>(cpu);
+	size_t stateSize() const {
+		return sizeof(*this);
 	}
 
-	Mapper2(int _prgBanks, int _prgBank1, int _prgBank2) : prg_banks(_prgBanks), prg_bank1(_prgBank1), prg_bank2(_prgBank2) {}
+	Mapper1() : shift_reg(0), control(0), prg_mode(0), chr_mode(0), prg_bank(0), chr_bank0(0), chr_bank1(0) {}
 };
 
-struct Mapper3 : public Mapper {
-	int chr_bank;
-	int prg_bank1;
-	int prg_bank2;
-
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			const int index = chr_bank * 0x2000 + static_cast<int>(address);
-			return cartridge->CHR[index];
-		}
-		else if (address >= 0xC000) {
-			const int index = prg_bank2 * 0x4000 + static_cast<int>(address - 0xC000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x8000) {
-			const int index = prg_bank1 * 0x4000 + static_cast<int>(address - 0x8000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x6000) {
-			const int index = int(address) - 0x6000;
-			return cartridge->SRAM[index];
-		}
-		else {
-			std::cerr << "ERROR: Mapper3 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
-		}
-	}
-
-	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			const int index = chr_bank * 0x2000 + static_cast<int>(address);
-			cartridge->CHR[index] = value;
-		}
-		else if (address >= 0x8000) {
-			chr_bank = static_cast<int>(value & 3);
-		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			cartridge->SRAM[index] = value;
-		}
-		else {
-			std::cerr << "ERROR: Mapper3 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-		}
-	}
-	void updateCounter(CPU* cpu) {
-		static_cast<void>(cpu);
-	}
-
-	Mapper3(int _chrBank, int _prgBank1, int _prgBank2) : chr_bank(_chrBank), prg_bank1(_prgBank1), prg_bank2(_prgBank2) {}
-};
-
-struct Mapper4 : public Mapper {
+// The scanline counter is clocked at dot 280 of every rendered line. Rather
+// than polling for that dot, the counter is brought up to date lazily from
+// the PPU position whenever it's needed, and the IRQ is scheduled as a
+// mapper event at the exact dot it will fire.
+struct Mapper4 : public PagedMapper {
+	NES* console;
 	uint8_t reg;
 	uint8_t regs[8];
 	uint8_t prg_mode;
 	uint8_t chr_mode;
-	int prg_offsets[4];
-	int chr_offsets[8];
 	uint8_t reload;
 	uint8_t counter;
 	bool IRQ_enable;
+	bool rendering;      // rendering state since the counter was last synced
+	uint64_t clock_base; // counter clocks as of the last sync, see mmc3Clocks()
 
-	int prgBankOffset(Cartridge* c, int index);
-	int chrBankOffset(Cartridge* cartridge, int index);
-	void updateOffsets(Cartridge* cartridge);
-
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			const uint16_t bank = address >> 10;
-			const uint16_t offset = address & 1023;
-			return cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)];
-		}
-		else if (address >= 0x8000) {
-			address -= 0x8000;
-			const uint16_t bank = address >> 13;
-			const uint16_t offset = address & 8191;
-			return cartridge->PRG[prg_offsets[bank] + static_cast<int>(offset)];
-		}
-		else if (address >= 0x6000) {
-			return cartridge->SRAM[static_cast<int>(address) - 0x6000];
-		}
-		else {
-			std::cerr << "ERROR: Mapper4 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
-		}
-	}
+	void updateOffsets();
+	void sync(NES* nes);
 
 	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			const uint16_t bank = address >> 10;
-			const uint16_t offset = address & 1023;
-			cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)] = value;
-		}
-		else if (address >= 0x8000) {
+		if (address >= 0x8000) {
 			if (address <= 0x9FFF && (address & 1) == 0) {
 				// bank select
 				prg_mode = (value >> 6) & 1;
 				chr_mode = (value >> 7) & 1;
 				reg = value & 7;
-				updateOffsets(cartridge);
+				updateOffsets();
 			}
 			else if (address <= 0x9FFF && (address & 1)) {
 				// bank data
 				regs[reg] = value;
-				updateOffsets(cartridge);
+				updateOffsets();
 			}
 			else if (address <= 0xBFFF && (address & 1) == 0) {
 				switch (value & 1) {
@@ -701,86 +951,514 @@ struct Mapper4 : public Mapper {
 			else if (address <= 0xBFFF && (address & 1)) {
 				// TODO
 			}
-			else if (address <= 0xDFFF && (address & 1) == 0) {
-				// IRQ latch
-				reload = value;
-			}
-			else if (address <= 0xDFFF && (address & 1)) {
-				// IRQ reload
-				counter = 0;
-			}
-			else if ((address & 1) == 0) {
-				// IRQ disable
-				IRQ_enable = false;
-			}
 			else {
-				// IRQ enable
-				IRQ_enable = true;
+				sync(console);
+				if (address <= 0xDFFF && (address & 1) == 0) {
+					// IRQ latch
+					reload = value;
+				}
+				else if (address <= 0xDFFF && (address & 1)) {
+					// IRQ reload
+					counter = 0;
+				}
+				else if ((address & 1) == 0) {
+					// IRQ disable
+					IRQ_enable = false;
+				}
+				else {
+					// IRQ enable
+					IRQ_enable = true;
+				}
+				schedule(console);
 			}
 		}
-		else if (address >= 0x6000) {
-			cartridge->SRAM[static_cast<int>(address) - 0x6000] = value;
-		}
 		else {
-			std::cerr << "ERROR: Mapper4 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
+			PagedMapper::write(cartridge, address, value);
 		}
 	}
 
-	void updateCounter(CPU* cpu);
+	void schedule(NES* nes);
+	void runEvent(NES* nes);
+
+	void rebind(NES* nes) {
+		console = nes;
+	}
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
 
-	Mapper4() : reg(0), regs{ 0, 0, 0, 0, 0, 0, 0, 0 }, prg_mode(0), chr_mode(0), prg_offsets{ 0, 0, 0, 0 }, chr_offsets{ 0, 0, 0, 0, 0, 0, 0, 0 }, reload(0), counter(0), IRQ_enable(false) {}
+	Mapper4(NES* _console) : console(_console), reg(0), regs{ 0, 0, 0, 0, 0, 0, 0, 0 }, prg_mode(0), chr_mode(0), reload(0), counter(0), IRQ_enable(false),
+		rendering(false), clock_base(0) {}
 };
 
-struct Mapper7 : public Mapper {
-	int prg_bank;
+// MMC2 (mapper 9) and MMC4 (mapper 10). Each 4k CHR window has two banks,
+// and a latch picks between them: the PPU fetching tile $FD or $FE from that
+// window flips it for the fetches that follow. The latches are driven from
+// the PPU fetch hooks, so no other mapper pays for the compare.
+struct Mapper9 : public PagedMapper {
+	bool mmc4;
+	uint8_t prg_bank;
+	uint8_t chr_regs[4]; // $B000, $C000, $D000, $E000: window 0 $FD/$FE, window 1 $FD/$FE
+	uint8_t latch[2];    // 0: $FD, 1: $FE
 
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			return cartridge->CHR[address];
+	void updateOffsets();
+	void updateLatch(uint16_t address);
+
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+		if (address >= 0xF000) {
+			cartridge->mirror = (value & 1) ? MirrorHorizontal : MirrorVertical;
 		}
-		else if (address >= 0x8000) {
-			const int index = (prg_bank << 15) + static_cast<int>(address - 0x8000);
-			return cartridge->PRG[index];
+		else if (address >= 0xB000) {
+			chr_regs[(address >> 12) - 0xB] = value & 0x1F;
+			updateOffsets();
 		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			return cartridge->SRAM[index];
+		else if (address >= 0xA000) {
+			prg_bank = value & 0x0F;
+			updateOffsets();
 		}
 		else {
-			std::cerr << "ERROR: Mapper7 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
+			PagedMapper::write(cartridge, address, value);
 		}
 	}
 
+	uint8_t fetchBackground(NES* nes, uint16_t address);
+	uint8_t fetchSprite(NES* nes, uint16_t address);
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	Mapper9(Cartridge* cartridge) : mmc4(cartridge->mapper == 10), prg_bank(0), chr_regs{ 0, 0, 0, 0 }, latch{ 1, 1 } {
+		fetch_hooks = true;
+		initPages(cartridge);
+		updateOffsets();
+	}
+};
+
+// IRQ counter shared by the VRC boards. An 8-bit counter is clocked every
+// scanline (341 PPU dots) or every CPU cycle, and reloads and fires on
+// overflow. Instead of being clocked, the overflow is scheduled as a mapper
+// event; 'base' is the PPU tick at which 'counter' was last exact.
+struct VRCIRQ {
+	uint8_t latch;
+	uint8_t control; // bit 0: re-enable after ack, 1: enable, 2: cycle mode
+	uint8_t counter;
+	uint64_t base;
+
+	uint64_t period() {
+		return (control & 4) ? 3 : 341;
+	}
+
+	void sync(NES* nes);
+	void writeControl(NES* nes, uint8_t value);
+	void acknowledge(NES* nes);
+	void schedule(NES* nes);
+	void runEvent(NES* nes);
+
+	VRCIRQ() : latch(0), control(0), counter(0), base(0) {}
+};
+
+// Konami VRC6 (mappers 24 and 26, which swap A0 and A1)
+struct Mapper24 : public PagedMapper {
+	NES* console;
+	VRCIRQ irq;
+	VRC6Audio vrc6;
+
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value);
+	void schedule(NES* nes) {
+		irq.schedule(nes);
+	}
+	void runEvent(NES* nes) {
+		irq.runEvent(nes);
+	}
+
+	void rebind(NES* nes) {
+		console = nes;
+		audio = &vrc6;
+		if (nes == nullptr) vrc6.clearVtable();
+	}
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	Mapper24(NES* _console, Cartridge* cartridge) : console(_console) {
+		audio = &vrc6;
+		initPages(cartridge);
+	}
+};
+
+// Konami VRC7 (mapper 85)
+struct Mapper85 : public PagedMapper {
+	NES* console;
+	VRCIRQ irq;
+	VRC7Audio vrc7;
+
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value);
+	void schedule(NES* nes) {
+		irq.schedule(nes);
+	}
+	void runEvent(NES* nes) {
+		irq.runEvent(nes);
+	}
+
+	void rebind(NES* nes) {
+		console = nes;
+		audio = &vrc7;
+		if (nes == nullptr) vrc7.clearVtable();
+	}
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	Mapper85(NES* _console, Cartridge* cartridge) : console(_console) {
+		audio = &vrc7;
+		initPages(cartridge);
+	}
+};
+
+// Namco 163 (mapper 19). Nametables can come from CHR-ROM as well
+// as CIRAM, so mirroring is handed to the mapper. CIRAM as pattern
+// tables isn't supported. The IRQ is a 15-bit CPU cycle up-counter
+// that fires at $7FFF, scheduled the same way as the VRC one.
+struct Mapper19 : public PagedMapper {
+	NES* console;
+	uint8_t nt_regs[4];
+	uint16_t irq_counter;
+	bool irq_enable;
+	uint64_t irq_base;
+	N163Audio n163;
+
+	void syncCounter(NES* nes);
+	uint8_t read(Cartridge* cartridge, uint16_t address);
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value);
+	uint8_t readNametable(NES* nes, uint16_t address);
+	void writeNametable(NES* nes, uint16_t address, uint8_t value);
+	void schedule(NES* nes);
+	void runEvent(NES* nes);
+
+	void rebind(NES* nes) {
+		console = nes;
+		audio = &n163;
+		if (nes == nullptr) n163.clearVtable();
+	}
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	Mapper19(NES* _console, Cartridge* cartridge) : console(_console), nt_regs{ 0xE0, 0xE0, 0xE1, 0xE1 }, irq_counter(0), irq_enable(false), irq_base(0) {
+		audio = &n163;
+		cartridge->mirror = MirrorMapper;
+		initPages(cartridge);
+	}
+};
+
+// Sunsoft FME-7 and 5B (mapper 69). The IRQ is a 16-bit CPU cycle
+// down-counter that fires on wrapping past 0.
+struct Mapper69 : public PagedMapper {
+	NES* console;
+	uint8_t command;
+	uint8_t ram_bank; // $6000 bank: bit 6 selects RAM, bit 7 enables it
+	uint16_t irq_counter;
+	uint8_t irq_control; // bit 0: IRQ enable, bit 7: counter enable
+	uint64_t irq_base;
+	Sunsoft5BAudio s5b;
+
+	void syncCounter(NES* nes);
+	uint8_t read(Cartridge* cartridge, uint16_t address);
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value);
+	void schedule(NES* nes);
+	void runEvent(NES* nes);
+
+	void rebind(NES* nes) {
+		console = nes;
+		audio = &s5b;
+		if (nes == nullptr) s5b.clearVtable();
+	}
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	Mapper69(NES* _console, Cartridge* cartridge) : console(_console), command(0), ram_bank(0), irq_counter(0), irq_control(0), irq_base(0) {
+		audio = &s5b;
+		initPages(cartridge);
+	}
+};
+
+// What a discrete-logic bank register drives
+enum BankTargets {
+	TargetPRG32 = 0,   // 32k PRG at $8000
+	TargetPRG16Lo = 1, // 16k PRG at $8000
+	TargetPRG16Hi = 2, // 16k PRG at $C000
+	TargetCHR8 = 3,    // 8k CHR at PPU $0000
+	TargetMirror = 4   // single-screen nametable select
+};
+
+// A register of a discrete-logic board: a write to an address with
+// (address & mask) == match loads 'bits' bits of the value,
+// starting at bit 'shift', into the bank selected by 'target'
+struct BankRegister {
+	uint16_t mask;
+	uint16_t match;
+	uint8_t shift;
+	uint8_t bits;
+	uint8_t target;
+};
+
+// Declarative description of a discrete-logic board (latches and a few gates,
+// no IRQs). 'prg_lo' and 'prg_hi' are the 16k banks mapped at $8000 and $C000
+// at power-on; windows no register drives stay fixed there.
+struct BoardDescriptor {
+	uint8_t mapper;
+	const char* name;
+	int8_t prg_lo;
+	int8_t prg_hi;
+	uint8_t num_regs;
+	BankRegister regs[2];
+};
+
+const BoardDescriptor* findBoard(uint8_t mapper);
+
+// Mapper built from a BoardDescriptor. Each register is compiled at load time
+// into a value mask that already folds in the size of the cartridge,
+// so a register write is a compare, a shift, a mask and a page table update.
+struct DiscreteMapper : public PagedMapper {
+	struct CompiledRegister {
+		uint16_t mask;
+		uint16_t match;
+		uint8_t shift;
+		uint8_t value_mask;
+		uint8_t target;
+	};
+
+	const BoardDescriptor* board;
+	int num_regs;
+	CompiledRegister regs[2];
+	uint8_t banks[2];
+
+	void setBank(Cartridge* cartridge, int index, uint8_t bank);
+
 	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			cartridge->CHR[address] = value;
-		}
-		else if (address >= 0x8000) {
-			prg_bank = static_cast<int>(value & 7);
-			switch (value & 0x10) {
-			case 0x00:
-				cartridge->mirror = MirrorSingle0;
-				break;
-			case 0x10:
-				cartridge->mirror = MirrorSingle1;
-				break;
+		if (address >= 0x6000) {
+			bool matched = false;
+			for (int i = 0; i < num_regs; ++i) {
+				const CompiledRegister& r = regs[i];
+				if ((address & r.mask) == r.match) {
+					setBank(cartridge, i, (value >> r.shift) & r.value_mask);
+					matched = true;
+				}
 			}
+			if (matched || address >= 0x8000) return;
 		}
-		else if (address >= 0x6000) {
-			int index = static_cast<int>(address) - 0x6000;
-			cartridge->SRAM[index] = value;
-		}
-		else {
-			std::cerr << "ERROR: Mapper7 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
+		PagedMapper::write(cartridge, address, value);
+	}
+
+	bool writesRegister(uint16_t address) const {
+		for (int i = 0; i < num_regs; ++i) {
+			if ((address & regs[i].mask) == regs[i].match) return true;
 		}
+		return Mapper::writesRegister(address);
 	}
 
-	void updateCounter(CPU* cpu) {
-		static_cast<void>(cpu);
+	void rebind(NES* nes);
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
 	}
 
-	Mapper7() : prg_bank(0) {}
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	DiscreteMapper(Cartridge* cartridge, const BoardDescriptor* _board);
+};
+
+// MMC5 (ExROM): PRG and CHR banking modes, banked PRG-RAM, ExRAM with
+// extended attributes, vertical split, fill mode, the multiplier and the
+// scanline IRQ, which runs off the mapper event scheduler instead of being
+// polled every dot. Split and extended attributes work through the PPU
+// fetch hooks. Expansion audio isn't emulated.
+struct Mapper5 : public PagedMapper {
+	NES* console;
+
+	uint8_t prg_mode;       // $5100
+	uint8_t chr_mode;       // $5101
+	uint8_t ram_protect[2]; // $5102, $5103
+	uint8_t exram_mode;     // $5104
+	uint8_t nt_mapping;     // $5105
+	uint8_t fill_tile;      // $5106
+	uint8_t fill_attrib;    // $5107
+	uint8_t prg_regs[5];    // $5113-$5117
+	uint8_t chr_regs[12];   // $5120-$512B
+	uint8_t chr_upper;      // $5130
+	bool chr_last_b;        // last CHR register written was in the background set
+	uint8_t split_ctrl;     // $5200
+	uint8_t split_scroll;   // $5201
+	uint8_t split_bank;     // $5202
+	uint8_t irq_target;     // $5203
+	bool irq_enable;
+	bool irq_pending;
+	uint8_t mul[2];         // $5205, $5206
+
+	int ram_pages[5];       // SRAM offsets of $6000 and of each page at $8000-$FFFF
+	bool prg_is_ram[4];
+	int chr_a[8];           // sprite set, $5120-$5127
+	int chr_b[8];           // background set, $5128-$512B
+
+	// background tile currently being fetched
+	bool in_split;
+	uint8_t split_fine_y;
+	uint8_t split_attrib;
+	uint8_t ext_byte;
+
+	uint8_t exram[1024];
+
+	void setPRGPage(int page, uint8_t value, int bank, bool rom_only);
+	void updatePRG();
+	void updateCHR();
+	bool inFrame();
+	uint8_t readCHR(Cartridge* cartridge, const int* pages, uint16_t address);
+
+	uint8_t read(Cartridge* cartridge, uint16_t address);
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value);
+
+	uint8_t readNametable(NES* nes, uint16_t address);
+	void writeNametable(NES* nes, uint16_t address, uint8_t value);
+	void schedule(NES* nes);
+	void runEvent(NES* nes);
+	uint8_t fetchTile(NES* nes, uint16_t address);
+	uint8_t fetchAttribute(NES* nes, uint16_t address);
+	uint8_t fetchBackground(NES* nes, uint16_t address);
+	uint8_t fetchSprite(NES* nes, uint16_t address);
+
+	void rebind(NES* nes) {
+		console = nes;
+	}
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	Mapper5(NES* _console, Cartridge* cartridge);
+};
+
+// Everything the CPU does that can change what the PPU draws, recorded from
+// power-on so the PPU can be replayed on its own (see 'replayPPUTrace'):
+// PPU register writes, the PPU register reads with side effects, OAM DMA
+// bytes and mapper register writes, each stamped with the PPU tick it
+// happened on, plus a hash of every finished frame to check the replay against.
+enum TraceKind {
+	TraceWrite = 0,
+	TraceRead = 1,
+	TraceOAM = 2
+};
+
+struct TraceEvent {
+	uint64_t tick;
+	uint16_t address;
+	uint8_t value;
+	uint8_t kind;
+};
+
+struct PPUTrace {
+	uint64_t rom_hash;
+	uint64_t end_tick; // PPU tick the recording stopped on
+	std::vector<TraceEvent> events;
+	std::vector<uint64_t> frames;
+
+	void record(uint64_t tick, uint8_t kind, uint16_t address, uint8_t value) {
+		TraceEvent e;
+		e.tick = tick;
+		e.address = address;
+		e.value = value;
+		e.kind = kind;
+		events.push_back(e);
+	}
+
+	PPUTrace() : rom_hash(0), end_tick(0) {}
+	PPUTrace(uint64_t _rom_hash) : rom_hash(_rom_hash), end_tick(0) {}
+};
+
+// APU register writes and the bytes the DMC fetches, stamped with the APU
+// cycle they happened on. Saved as a VGM file (see 'saveAPULog').
+struct APULog {
+	uint64_t end_cycle; // APU cycle the recording stopped on
+	std::vector<TraceEvent> events;
+
+	void record(uint64_t cycle, uint8_t kind, uint16_t address, uint8_t value) {
+		TraceEvent e;
+		e.tick = cycle;
+		e.address = address;
+		e.value = value;
+		e.kind = kind;
+		events.push_back(e);
+	}
+
+	APULog() : end_cycle(0) {}
 };
 
 struct NES {
@@ -793,8 +1471,23 @@ struct NES {
 	Controller* controller2;
 	Mapper* mapper;
 	uint8_t* RAM;
+	uint64_t mapper_event; // PPU tick of the next mapper event
+	uint64_t io_writes; // CPU writes to $2000-$4017 since power-on, for the watchdog
+	uint64_t vblanks_seen; // NMIs taken and $2002 reads that saw vblank, for the watchdog
+	PPUTrace* ppu_trace; // recording if not null
+	APULog* apu_log;     // recording if not null
 
 	NES(const char* path, const char* SRAM_path);
+
+	// a console with no cartridge, around a mapper that supplies the memory,
+	// for driving parts of it on their own
+	NES(Mapper* _mapper);
+
+	// frees everything the console owns, the mapper and any recordings
+	// included. PRG- and CHR-ROM go with the last console sharing them.
+	~NES();
+
+	void powerOn();
 };
 
 struct Instruction {
@@ -809,6 +1502,14 @@ struct Instruction {
 	constexpr Instruction(const uint8_t _opcode, const char _name[4], void(*_dispatch)(CPU*, NES*, uint16_t, uint8_t), const uint8_t _mode, const uint8_t _size, const uint8_t _cycles, const uint8_t _page_crossed_cycles) : opcode(_opcode), name(_name), dispatch(_dispatch), mode(_mode), size(_size), cycles(_cycles), page_cross_cycles(_page_crossed_cycles) {}
 };
 
+// defined in 'cpu.cpp'. Opcodes KNES doesn't implement have size 0
+extern const Instruction instructions[256];
+
+// memory an instruction writes besides the registers: the address it
+// operates on (stores and read-modify-writes), or the stack
+bool writesOperand(const Instruction& instruction);
+bool pushesStack(const Instruction& instruction);
+
 void PPUnmiShift(PPU* ppu);
 void dmcRestart(DMC* d);
 
@@ -819,13 +1520,529 @@ void push16(NES* nes, uint16_t value);
 void php(CPU* cpu, NES* nes, uint16_t address, uint8_t mode);
 
 uint16_t read16(NES* nes, uint16_t address);
+uint16_t read16_ff_bug(NES* nes, uint16_t address);
+bool pagesDiffer(uint16_t a, uint16_t b);
 void execute(NES* nes, uint8_t opcode);
 void writeByte(NES* nes, uint16_t address, uint8_t value);
 void emulate(NES* nes, double seconds);
+void emulateFrame(NES* nes);
+void emulateCycles(NES* nes, int cycles);
+void reserveAudio(NES* nes, double seconds);
+// cycles left until emulateFrame() would stop
+int cyclesToFrame(NES* nes);
+
+// Runs the next frame of each console, interleaving them in groups of up
+// to MAX_INTERLEAVE on this thread. Same results as emulateFrame() on each.
+constexpr int MAX_INTERLEAVE = 4;
+void emulateFrames(NES* const* consoles, int count);
+
+NES* cloneNES(const NES* src);
+void copyState(NES* dst, const NES* src);
+void saveState(const NES* nes, std::vector<uint8_t>* out);
+bool loadState(NES* nes, const uint8_t* data, size_t size);
+
+// Moving a live session to another worker process (see 'migrate.cpp').
+struct Migration {
+	int fd; // socket to the new worker while migrating, otherwise -1
+	std::vector<uint8_t> inputs; // controller 1 and 2 buttons of each frame run since the state was sent
+
+	Migration() : fd(-1) {}
+};
+
+// Old worker, at a frame boundary: sends the session to the new worker
+// waiting on 'socket_path', then keeps running frames as usual.
+bool startMigration(Migration* m, const NES* nes, const char* socket_path);
+
+// Old worker: call before each emulateFrame() once the controllers are set.
+// Returns true once the new worker has taken over, in which case this
+// frame and all later ones are the new worker's to run.
+bool migrationFrame(Migration* m, const NES* nes);
+
+// New worker: waits on 'socket_path' for a session and loads it into 'nes',
+// which must be running the same ROM, catching up on the frames the old
+// worker ran in the meantime.
+bool acceptMigration(NES* nes, const char* socket_path);
+
+// Whole-buffer socket I/O, false once the peer is gone.
+bool sendAll(int fd, const void* data, size_t size);
+bool recvAll(int fd, void* data, size_t size);
+
+// Listening and connecting on "unix:<path>" or "tcp:<IPv4 address>:<port>"
+// (see 'stream.cpp'). Both return the socket, or -1.
+int listenSocket(const char* address, int backlog);
+int connectSocket(const char* address);
+
+// Streaming video and audio to a thin client (see 'stream.cpp').
+constexpr uint8_t STREAM_VIDEO = 1;
+constexpr uint8_t STREAM_AUDIO = 2;
+constexpr size_t STREAM_HEADER = 5; // packet type and payload size
+
+struct FrameStream {
+	int fd; // connected client, otherwise -1
+	uint32_t frame; // video packets sent
+	bool keyframe; // send every tile of the next frame
+	uint64_t last_frame; // PPU frame last sent
+	uint32_t prev[256 * 240]; // picture as the client has it
+	std::vector<uint8_t> packet;
+
+	FrameStream() : fd(-1), frame(0), keyframe(true), last_frame(0) {}
+};
+
+struct FrameDecoder {
+	uint32_t frame;
+	uint32_t pixels[256 * 240];
+	std::vector<float> audio; // samples of the last audio packet
+
+	FrameDecoder() : frame(0) {
+		for (uint32_t& p : pixels) p = palette[0x0F];
+	}
+};
+
+// Server: waits on 'address' ("unix:<path>" or "tcp:<IPv4 address>:<port>")
+// for one client to connect.
+bool openStream(FrameStream* s, const char* address);
+
+// Server: call after each emulate(). Sends the latest frame if a new one
+// was completed, then the audio just generated. False once the client is gone.
+bool streamOutput(FrameStream* s, const NES* nes);
+
+// Encode one packet into 's->packet'.
+void encodeFrame(FrameStream* s, const uint32_t* pixels);
+void encodeAudio(FrameStream* s, const float* samples, int count);
+
+// Client side: connect, receive whole packets and decode them into 'd'.
+// decodePacket() returns the packet type, or -1 if it is malformed.
+int connectStream(const char* address);
+bool receivePacket(int fd, std::vector<uint8_t>* packet);
+int decodePacket(FrameDecoder* d, const uint8_t* data, size_t size);
+
+// Chunked trajectory datasets for training pipelines (see 'dataset.cpp').
+constexpr int DATASET_CHUNK_STEPS = 64;
+
+// Consecutive steps of one instance: what it showed, its RAM and the
+// controllers after each step, and the reward the caller gave it.
+struct TrajectoryChunk {
+	uint32_t instance;
+	uint64_t first_step;
+	int steps;
+	std::vector<uint32_t> frames; // 256 x 240 per step
+	std::vector<uint8_t> ram;     // 2 KB per step
+	std::vector<uint8_t> inputs;  // controller 1 and 2 buttons per step
+	std::vector<float> rewards;
+
+	TrajectoryChunk() : instance(0), first_step(0), steps(0) {}
+};
+
+struct DatasetIndexEntry {
+	uint32_t instance;
+	uint32_t steps;
+	uint64_t first_step;
+	uint64_t offset; // of the chunk in the file
+	uint64_t size;
+};
+
+struct DatasetWriter {
+	FILE* fp;
+	uint64_t end; // file offset the next chunk goes to
+	bool closing;
+	bool failed;
+	std::vector<std::thread> workers;
+	std::mutex lock; // guards 'pending', 'spare' and 'closing'
+	std::condition_variable wake;     // a chunk is pending, or closing
+	std::condition_variable returned; // a chunk is spare again
+	std::vector<TrajectoryChunk*> pending; // full chunks waiting for a worker, oldest first
+	std::vector<TrajectoryChunk*> spare;   // chunks free to be filled
+	std::mutex file_lock; // guards 'fp', 'end', 'failed' and 'index'
+	std::vector<DatasetIndexEntry> index;
+
+	DatasetWriter() : fp(nullptr), end(0), closing(false), failed(false) {}
+};
+
+// The steps of one instance being buffered for a writer.
+struct Trajectory {
+	DatasetWriter* writer;
+	uint32_t instance;
+	uint64_t steps;
+	TrajectoryChunk* chunk; // being filled, or null
+
+	Trajectory() : writer(nullptr), instance(0), steps(0), chunk(nullptr) {}
+};
+
+// Starts 'threads' workers compressing and writing chunks to 'path', with a
+// pool of 'chunks' chunks (about 16 MB each). Every trajectory being
+// recorded holds one, so there must be at least as many as trajectories
+// recorded at once, and a few more per worker keep the workers busy.
+bool openDataset(DatasetWriter* w, const char* path, uint64_t rom_hash, int threads, int chunks);
+void beginTrajectory(Trajectory* t, DatasetWriter* w, uint32_t instance);
+// Call on the instance's own thread after each step. Only copies the step;
+// every DATASET_CHUNK_STEPS steps the chunk is handed to the workers. Waits
+// for a chunk to be written if the pool has none free.
+void recordStep(Trajectory* t, const NES* nes, float reward);
+// Hands over the last, partly filled chunk.
+void endTrajectory(Trajectory* t);
+// Once every trajectory has ended: waits for the workers, writes the index.
+bool closeDataset(DatasetWriter* w);
+
+// Random access to a finished file.
+bool loadDatasetIndex(const char* path, uint64_t* rom_hash, std::vector<DatasetIndexEntry>* index);
+bool readDatasetChunk(const char* path, const DatasetIndexEntry& e, TrajectoryChunk* c);
+
+// Speculative pre-simulation for rollback netplay. While the remote player's
+// input for the next frame is still on its way, that frame is run ahead on
+// other cores for a few likely guesses at it (say, their last input and
+// nothing pressed). If the real input turns out to be one of them, the
+// finished console is swapped in instead of simulating the frame again.
+constexpr int MAX_SPECULATIONS = 4;
+
+struct Speculation {
+	NES* instances[MAX_SPECULATIONS]; // cloned on first use, then reused
+	uint8_t guesses[MAX_SPECULATIONS];
+	int count;
+
+	// workers[i] runs instances[i]. They are started as first needed and
+	// kept, so that a frame's speculation doesn't spawn threads: each round
+	// speculate() starts, resolveSpeculation() waits for.
+	std::thread workers[MAX_SPECULATIONS];
+	int started;
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable finished;
+	uint64_t round;
+	int remaining; // workers still running the round
+	bool closing;
+
+	Speculation() : instances{ nullptr, nullptr, nullptr, nullptr }, guesses{ 0, 0, 0, 0 }, count(0), started(0), round(0), remaining(0), closing(false) {}
+
+	~Speculation() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closing = true;
+		}
+		start.notify_all();
+		for (int i = 0; i < started; ++i) {
+			workers[i].join();
+		}
+		for (NES* nes : instances) {
+			delete nes;
+		}
+	}
+};
+
+// Starts running the next frame of 'nes' once per guess at the remote
+// player's buttons, with the local player's already applied to 'nes'.
+// 'remote' is the remote player's controller, 1 or 2.
+void speculate(Speculation* spec, const NES* nes, int remote, const uint8_t* guesses, int count);
+
+// Waits for the speculative frames. If one of them guessed 'buttons', swaps
+// its console with '*nes' and returns true; otherwise the caller has to run
+// the frame itself.
+bool resolveSpeculation(Speculation* spec, NES** nes, uint8_t buttons);
+
+// Consoles kept ready at a snapshot for instant session start (see 'pool.cpp').
+struct InstancePool {
+	NES* snapshot; // what handed-out instances start from
+	int size;      // instances to keep ready
+	bool closing;
+	std::vector<NES*> ready;
+	std::vector<NES*> returned; // to be rewound to the snapshot
+	std::mutex lock; // guards all of the above but 'snapshot'
+	std::condition_variable wake;
+	std::thread refiller;
+
+	InstancePool() : snapshot(nullptr), size(0), closing(false) {}
+};
+
+// Copies 'snapshot', which can be a console booted to any point, say a
+// title screen or a loaded save state, and starts filling the pool.
+void openPool(InstancePool* pool, const NES* snapshot, int size);
+// A console at the snapshot, from the pool unless it has run dry.
+NES* acquireInstance(InstancePool* pool);
+// Hands a console back to be rewound and reused.
+void releaseInstance(InstancePool* pool, NES* nes);
+// Stops the refill thread and frees the pooled consoles and the snapshot.
+// Consoles still handed out are the caller's to delete.
+void closePool(InstancePool* pool);
+
+// Spotting jammed or hung consoles in batch runs (see 'watchdog.cpp').
+enum WatchdogReason {
+	WatchdogOK,
+	WatchdogJam,
+	WatchdogHang,
+	WatchdogNoVBlank
+};
+
+struct Watchdog {
+	int max_idle_frames;   // frames without I/O that count as a hang
+	int max_blind_frames;  // frames without the game seeing a vblank that count as no vblank
+	uint64_t last_vblanks;
+	uint64_t last_io;
+	int idle_frames;
+	int blind_frames;
+	int jam_frames;
+	WatchdogReason reason;
+
+	// taken when it goes off
+	CPU cpu;
+	uint8_t opcode;
+	uint64_t frame;
+	std::vector<uint8_t> state; // see saveState()
+
+	Watchdog() : max_idle_frames(600), max_blind_frames(600), last_vblanks(0), last_io(0), idle_frames(0), blind_frames(0), jam_frames(0), reason(WatchdogOK),
+		opcode(0), frame(0) {}
+};
+
+void resetWatchdog(Watchdog* w, const NES* nes);
+// Returns true, with a snapshot for the post-mortem, once the console is
+// jammed, hung or blind to vblank. The worker should stop running it then.
+bool watchdogFrame(Watchdog* w, NES* nes);
+void reportWatchdog(const Watchdog* w);
+
+// Reward and episode-termination rules on RAM (see 'rules.cpp').
+struct RuleProgram {
+	std::vector<int32_t> code;
+	int var_count;
+
+	RuleProgram() : var_count(0) {}
+};
+
+// The vars of one console, now and at the previous frame.
+struct RuleState {
+	std::vector<int64_t> vars;
+	std::vector<int64_t> prev;
+};
+
+bool loadRules(RuleProgram* program, const char* path);
+// 'path' only names the source in error messages.
+bool compileRules(RuleProgram* program, const char* source, const char* path);
+// Starts the vars from 'nes' as it is now, so the next frame has a 'prev'.
+void resetRules(const RuleProgram* program, RuleState* state, const NES* nes);
+// Call once per frame.
+void evaluateRules(const RuleProgram* program, RuleState* state, const NES* nes, float* reward, bool* done);
+
+// Reinforcement learning environments (see 'env.cpp'). A step runs
+// 'frame_skip' frames with the same buttons on controller 1.
+struct EnvConfig {
+	int frame_skip;
+	bool max_pool; // observe the per-channel max of the last two frames
+	float sticky;  // chance that a frame keeps the previous buttons instead
+	int stack;     // observations kept
+	uint64_t seed; // for sticky actions
+	const RuleProgram* rules; // reward and done for each step, if not null
+
+	EnvConfig() : frame_skip(4), max_pool(true), sticky(0.25f), stack(4), seed(0), rules(nullptr) {}
+};
+
+struct Env {
+	NES* nes;
+	NES* start; // state resetEnv() goes back to
+	EnvConfig config;
+	uint64_t rng;
+	uint8_t buttons; // on controller 1 during the last frame
+	int newest;      // of 'frames'
+	std::vector<uint32_t> frames; // ring of 'stack' observations
+	std::vector<uint32_t> pool;   // the second last frame of a step
+	RuleState rule_state;
+	Watchdog watchdog; // ends the episode if the game jams or hangs
+	float reward; // of the last step
+	bool done;    // the episode ended, possibly before the step's last frame
+
+	Env() : nes(nullptr), start(nullptr), rng(0), buttons(0), newest(0), reward(0.0f), done(false) {}
+
+	Env(const Env&) = delete;
+	Env& operator=(const Env&) = delete;
+
+	// 'start' is the environment's own clone, 'nes' stays the caller's
+	~Env() {
+		delete start;
+	}
+};
+
+// 'nes' as it is now becomes the state episodes start from. Deleting the
+// Env frees its copy of that state, but not 'nes'.
+Env* createEnv(NES* nes, const EnvConfig& config);
+void resetEnv(Env* env);
+void stepEnv(Env* env, uint8_t action);
+// Steps 'count' environments, split across 'threads' threads, and gathers
+// their rewards and dones if those aren't null.
+void stepEnvs(Env* const* envs, const uint8_t* actions, int count, int threads, float* rewards, bool* dones);
+// 256 x 240 observation, 0 the newest and 'stack' - 1 the oldest.
+const uint32_t* envObservation(const Env* env, int age);
+
+// Sweeps of (ROM, input script, seed) jobs over worker processes
+// (see 'jobs.cpp').
+struct JobSpec {
+	std::string rom;
+	std::string script;
+	uint64_t seed;
+
+	JobSpec() : seed(0) {}
+};
+
+struct CoordinatorConfig {
+	const char* address; // for workers to connect to, see listenSocket()
+	const char* output;  // result lines are appended here
+	int local_workers;   // forked and kept running by the coordinator
+	int depth;           // jobs sent ahead to each worker, the first one running
+	double timeout;      // seconds without word from a busy worker before it is dropped
+	int max_attempts;    // workers a job may take down with it before it is given up on
+
+	CoordinatorConfig() : address(nullptr), output(nullptr), local_workers(0), depth(2), timeout(10.0), max_attempts(3) {}
+};
+
+// Lines of '<ROM> <input script> <seed>'.
+bool loadJobs(std::vector<JobSpec>* jobs, const char* path);
+// Returns once every job has a result line in the output file.
+bool runCoordinator(const std::vector<JobSpec>& jobs, const CoordinatorConfig& config);
+// Runs the jobs of the coordinator at 'address' until it says to stop.
+bool runJobWorker(const char* address);
+
+// Remembering the outcome of deterministic runs on disk (see 'memo.cpp').
+struct MemoKey {
+	uint64_t rom;    // cartridge hash
+	uint64_t start;  // of the save state the run starts from
+	uint64_t inputs; // of the controller inputs and any rules
+};
+
+struct MemoResult {
+	std::vector<uint8_t> state;         // save state at the end
+	std::vector<uint64_t> frame_hashes; // hashFrame() of every frame
+	std::vector<double> metrics;        // total reward and frames run, with rules
+};
+
+struct MemoEntry {
+	MemoKey key;
+	uint64_t size; // on disk
+};
+
+struct MemoStore {
+	std::string dir;
+	uint64_t budget; // bytes of entries kept on disk
+	uint64_t used;
+	std::list<MemoEntry> entries; // most recently used first
+	std::unordered_map<uint64_t, std::list<MemoEntry>::iterator> index;
+	uint64_t hits;
+	uint64_t misses;
+
+	MemoStore() : budget(0), used(0), hits(0), misses(0) {}
+};
+
+// Picks up the entries already in 'dir', which must exist, oldest first to go.
+bool openMemo(MemoStore* store, const char* dir, uint64_t budget);
+// 'start' is the save state the run starts from, and 'inputs' has
+// controller 1 and 2 for each of 'frames' frames.
+MemoKey memoKey(const NES* nes, const std::vector<uint8_t>& start, const uint8_t* inputs, int frames, const RuleProgram* rules);
+bool lookupMemo(MemoStore* store, const MemoKey& key, MemoResult* result);
+void storeMemo(MemoStore* store, const MemoKey& key, const MemoResult& result);
+// Leaves 'nes' as the run would have, from the store if it has seen it,
+// otherwise by loading 'start' into it, running it and remembering the
+// result. Returns true on a hit. With rules the run stops early once they
+// say it is done. If 'start' doesn't load, 'result' comes back empty.
+bool runMemoized(MemoStore* store, NES* nes, const std::vector<uint8_t>& start, const uint8_t* inputs, int frames,
+	const RuleProgram* rules, MemoResult* result);
+
+// Hardware performance counters for the benchmarks (see 'perf.cpp').
+enum PerfEvent {
+	PerfCycles,
+	PerfInstructions,
+	PerfBranchMisses,
+	PerfL1DMisses,
+	PerfLLCMisses,
+	PerfITLBMisses,
+	PERF_EVENTS
+};
+
+struct PerfCounters {
+	int fds[PERF_EVENTS]; // -1 where the event couldn't be opened
+	const char* error;    // why none could, if so
+
+	PerfCounters() : error(nullptr) {
+		for (int& fd : fds) fd = -1;
+	}
+};
+
+// Counts since the counters were opened, for this thread only.
+struct PerfSample {
+	uint64_t counts[PERF_EVENTS];
+	bool valid[PERF_EVENTS];
+};
+
+// False, with the reason in 'error', if no counter could be opened, as
+// in most containers. Reading them then gives samples with nothing valid.
+bool openPerfCounters(PerfCounters* perf);
+void readPerfCounters(const PerfCounters* perf, PerfSample* sample);
+// 'a' becomes the counts from 'b' to 'a'.
+void subtractPerf(PerfSample* a, const PerfSample& b);
+// IPC and every valid count divided by 'frames', on one indented line.
+void printPerf(const PerfCounters* perf, const PerfSample& sample, double frames);
+void closePerfCounters(PerfCounters* perf);
+
+// Allocation tracking (see 'alloc.cpp', linked into 'bench/allocbench'
+// only). Counts the allocations and frees made on any thread between the
+// two calls.
+struct AllocCounts {
+	uint64_t allocations;
+	uint64_t frees;
+};
+
+void beginAllocTracking();
+// True if nothing was allocated or freed.
+bool endAllocTracking(AllocCounts* counts);
+
+// Synthetic test programs for the benchmarks (see 'synth.cpp').
+enum SynthClass {
+	SynthLoad,     // LDA LDX LDY
+	SynthStore,    // STA STX STY
+	SynthALU,      // ADC SBC AND ORA EOR CMP CPX CPY BIT and register INC/DEC
+	SynthShift,    // ASL LSR ROL ROR INC DEC
+	SynthBranch,   // conditional branches
+	SynthTransfer, // register transfers and NOP
+	SynthStack,    // PHA/PLA and PHP/PLP pairs, JSR to an RTS
+	SynthFlag,     // flag sets and clears
+	SYNTH_CLASSES
+};
+
+struct SynthConfig {
+	uint8_t mapper; // 0, 1, 4 or 24
+	uint64_t seed;
+	int length; // instructions in the main loop
+	float mix[SYNTH_CLASSES]; // relative weight of each class
+	float modes[14]; // relative weight of each addressing mode, by AddressingModes
+	bool rendering;
+	// I/O done in each vblank
+	int vram_writes; // $2007 writes
+	int oam_dmas;    // $4014 writes
+	int bank_writes; // CHR bank switches, mappers 1, 4 and 24 only
+
+	SynthConfig() : mapper(0), seed(1), length(1024), mix{ 3, 2, 3, 1, 1, 1, 0.5f, 0.5f }, modes{ 0, 3, 1, 1, 1, 3, 2, 0.5f, 0, 0.5f, 1, 3, 1, 0.5f },
+		rendering(true), vram_writes(32), oam_dmas(1), bank_writes(0) {}
+};
+
+// An iNES image of a program that runs a random main loop drawn from
+// 'config' while its NMI handler does the configured I/O.
+bool generateROM(const SynthConfig& config, std::vector<uint8_t>* image);
+// An iNES image (NROM) that runs 'count' copies of 'opcode' in a loop,
+// counting loops in the 16 bits at $0200. Lowers 'count' for RTS and RTI,
+// which take their addresses from one page of stack. A 'count' of 0
+// gives the bare loop. False if KNES doesn't implement 'opcode'.
+bool generateOpcodeROM(uint8_t opcode, int* count, std::vector<uint8_t>* image);
 
 void setI(CPU* cpu, bool value);
 uint8_t getI(CPU* cpu);
+void triggerIRQ(CPU* cpu);
+
+uint64_t ppuTickAt(PPU* ppu, int scanline, int cycle);
+uint64_t ppuTickAtFrame(PPU* ppu, uint64_t frame, int scanline, int cycle);
+uint64_t predictSpriteZeroHit(NES* nes);
+uint64_t predictSpriteOverflow(NES* nes);
+
+uint64_t hashFrame(const uint32_t* frame);
+bool savePPUTrace(const PPUTrace* trace, const char* path);
+bool loadPPUTrace(PPUTrace* trace, const char* path);
+bool saveAPULog(const APULog* log, const char* path);
+template <bool hooks>
+int replayPPUTrace(NES* nes, const PPUTrace* trace, uint64_t* hashes);
 
+void tickAPU(NES* nes, APU* apu);
 void tickEnvelope(APU* apu);
 void tickSweep(APU* apu);
 void tickLength(APU* apu);
\ No newline at end of file
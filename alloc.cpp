@@ -0,0 +1,176 @@
+/*******************************************************************
+*   alloc.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Allocation tracking, to show that stepping, snapshots and batch stepping
+// allocate nothing once a console is built. Only 'bench/allocbench' links
+// this file. In it the global operator new and delete are replaced, and
+// with glibc so are malloc, calloc, realloc, posix_memalign and free, all
+// passing straight through to the real allocator. Outside of tracking they
+// cost one relaxed load each.
+//
+// While tracking, every call on any thread is counted and the stacks of
+// the first few allocations go to stderr.
+
+#include "NES.h"
+
+#include <atomic>
+#include <cerrno>
+#include <new>
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#include <unistd.h>
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void* p);
+#endif
+
+constexpr int MAX_TRACES = 4;
+constexpr int TRACE_DEPTH = 32;
+
+static std::atomic<bool> tracking(false);
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> frees(0);
+static std::atomic<int> traces(0);
+static thread_local bool tracing = false;
+
+static void noteAllocation(size_t size) {
+	if (!tracking.load(std::memory_order_relaxed)) return;
+	allocations.fetch_add(1, std::memory_order_relaxed);
+#ifdef __GLIBC__
+	// backtrace() may allocate itself, and stdio might too
+	if (tracing || traces.fetch_add(1, std::memory_order_relaxed) >= MAX_TRACES) return;
+	tracing = true;
+	void* frames[TRACE_DEPTH];
+	const int depth = backtrace(frames, TRACE_DEPTH);
+	char line[96];
+	const int length = snprintf(line, sizeof(line), "ERROR: allocation of %zu bytes while tracking, from:\n", size);
+	if (write(STDERR_FILENO, line, static_cast<size_t>(length)) == length) {
+		backtrace_symbols_fd(frames + 1, depth - 1, STDERR_FILENO);
+	}
+	tracing = false;
+#else
+	static_cast<void>(size);
+#endif
+}
+
+static void noteFree(const void* p) {
+	if (p && tracking.load(std::memory_order_relaxed)) frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+#ifdef __GLIBC__
+static void* allocate(size_t size) {
+	noteAllocation(size);
+	return __libc_malloc(size);
+}
+
+static void release(void* p) {
+	noteFree(p);
+	__libc_free(p);
+}
+
+extern "C" void* malloc(size_t size) noexcept {
+	return allocate(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept {
+	noteAllocation(count * size);
+	return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) noexcept {
+	noteAllocation(size);
+	return __libc_realloc(p, size);
+}
+
+extern "C" int posix_memalign(void** p, size_t alignment, size_t size) noexcept {
+	noteAllocation(size);
+	*p = __libc_memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+extern "C" void free(void* p) noexcept {
+	release(p);
+}
+#else
+static void* allocate(size_t size) {
+	noteAllocation(size);
+	return std::malloc(size);
+}
+
+static void release(void* p) {
+	noteFree(p);
+	std::free(p);
+}
+#endif
+
+void* operator new(size_t size) {
+	void* p = allocate(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p) noexcept {
+	release(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	release(p);
+}
+
+void beginAllocTracking() {
+#ifdef __GLIBC__
+	// the first backtrace() loads libgcc, which allocates
+	void* frames[1];
+	backtrace(frames, 1);
+#endif
+	allocations.store(0);
+	frees.store(0);
+	traces.store(0);
+	tracking.store(true);
+}
+
+bool endAllocTracking(AllocCounts* counts) {
+	tracking.store(false);
+	counts->allocations = allocations.load();
+	counts->frees = frees.load();
+	return counts->allocations == 0 && counts->frees == 0;
+}
@@ -0,0 +1,610 @@
+/*******************************************************************
+*   audio.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Expansion audio chips (VRC6, VRC7, Namco 163 and Sunsoft 5B), rendered
+// a block of samples at a time into the APU's buffer, from one register
+// write to the next.
+
+#include "NES.h"
+
+#include <cmath>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// -log2(sin) over a quarter wave, in 1/256 octave steps
+constexpr uint16_t logsin_tbl[256] = {
+	2137, 1731, 1543, 1419, 1326, 1252, 1190, 1137, 1091, 1050, 1013, 979, 949, 920, 894, 869,
+	846, 825, 804, 785, 767, 749, 732, 717, 701, 687, 672, 659, 646, 633, 621, 609,
+	598, 587, 576, 566, 556, 546, 536, 527, 518, 509, 501, 492, 484, 476, 468, 461,
+	453, 446, 439, 432, 425, 418, 411, 405, 399, 392, 386, 380, 375, 369, 363, 358,
+	352, 347, 341, 336, 331, 326, 321, 316, 311, 307, 302, 297, 293, 289, 284, 280,
+	276, 271, 267, 263, 259, 255, 251, 248, 244, 240, 236, 233, 229, 226, 222, 219,
+	215, 212, 209, 205, 202, 199, 196, 193, 190, 187, 184, 181, 178, 175, 172, 169,
+	167, 164, 161, 159, 156, 153, 151, 148, 146, 143, 141, 138, 136, 134, 131, 129,
+	127, 125, 122, 120, 118, 116, 114, 112, 110, 108, 106, 104, 102, 100, 98, 96,
+	94, 92, 91, 89, 87, 85, 83, 82, 80, 78, 77, 75, 74, 72, 70, 69,
+	67, 66, 64, 63, 62, 60, 59, 57, 56, 55, 53, 52, 51, 49, 48, 47,
+	46, 45, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 31, 30,
+	29, 28, 27, 26, 25, 24, 23, 23, 22, 21, 20, 20, 19, 18, 17, 17,
+	16, 15, 15, 14, 13, 13, 12, 12, 11, 10, 10, 9, 9, 8, 8, 7,
+	7, 7, 6, 6, 5, 5, 5, 4, 4, 4, 3, 3, 3, 2, 2, 2,
+	2, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// 2^(i/256) - 1, scaled by 1024
+constexpr uint16_t exp_tbl[256] = {
+	0, 3, 6, 8, 11, 14, 17, 20, 22, 25, 28, 31, 34, 37, 40, 42,
+	45, 48, 51, 54, 57, 60, 63, 66, 69, 72, 75, 78, 81, 84, 87, 90,
+	93, 96, 99, 102, 105, 108, 111, 114, 117, 120, 123, 126, 130, 133, 136, 139,
+	142, 145, 148, 152, 155, 158, 161, 164, 168, 171, 174, 177, 181, 184, 187, 190,
+	194, 197, 200, 204, 207, 210, 214, 217, 220, 224, 227, 231, 234, 237, 241, 244,
+	248, 251, 255, 258, 262, 265, 268, 272, 276, 279, 283, 286, 290, 293, 297, 300,
+	304, 308, 311, 315, 318, 322, 326, 329, 333, 337, 340, 344, 348, 352, 355, 359,
+	363, 367, 370, 374, 378, 382, 385, 389, 393, 397, 401, 405, 409, 412, 416, 420,
+	424, 428, 432, 436, 440, 444, 448, 452, 456, 460, 464, 468, 472, 476, 480, 484,
+	488, 492, 496, 501, 505, 509, 513, 517, 521, 526, 530, 534, 538, 542, 547, 551,
+	555, 560, 564, 568, 572, 577, 581, 585, 590, 594, 599, 603, 607, 612, 616, 621,
+	625, 630, 634, 639, 643, 648, 652, 657, 661, 666, 670, 675, 680, 684, 689, 693,
+	698, 703, 708, 712, 717, 722, 726, 731, 736, 741, 745, 750, 755, 760, 765, 770,
+	774, 779, 784, 789, 794, 799, 804, 809, 814, 819, 824, 829, 834, 839, 844, 849,
+	854, 859, 864, 869, 874, 880, 885, 890, 895, 900, 906, 911, 916, 921, 927, 932,
+	937, 942, 948, 953, 959, 964, 969, 975, 980, 986, 991, 996, 1002, 1007, 1013, 1018
+};
+
+// 1.5 dB per level
+constexpr float s5b_vol_tbl[32] = {
+	0.0f, 0.00562341325f, 0.00668343918f, 0.00794328235f, 0.00944060876f, 0.0112201845f, 0.0133352143f, 0.0158489319f,
+	0.0188364909f, 0.0223872114f, 0.0266072506f, 0.0316227766f, 0.0375837404f, 0.0446683592f, 0.0530884444f, 0.0630957344f,
+	0.0749894209f, 0.0891250938f, 0.105925373f, 0.125892541f, 0.149623566f, 0.177827941f, 0.211348904f, 0.251188643f,
+	0.298538262f, 0.354813389f, 0.421696503f, 0.501187234f, 0.595662144f, 0.707945784f, 0.841395142f, 1.0f
+};
+
+// VRC7 instruments 1-15. Modulator and carrier flags and multiplier,
+// KSL/TL, KSL/waveforms/feedback, attack/decay, sustain/release.
+constexpr uint8_t vrc7_patches[15][8] = {
+	{ 0x03, 0x21, 0x05, 0x06, 0xE8, 0x81, 0x42, 0x27 },
+	{ 0x13, 0x41, 0x14, 0x0D, 0xD8, 0xF6, 0x23, 0x12 },
+	{ 0x11, 0x11, 0x08, 0x08, 0xFA, 0xB2, 0x20, 0x12 },
+	{ 0x31, 0x61, 0x0C, 0x07, 0xA8, 0x64, 0x61, 0x27 },
+	{ 0x32, 0x21, 0x1E, 0x06, 0xE1, 0x76, 0x01, 0x28 },
+	{ 0x02, 0x01, 0x06, 0x00, 0xA3, 0xE2, 0xF4, 0xF4 },
+	{ 0x21, 0x61, 0x1D, 0x07, 0x82, 0x81, 0x11, 0x07 },
+	{ 0x23, 0x21, 0x22, 0x17, 0xA2, 0x72, 0x01, 0x17 },
+	{ 0x35, 0x11, 0x25, 0x00, 0x40, 0x73, 0x72, 0x01 },
+	{ 0xB5, 0x01, 0x0F, 0x0F, 0xA8, 0xA5, 0x51, 0x02 },
+	{ 0x17, 0xC1, 0x24, 0x07, 0xF8, 0xF8, 0x22, 0x12 },
+	{ 0x71, 0x23, 0x11, 0x06, 0x65, 0x74, 0x18, 0x16 },
+	{ 0x01, 0x02, 0xD3, 0x05, 0xC9, 0x95, 0x03, 0x02 },
+	{ 0x61, 0x63, 0x0C, 0x00, 0x94, 0xC0, 0x33, 0xF6 },
+	{ 0x21, 0x72, 0x0D, 0x00, 0xC1, 0xD5, 0x56, 0x06 }
+};
+
+// frequency multiplier x2
+constexpr uint8_t opll_mult_tbl[16] = { 1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30 };
+
+// key scale level by the top 4 bits of F-Number, in 0.75 dB steps
+constexpr uint8_t opll_ksl_tbl[16] = { 0, 24, 32, 37, 40, 43, 45, 47, 48, 50, 51, 52, 53, 54, 55, 56 };
+
+// OPLL native sample rate over the output rate
+constexpr double opll_ratio = (3579545.0 / 72.0) / 44100.0;
+
+// output levels relative to the 2A03 mix
+constexpr float vrc6_scale = 0.0099f;
+constexpr float vrc7_scale = 0.000035f;
+constexpr float n163_scale = 0.0008f;
+constexpr float s5b_scale = 0.12f;
+
+void VRC6Audio::write(uint16_t address, uint8_t value) {
+	VRC6Pulse* p = (address & 0xF000) == 0x9000 ? &pulse1 : &pulse2;
+	switch (address) {
+	case 0x9000:
+	case 0xA000:
+		p->mode = (value & 0x80) == 0x80;
+		p->duty = (value >> 4) & 7;
+		p->volume = value & 0x0F;
+		break;
+	case 0x9001:
+	case 0xA001:
+		p->period = (p->period & 0x0F00) | value;
+		break;
+	case 0x9002:
+	case 0xA002:
+		p->period = static_cast<uint16_t>((p->period & 0x00FF) | ((value & 0x0F) << 8));
+		p->enabled = (value & 0x80) == 0x80;
+		if (!p->enabled) {
+			p->phase = 0.0f;
+		}
+		break;
+	case 0x9003:
+		halt = (value & 1) == 1;
+		shift = (value & 4) ? 8 : (value & 2) ? 4 : 0;
+		break;
+	case 0xB000:
+		saw.rate = value & 0x3F;
+		break;
+	case 0xB001:
+		saw.period = (saw.period & 0x0F00) | value;
+		break;
+	case 0xB002:
+		saw.period = static_cast<uint16_t>((saw.period & 0x00FF) | ((value & 0x0F) << 8));
+		saw.enabled = (value & 0x80) == 0x80;
+		if (!saw.enabled) {
+			saw.phase = 0.0f;
+		}
+		break;
+	}
+}
+
+// Each channel is stepped across the whole block in turn. Phases count
+// duty (or accumulator) steps, advancing by CPU cycles per sample over
+// the channel's period.
+static void renderVRC6Pulse(VRC6Pulse* p, bool halt, uint8_t shift, float* out, int count) {
+	if (!p->enabled) {
+		return;
+	}
+	const float level = static_cast<float>(p->volume) * vrc6_scale;
+	if (p->mode) {
+		for (int i = 0; i < count; ++i) {
+			out[i] += level;
+		}
+		return;
+	}
+	const float inc = halt ? 0.0f : static_cast<float>(SAMPLE_RATE / static_cast<double>((p->period >> shift) + 1));
+	const int threshold = 15 - p->duty;
+	float phase = p->phase;
+	for (int i = 0; i < count; ++i) {
+		phase += inc;
+		if (phase >= 16.0f) {
+			phase = fmodf(phase, 16.0f);
+		}
+		out[i] += static_cast<int>(phase) >= threshold ? level : 0.0f;
+	}
+	p->phase = phase;
+}
+
+static void renderVRC6Saw(VRC6Saw* s, bool halt, uint8_t shift, float* out, int count) {
+	if (!s->enabled) {
+		return;
+	}
+	const float inc = halt ? 0.0f : static_cast<float>(SAMPLE_RATE / static_cast<double>((s->period >> shift) + 1));
+	float phase = s->phase;
+	for (int i = 0; i < count; ++i) {
+		phase += inc;
+		if (phase >= 14.0f) {
+			phase = fmodf(phase, 14.0f);
+		}
+		// the accumulator gains 'rate' every other step and resets after 14
+		const int acc = (s->rate * (static_cast<int>(phase) >> 1)) & 0xFF;
+		out[i] += static_cast<float>(acc >> 3) * vrc6_scale;
+	}
+	s->phase = phase;
+}
+
+void VRC6Audio::render(float* out, int count) {
+	renderVRC6Pulse(&pulse1, halt, shift, out, count);
+	renderVRC6Pulse(&pulse2, halt, shift, out, count);
+	renderVRC6Saw(&saw, halt, shift, out, count);
+}
+
+void VRC7Audio::write(uint8_t value) {
+	if (address < 8) {
+		custom[address] = value;
+		return;
+	}
+	const int ch = address & 0x0F;
+	if (ch >= 6) {
+		return;
+	}
+	OPLLChannel* c = &channels[ch];
+	switch (address & 0xF0) {
+	case 0x10:
+		c->fnum = (c->fnum & 0x100) | value;
+		break;
+	case 0x20: {
+		c->fnum = static_cast<uint16_t>((c->fnum & 0xFF) | ((value & 1) << 8));
+		c->block = (value >> 1) & 7;
+		c->sustain = (value & 0x20) == 0x20;
+		const bool key = (value & 0x10) == 0x10;
+		if (key && !c->key) {
+			keyOn(c);
+		}
+		else if (!key && c->key) {
+			if (c->mod.env_state != EnvelopeOff) {
+				c->mod.env_state = EnvelopeRelease;
+			}
+			if (c->car.env_state != EnvelopeOff) {
+				c->car.env_state = EnvelopeRelease;
+			}
+		}
+		c->key = key;
+		break;
+	}
+	case 0x30:
+		c->instrument = value >> 4;
+		c->volume = value & 0x0F;
+		break;
+	}
+}
+
+void VRC7Audio::keyOn(OPLLChannel* c) {
+	c->mod.env_state = EnvelopeAttack;
+	c->mod.phase = 0;
+	c->car.env_state = EnvelopeAttack;
+	c->car.phase = 0;
+}
+
+// Per-operator values that only change on register writes,
+// worked out once per block.
+struct OPLLParams {
+	uint32_t inc;     // phase step per sample
+	int att;          // total level and key scaling, in 0.375 dB steps
+	float attack;     // envelope steps per sample in each state
+	float decay;
+	float sustain;
+	float release;
+	float sustain_level;
+	int feedback;
+	bool am;
+	bool vib;
+	bool half_sine;
+};
+
+// envelope steps per sample at an effective rate of 0-63
+static float opllRate(int rate) {
+	if (rate <= 0) {
+		return 0.0f;
+	}
+	if (rate > 63) {
+		rate = 63;
+	}
+	return static_cast<float>(static_cast<double>((4 + (rate & 3)) << (rate >> 2)) * (opll_ratio / 65536.0));
+}
+
+// 'op' 0: modulator, 1: carrier
+static void opllParams(OPLLParams* p, const OPLLChannel* c, const uint8_t* patch, int op) {
+	const uint8_t flags = patch[op];
+	const int ksl = (op == 0 ? patch[2] : patch[3]) >> 6;
+	const bool eg = (flags & 0x20) == 0x20;
+	const int ar = patch[4 + op] >> 4;
+	const int dr = patch[4 + op] & 0x0F;
+	const int sl = patch[6 + op] >> 4;
+	const int rr = patch[6 + op] & 0x0F;
+	const int rks = (flags & 0x10) ? ((c->block << 1) | (c->fnum >> 8)) : (c->block >> 1);
+
+	p->inc = static_cast<uint32_t>(static_cast<double>((c->fnum * opll_mult_tbl[flags & 0x0F]) << c->block) * (opll_ratio * 128.0));
+
+	int key_scale = opll_ksl_tbl[c->fnum >> 5] - 8 * (7 - c->block);
+	key_scale = (ksl == 0 || key_scale < 0) ? 0 : (key_scale << 1) >> (3 - ksl);
+	p->att = key_scale + (op == 0 ? (patch[2] & 0x3F) << 1 : c->volume << 3);
+
+	p->attack = ar == 15 ? -1.0f : opllRate(ar ? ar * 4 + rks : 0);
+	p->decay = opllRate(dr ? dr * 4 + rks : 0);
+	p->sustain = eg ? 0.0f : opllRate(rr ? rr * 4 + rks : 0);
+	if (c->sustain) {
+		p->release = opllRate(5 * 4 + rks);
+	}
+	else if (eg) {
+		p->release = opllRate(rr ? rr * 4 + rks : 0);
+	}
+	else {
+		p->release = opllRate(7 * 4 + rks);
+	}
+	p->sustain_level = static_cast<float>(sl << 3);
+	p->feedback = op == 0 ? patch[3] & 7 : 0;
+	p->am = (flags & 0x80) == 0x80;
+	p->vib = (flags & 0x40) == 0x40;
+	p->half_sine = (patch[3] & (op == 0 ? 0x08 : 0x10)) != 0;
+}
+
+static void opllEnvelope(OPLLOperator* o, const OPLLParams* p) {
+	switch (o->env_state) {
+	case EnvelopeAttack:
+		if (p->attack < 0.0f) {
+			o->env = 0.0f;
+		}
+		else {
+			o->env -= (o->env * 0.125f + 1.0f) * p->attack;
+		}
+		if (o->env <= 0.0f) {
+			o->env = 0.0f;
+			o->env_state = EnvelopeDecay;
+		}
+		break;
+	case EnvelopeDecay:
+		o->env += p->decay;
+		if (o->env >= p->sustain_level) {
+			o->env = p->sustain_level;
+			o->env_state = EnvelopeSustain;
+		}
+		break;
+	case EnvelopeSustain:
+		o->env += p->sustain;
+		if (o->env >= 127.0f) {
+			o->env = 127.0f;
+		}
+		break;
+	case EnvelopeRelease:
+		o->env += p->release;
+		if (o->env >= 127.0f) {
+			o->env = 127.0f;
+			o->env_state = EnvelopeOff;
+		}
+		break;
+	}
+}
+
+// 'phase' is a 10-bit index into one sine cycle, 'att' is in 1/256 octave
+// steps. The sine is looked up as a logarithm so the attenuation is a
+// plain add, then converted back through the exponent table.
+static int opllOutput(int phase, int att, bool half_sine) {
+	if (half_sine && (phase & 512)) {
+		return 0;
+	}
+	const int i = (phase & 256) ? 255 - (phase & 255) : (phase & 255);
+	const int a = logsin_tbl[i] + att;
+	if (a >= 0x1000) {
+		return 0;
+	}
+	const int v = ((exp_tbl[255 - (a & 255)] + 1024) << 1) >> (a >> 8);
+	return (phase & 512) ? -v : v;
+}
+
+void VRC7Audio::render(float* out, int count) {
+	if (silenced) {
+		return;
+	}
+	OPLLParams mod[6];
+	OPLLParams car[6];
+	bool active[6];
+	for (int ch = 0; ch < 6; ++ch) {
+		const OPLLChannel* c = &channels[ch];
+		active[ch] = c->car.env_state != EnvelopeOff;
+		if (active[ch]) {
+			const uint8_t* patch = c->instrument ? vrc7_patches[c->instrument - 1] : custom;
+			opllParams(&mod[ch], c, patch, 0);
+			opllParams(&car[ch], c, patch, 1);
+		}
+	}
+
+	for (int i = 0; i < count; ++i) {
+		// AM is a 3.7 Hz triangle up to 4.8 dB, vibrato 6.4 Hz at about 7 cents
+		am_phase += static_cast<float>(3.7 / 44100.0);
+		vib_phase += static_cast<float>(6.4 / 44100.0);
+		am_phase -= floorf(am_phase);
+		vib_phase -= floorf(vib_phase);
+		const int am = static_cast<int>(fabsf(am_phase * 2.0f - 1.0f) * 13.0f);
+		const float vib = 1.0f + (fabsf(vib_phase * 2.0f - 1.0f) * 2.0f - 1.0f) * 0.004f;
+
+		int sum = 0;
+		for (int ch = 0; ch < 6; ++ch) {
+			if (!active[ch]) {
+				continue;
+			}
+			OPLLChannel* c = &channels[ch];
+
+			OPLLOperator* m = &c->mod;
+			const OPLLParams* mp = &mod[ch];
+			opllEnvelope(m, mp);
+			m->phase += mp->vib ? static_cast<uint32_t>(static_cast<float>(mp->inc) * vib) : mp->inc;
+			const int m_att = (static_cast<int>(m->env) + mp->att + (mp->am ? am : 0)) << 4;
+			int m_phase = static_cast<int>(m->phase >> 17);
+			if (mp->feedback) {
+				m_phase += (m->out[0] + m->out[1]) >> (9 - mp->feedback);
+			}
+			const int m_out = opllOutput(m_phase & 1023, m_att, mp->half_sine);
+			m->out[1] = m->out[0];
+			m->out[0] = m_out;
+
+			OPLLOperator* k = &c->car;
+			const OPLLParams* kp = &car[ch];
+			opllEnvelope(k, kp);
+			k->phase += kp->vib ? static_cast<uint32_t>(static_cast<float>(kp->inc) * vib) : kp->inc;
+			const int k_att = (static_cast<int>(k->env) + kp->att + (kp->am ? am : 0)) << 4;
+			const int k_phase = static_cast<int>(k->phase >> 17) + (m_out >> 1);
+			sum += opllOutput(k_phase & 1023, k_att, kp->half_sine);
+		}
+		out[i] += static_cast<float>(sum) * vrc7_scale;
+	}
+}
+
+uint8_t N163Audio::read() {
+	const uint8_t value = ram[address];
+	if (auto_increment) {
+		address = (address + 1) & 0x7F;
+	}
+	return value;
+}
+
+void N163Audio::writeAddress(uint8_t value) {
+	address = value & 0x7F;
+	auto_increment = (value & 0x80) == 0x80;
+}
+
+void N163Audio::writeData(uint8_t value) {
+	ram[address] = value;
+	// phase registers are the low, mid and high bytes of a 16.8 wave position
+	if (address >= 0x40 && (address & 1) && (address & 7) != 7) {
+		const int c = (address - 0x40) >> 3;
+		const int base = 0x40 + (c << 3);
+		const uint32_t pos = static_cast<uint32_t>(ram[base + 1]) | (static_cast<uint32_t>(ram[base + 3]) << 8) | (static_cast<uint32_t>(ram[base + 5]) << 16);
+		phase[c] = pos;
+	}
+	if (auto_increment) {
+		address = (address + 1) & 0x7F;
+	}
+}
+
+// Channel state is unpacked from sound RAM into flat arrays of all eight
+// channels, silent ones with no volume, and the waveform into a table of
+// samples, so each output sample steps every channel the same way: a
+// fixed-point add, a wrap by one conditional subtract, and a table lookup,
+// with no branches in between. The positions are written back so the CPU reads them through $4800.
+void N163Audio::render(float* out, int count) {
+	if (disabled) {
+		return;
+	}
+	const int active = ((ram[0x7F] >> 4) & 7) + 1;
+	const int first = 8 - active;
+	const double updates = SAMPLE_RATE / (15.0 * active);
+
+	float wave[256];
+	for (int a = 0; a < 256; ++a) {
+		wave[a] = static_cast<float>(((ram[a >> 1] >> ((a & 1) << 2)) & 0x0F) - 8);
+	}
+
+	// 8.16 wave positions, as in the phase registers
+	uint32_t step[8];
+	uint32_t length[8];
+	uint32_t offset[8];
+	float volume[8];
+	for (int c = 0; c < 8; ++c) {
+		const uint8_t* r = ram + 0x40 + (c << 3);
+		const uint32_t freq = static_cast<uint32_t>(r[0]) | (static_cast<uint32_t>(r[2]) << 8) | (static_cast<uint32_t>(r[4] & 3) << 16);
+		length[c] = static_cast<uint32_t>(256 - (r[4] & 0xFC)) << 16;
+		// less than a whole wave, so a single subtract always wraps
+		step[c] = c >= first ? static_cast<uint32_t>(static_cast<double>(freq) * updates + 0.5) % length[c] : 0;
+		offset[c] = r[6];
+		volume[c] = c >= first ? static_cast<float>(r[7] & 0x0F) : 0.0f;
+		phase[c] %= length[c];
+	}
+
+	const float scale = n163_scale / static_cast<float>(active);
+	// the eight channels step together in one AVX2 register where there is one
+#ifdef __AVX2__
+	__m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(phase));
+	const __m256i steps = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(step));
+	const __m256i lengths = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(length));
+	const __m256i last = _mm256_sub_epi32(lengths, _mm256_set1_epi32(1));
+	const __m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset));
+	const __m256i bytes = _mm256_set1_epi32(0xFF);
+	const __m256 volumes = _mm256_loadu_ps(volume);
+	for (int i = 0; i < count; ++i) {
+		// positions stay below 2^25, so the signed compare is safe
+		p = _mm256_add_epi32(p, steps);
+		p = _mm256_sub_epi32(p, _mm256_and_si256(_mm256_cmpgt_epi32(p, last), lengths));
+		const __m256i index = _mm256_and_si256(_mm256_add_epi32(_mm256_srli_epi32(p, 16), offsets), bytes);
+		const __m256 level = _mm256_mul_ps(_mm256_i32gather_ps(wave, index, 4), volumes);
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(level), _mm256_extractf128_ps(level, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		out[i] += _mm_cvtss_f32(sum) * scale;
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(phase), p);
+#else
+	for (int i = 0; i < count; ++i) {
+		float level[8];
+		for (int c = 0; c < 8; ++c) {
+			phase[c] += step[c];
+			phase[c] -= phase[c] >= length[c] ? length[c] : 0;
+			level[c] = wave[((phase[c] >> 16) + offset[c]) & 0xFF] * volume[c];
+		}
+		out[i] += (((level[0] + level[4]) + (level[2] + level[6])) + ((level[1] + level[5]) + (level[3] + level[7]))) * scale;
+	}
+#endif
+
+	for (int c = first; c < 8; ++c) {
+		uint8_t* r = ram + 0x40 + (c << 3);
+		r[1] = phase[c] & 0xFF;
+		r[3] = (phase[c] >> 8) & 0xFF;
+		r[5] = (phase[c] >> 16) & 0xFF;
+	}
+}
+
+void Sunsoft5BAudio::write(uint8_t value) {
+	regs[address] = value;
+	if (address == 13) {
+		// restart the envelope
+		env_phase = 0.0f;
+		env_step = 0;
+		env_attack = (value & 4) == 4;
+		env_holding = false;
+	}
+}
+
+// Tone and noise both count in CPU cycles: a tone flips every 16 * period,
+// the noise LFSR clocks every 32 * period, and the 32-step envelope
+// steps every 16 * period.
+void Sunsoft5BAudio::render(float* out, int count) {
+	float tone_inc[3];
+	for (int c = 0; c < 3; ++c) {
+		int period = regs[c << 1] | ((regs[(c << 1) + 1] & 0x0F) << 8);
+		if (period == 0) {
+			period = 1;
+		}
+		tone_inc[c] = static_cast<float>(SAMPLE_RATE / (16.0 * period));
+	}
+	const int noise_period = (regs[6] & 0x1F) ? (regs[6] & 0x1F) : 1;
+	const float noise_inc = static_cast<float>(SAMPLE_RATE / (32.0 * noise_period));
+	const int env_period = (regs[11] | (regs[12] << 8)) ? (regs[11] | (regs[12] << 8)) : 1;
+	const float env_inc = static_cast<float>(SAMPLE_RATE / (16.0 * env_period));
+	const uint8_t mixer = regs[7];
+	const uint8_t shape = regs[13];
+
+	for (int i = 0; i < count; ++i) {
+		if (!env_holding) {
+			env_phase += env_inc;
+			while (env_phase >= 1.0f) {
+				env_phase -= 1.0f;
+				if (++env_step < 32) {
+					continue;
+				}
+				if ((shape & 8) == 0) {
+					// one-shot: fall silent
+					env_holding = true;
+					env_attack = false;
+					env_step = 31;
+				}
+				else if (shape & 1) {
+					env_holding = true;
+					if (shape & 2) {
+						env_attack = !env_attack;
+					}
+					env_step = 31;
+				}
+				else {
+					if (shape & 2) {
+						env_attack = !env_attack;
+					}
+					env_step = 0;
+				}
+				if (env_holding) {
+					break;
+				}
+			}
+		}
+		const int env_level = env_attack ? env_step : 31 - env_step;
+
+		noise_phase += noise_inc;
+		while (noise_phase >= 1.0f) {
+			noise_phase -= 1.0f;
+			const uint32_t bit = (noise_reg ^ (noise_reg >> 3)) & 1;
+			noise_reg = (noise_reg >> 1) | (bit << 16);
+		}
+
+		float sum = 0.0f;
+		for (int c = 0; c < 3; ++c) {
+			tone_phase[c] += tone_inc[c];
+			if (tone_phase[c] >= 1.0f) {
+				const int flips = static_cast<int>(tone_phase[c]);
+				tone_phase[c] -= static_cast<float>(flips);
+				tone_out[c] ^= (flips & 1) == 1;
+			}
+			const bool tone = tone_out[c] || (mixer & (1 << c));
+			const bool noise = (noise_reg & 1) || (mixer & (8 << c));
+			if (tone && noise) {
+				const uint8_t vol = regs[8 + c];
+				const int level = (vol & 0x10) ? env_level : ((vol & 0x0F) ? ((vol & 0x0F) << 1) + 1 : 0);
+				sum += s5b_vol_tbl[level];
+			}
+		}
+		out[i] += sum * s5b_scale;
+	}
+}
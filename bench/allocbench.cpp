@@ -0,0 +1,109 @@
+/*******************************************************************
+*   allocbench.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Standalone check that the hot paths allocate nothing (see 'alloc.cpp').
+// Builds and warms up the consoles it needs, then tracks allocations over
+// frame stepping, stepping with audio, save and load of states into a
+// reused buffer, copyState(), and batch stepping with emulateFrames() and
+// with stepEnvs() on two threads.
+// Any allocation fails it, with the stack it came from.
+//
+// Usage: allocbench <ROM file> [frames]
+
+#include "../NES.h"
+
+const int COPIES = MAX_INTERLEAVE;
+const int WARMUP_FRAMES = 120;
+
+static bool report(const char* phase) {
+	AllocCounts counts;
+	const bool ok = endAllocTracking(&counts);
+	std::cout << phase << ": " << counts.allocations << " allocations, " << counts.frees << " frees" << (ok ? "" : " (FAILED)") << std::endl;
+	return ok;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc > 3) {
+		std::cout << "Usage: allocbench <ROM file> [frames]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const int frames = argc == 3 ? atoi(argv[2]) : 300;
+
+	NES* nes = new NES(argv[1], "");
+	if (!nes->initialized) return EXIT_FAILURE;
+	for (int i = 0; i < WARMUP_FRAMES; ++i) {
+		nes->controller1->buttons = static_cast<uint8_t>(i >> 3);
+		emulateFrame(nes);
+	}
+	NES* consoles[COPIES];
+	for (int i = 0; i < COPIES; ++i) {
+		consoles[i] = cloneNES(nes);
+	}
+	std::vector<uint8_t> state;
+	saveState(nes, &state);
+
+	bool all_ok = true;
+	beginAllocTracking();
+	for (int i = 0; i < frames; ++i) {
+		nes->controller1->buttons = static_cast<uint8_t>(i >> 3);
+		emulateFrame(nes);
+	}
+	all_ok &= report("emulateFrame()");
+
+	beginAllocTracking();
+	for (int i = 0; i < frames; ++i) {
+		emulate(nes, 1.0 / 60.0);
+	}
+	all_ok &= report("emulate()");
+
+	beginAllocTracking();
+	for (int i = 0; i < frames; ++i) {
+		saveState(nes, &state);
+		if (!loadState(consoles[0], state.data(), state.size())) all_ok = false;
+	}
+	all_ok &= report("saveState() and loadState()");
+
+	beginAllocTracking();
+	for (int i = 0; i < frames; ++i) {
+		copyState(consoles[i % COPIES], nes);
+	}
+	all_ok &= report("copyState()");
+
+	beginAllocTracking();
+	for (int i = 0; i < frames; ++i) {
+		for (int k = 0; k < COPIES; ++k) {
+			consoles[k]->controller1->buttons = static_cast<uint8_t>((i >> 3) * (2 * k + 1));
+		}
+		emulateFrames(consoles, COPIES);
+	}
+	all_ok &= report("emulateFrames()");
+
+	Env* envs[COPIES];
+	uint8_t actions[COPIES];
+	for (int i = 0; i < COPIES; ++i) {
+		envs[i] = createEnv(consoles[i], EnvConfig());
+		actions[i] = static_cast<uint8_t>(i);
+	}
+	// starts the threads
+	stepEnvs(envs, actions, COPIES, 2, nullptr, nullptr);
+	beginAllocTracking();
+	for (int i = 0; i < frames / EnvConfig().frame_skip; ++i) {
+		stepEnvs(envs, actions, COPIES, 2, nullptr, nullptr);
+		if (envs[0]->done) resetEnv(envs[0]);
+	}
+	all_ok &= report("stepEnvs()");
+
+	for (int i = 0; i < COPIES; ++i) {
+		delete envs[i];
+		delete consoles[i];
+	}
+	delete nes;
+	return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
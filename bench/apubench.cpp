@@ -0,0 +1,225 @@
+/*******************************************************************
+*   apubench.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Standalone APU benchmark. Replays a VGM file, such as one recorded with
+// 'KNES <rom file> --vgm <file>', through tickAPU() with a bare console
+// (no cartridge, no CPU running) and reports how many samples per second
+// it produces, and the hardware counters per frame's worth of audio where
+// the system allows them. KNES has one APU implementation, so there is
+// nothing to compare against in one run; instead the hash of the output
+// is printed, and checked against an expected one if given, to compare
+// builds.
+//
+// Usage: apubench <VGM file> [repetitions] [expected hash]
+
+#include "../NES.h"
+
+#include <chrono>
+#include <cmath>
+
+enum VGMKind {
+	VGMWrite = 0,  // APU register write
+	VGMMemory = 1  // DMC sample data
+};
+
+struct VGMEvent {
+	uint64_t cycle;
+	uint16_t address;
+	uint8_t value;
+	uint8_t kind;
+};
+
+// The player's copy of $8000-$FFFF, filled from the VGM's data blocks.
+struct VGMMapper : public Mapper {
+	uint8_t image[0x8000];
+
+	uint8_t read(Cartridge* cartridge, uint16_t address) {
+		static_cast<void>(cartridge);
+		return address >= 0x8000 ? image[address & 0x7FFF] : 0;
+	}
+
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+		static_cast<void>(cartridge);
+		static_cast<void>(address);
+		static_cast<void>(value);
+	}
+
+	Mapper* clone(NES* nes) const {
+		return cloneMapper(this, nes);
+	}
+
+	void copyFrom(NES* nes, const Mapper* other) {
+		copyMapper(this, nes, other);
+	}
+
+	size_t stateSize() const {
+		return sizeof(*this);
+	}
+
+	VGMMapper() {
+		memset(image, 0, sizeof(image));
+	}
+};
+
+static uint32_t get32(const std::vector<uint8_t>& vgm, size_t offset) {
+	return static_cast<uint32_t>(vgm[offset]) | (static_cast<uint32_t>(vgm[offset + 1]) << 8) |
+		(static_cast<uint32_t>(vgm[offset + 2]) << 16) | (static_cast<uint32_t>(vgm[offset + 3]) << 24);
+}
+
+static bool loadVGM(const char* path, std::vector<VGMEvent>* events, uint64_t* end_cycle) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to open VGM file!" << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> vgm;
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		vgm.insert(vgm.end(), buf, buf + n);
+	}
+	fclose(fp);
+
+	if (vgm.size() < 0x88 || memcmp(vgm.data(), "Vgm ", 4) != 0 || get32(vgm, 0x84) == 0) {
+		std::cerr << "ERROR: not a VGM file for the NES APU!" << std::endl;
+		return false;
+	}
+
+	uint64_t sample = 0;
+	uint64_t cycle = 0;
+	size_t i = get32(vgm, 0x08) >= 0x150 && get32(vgm, 0x34) != 0 ? 0x34 + get32(vgm, 0x34) : 0x40;
+	while (i < vgm.size()) {
+		const uint8_t cmd = vgm[i];
+		if (cmd == 0x66) {
+			break;
+		}
+		else if (cmd == 0xB4 && i + 2 < vgm.size()) {
+			if (vgm[i + 1] <= 0x17) {
+				events->push_back({ cycle, static_cast<uint16_t>(0x4000 + vgm[i + 1]), vgm[i + 2], VGMWrite });
+			}
+			i += 3;
+			continue;
+		}
+		else if (cmd == 0x67 && i + 6 < vgm.size()) {
+			const uint8_t type = vgm[i + 2];
+			const uint32_t size = get32(vgm, i + 3);
+			if (i + 7 + size > vgm.size()) break;
+			if (type == 0xC2 && size >= 2) {
+				uint16_t address = static_cast<uint16_t>(vgm[i + 7] | (vgm[i + 8] << 8));
+				for (uint32_t k = 2; k < size; ++k, ++address) {
+					events->push_back({ cycle, address, vgm[i + 7 + k], VGMMemory });
+				}
+			}
+			i += 7 + size;
+			continue;
+		}
+		else if (cmd == 0x61 && i + 2 < vgm.size()) {
+			sample += vgm[i + 1] | (vgm[i + 2] << 8);
+			i += 3;
+		}
+		else if (cmd == 0x62 || cmd == 0x63) {
+			sample += cmd == 0x62 ? 735 : 882;
+			++i;
+		}
+		else if (cmd >= 0x70 && cmd <= 0x7F) {
+			sample += (cmd & 15) + 1;
+			++i;
+		}
+		else {
+			std::cerr << "ERROR: unsupported VGM command 0x" << std::hex << static_cast<int>(cmd) << std::dec << std::endl;
+			return false;
+		}
+		// first APU cycle of the sample
+		cycle = static_cast<uint64_t>(std::ceil(static_cast<double>(sample) * SAMPLE_RATE));
+	}
+	*end_cycle = cycle;
+	return true;
+}
+
+struct Result {
+	double ns;
+	int samples;
+	uint64_t hash;
+	PerfSample counts;
+};
+
+static Result replay(const std::vector<VGMEvent>& events, uint64_t end_cycle, const PerfCounters* perf) {
+	VGMMapper* mapper = new VGMMapper();
+	NES* nes = new NES(mapper);
+	APU* apu = nes->apu;
+	reserveAudio(nes, static_cast<double>(end_cycle) / CPU_FREQ);
+
+	Result r;
+	PerfSample before;
+	readPerfCounters(perf, &before);
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i <= events.size(); ++i) {
+		const uint64_t cycle = i < events.size() ? events[i].cycle : end_cycle;
+		while (apu->cycle < cycle) {
+			tickAPU(nes, apu);
+		}
+		if (i == events.size()) break;
+
+		const VGMEvent& e = events[i];
+		if (e.kind == VGMMemory) {
+			mapper->image[e.address & 0x7FFF] = e.value;
+		}
+		else {
+			writeByte(nes, e.address, e.value);
+		}
+	}
+	const auto end = std::chrono::steady_clock::now();
+	readPerfCounters(perf, &r.counts);
+	subtractPerf(&r.counts, before);
+
+	r.ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	r.samples = apu->sample_count;
+	r.hash = hashBytes(HASH_SEED, reinterpret_cast<const uint8_t*>(apu->samples), apu->sample_count * static_cast<int>(sizeof(float)));
+	delete nes;
+	return r;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc > 4) {
+		std::cout << "Usage: apubench <VGM file> [repetitions] [expected hash]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const int reps = argc >= 3 ? atoi(argv[2]) : 5;
+
+	std::vector<VGMEvent> events;
+	uint64_t end_cycle = 0;
+	if (!loadVGM(argv[1], &events, &end_cycle)) return EXIT_FAILURE;
+
+	PerfCounters perf;
+	openPerfCounters(&perf);
+
+	Result best = replay(events, end_cycle, &perf);
+	for (int i = 1; i < reps; ++i) {
+		const Result r = replay(events, end_cycle, &perf);
+		if (r.ns < best.ns) {
+			best.ns = r.ns;
+			best.counts = r.counts;
+		}
+	}
+
+	bool ok = true;
+	std::cout << std::endl << "tickAPU: " << best.samples << " samples, hash " << std::hex << best.hash << std::dec;
+	if (argc == 4 && strtoull(argv[3], nullptr, 16) != best.hash) {
+		std::cout << " (DIFFERS from " << argv[3] << ')';
+		ok = false;
+	}
+	std::cout << std::endl << "    " << static_cast<double>(best.samples) * 1e9 / best.ns << " samples/s, "
+		<< best.ns / static_cast<double>(best.samples) << " ns/sample" << std::endl;
+	printPerf(&perf, best.counts, static_cast<double>(end_cycle) * 60.0 / CPU_FREQ);
+
+	closePerfCounters(&perf);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
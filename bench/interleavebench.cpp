@@ -0,0 +1,126 @@
+/*******************************************************************
+*   interleavebench.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Standalone benchmark of interleaved execution. Runs four copies of a game,
+// each with its own input, first one instruction stream at a time, then
+// two and four at a time with emulateFrames(), checks that every copy ends
+// up the same either way and reports frames per second on one core, and
+// the hardware counters per frame where the system allows them.
+//
+// Usage: interleavebench <ROM file> [frames] [repetitions]
+
+#include "../NES.h"
+
+#include <chrono>
+
+const int COPIES = 4;
+const int WARMUP_FRAMES = 120;
+
+struct Result {
+	double ns;
+	uint64_t hashes[COPIES];
+	PerfSample counts;
+};
+
+// every copy presses its own pattern so they do not run in lockstep
+static uint8_t buttonsFor(int copy, int frame) {
+	return static_cast<uint8_t>((frame >> 3) * (2 * copy + 1));
+}
+
+static Result play(const NES* start, int ways, int frames, const PerfCounters* perf) {
+	NES* consoles[COPIES];
+	for (int i = 0; i < COPIES; ++i) {
+		consoles[i] = cloneNES(start);
+	}
+
+	Result r;
+	PerfSample before;
+	readPerfCounters(perf, &before);
+	const auto begin = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; ++frame) {
+		for (int i = 0; i < COPIES; ++i) {
+			consoles[i]->controller1->buttons = buttonsFor(i, frame);
+		}
+		if (ways == 1) {
+			for (int i = 0; i < COPIES; ++i) {
+				emulateFrame(consoles[i]);
+			}
+		}
+		else {
+			for (int i = 0; i < COPIES; i += ways) {
+				emulateFrames(consoles + i, ways);
+			}
+		}
+	}
+	const auto end = std::chrono::steady_clock::now();
+	readPerfCounters(perf, &r.counts);
+	subtractPerf(&r.counts, before);
+
+	r.ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+	for (int i = 0; i < COPIES; ++i) {
+		NES* nes = consoles[i];
+		uint64_t hash = hashBytes(HASH_SEED, nes->RAM, 2048);
+		hash = hashBytes(hash, reinterpret_cast<const uint8_t*>(nes->ppu->front), 256 * 240 * static_cast<int>(sizeof(nes->ppu->front[0])));
+		hash = hashBytes(hash, reinterpret_cast<const uint8_t*>(nes->apu->samples), nes->apu->sample_count * static_cast<int>(sizeof(float)));
+		r.hashes[i] = hash;
+		delete nes;
+	}
+	return r;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc > 4) {
+		std::cout << "Usage: interleavebench <ROM file> [frames] [repetitions]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const int frames = argc >= 3 ? atoi(argv[2]) : 600;
+	const int reps = argc == 4 ? atoi(argv[3]) : 3;
+
+	NES* start = new NES(argv[1], "");
+	if (!start->initialized) return EXIT_FAILURE;
+	for (int i = 0; i < WARMUP_FRAMES; ++i) {
+		emulateFrame(start);
+	}
+
+	PerfCounters perf;
+	openPerfCounters(&perf);
+
+	bool all_ok = true;
+	Result reference;
+	for (int ways = 1; ways <= MAX_INTERLEAVE; ways *= 2) {
+		Result best = play(start, ways, frames, &perf);
+		for (int i = 1; i < reps; ++i) {
+			const Result r = play(start, ways, frames, &perf);
+			if (r.ns < best.ns) {
+				best.ns = r.ns;
+				best.counts = r.counts;
+			}
+		}
+
+		if (ways == 1) {
+			reference = best;
+		}
+		std::cout << std::endl << ways << "-way: " << COPIES << " x " << frames << " frames";
+		for (int i = 0; i < COPIES; ++i) {
+			if (best.hashes[i] != reference.hashes[i]) {
+				std::cout << " (copy " << i << " DIFFERS from 1-way)";
+				all_ok = false;
+			}
+		}
+		const double total = static_cast<double>(COPIES) * frames;
+		std::cout << std::endl << "    " << total * 1e9 / best.ns << " frames/s per core, "
+			<< best.ns / reference.ns * 100.0 << "% of the 1-way time" << std::endl;
+		printPerf(&perf, best.counts, total);
+	}
+
+	closePerfCounters(&perf);
+	delete start;
+	return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
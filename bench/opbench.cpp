@@ -0,0 +1,182 @@
+/*******************************************************************
+*   opbench.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Standalone benchmark on synthetic programs (see 'synth.cpp'), which
+// need no ROM. First the cost of every opcode KNES implements: each runs
+// many times over in a loop, and the time of the bare loop is taken off
+// before dividing by the copies. The cost of an opcode includes the PPU
+// and APU time of the cycles it takes. Then whole frames of synthetic
+// workloads, each leaning on one subsystem, with the hardware counters
+// per frame where the system allows them.
+//
+// Usage: opbench [cycles per run] [repetitions]
+
+#include "../NES.h"
+
+#include <chrono>
+#include <unistd.h>
+
+const int OPCODE_COPIES = 256;
+const int WARMUP_CYCLES = 50000;
+const int WORKLOAD_FRAMES = 300;
+const int WARMUP_FRAMES = 60;
+
+static const char* const MODE_NAMES[14] = { "", "abs", "abs,X", "abs,Y", "A", "#imm", "impl", "(zp,X)", "(ind)", "(zp),Y", "rel", "zp", "zp,X", "zp,Y" };
+
+// NES only loads from files
+static NES* loadImage(const std::vector<uint8_t>& image) {
+	char path[] = "/tmp/opbenchXXXXXX";
+	const int fd = mkstemp(path);
+	if (fd < 0) {
+		std::cerr << "ERROR: failed to create a temporary file." << std::endl;
+		return nullptr;
+	}
+	const bool written = write(fd, image.data(), image.size()) == static_cast<ssize_t>(image.size());
+	close(fd);
+	NES* nes = written ? new NES(path, "") : nullptr;
+	unlink(path);
+	if (nes && !nes->initialized) {
+		delete nes;
+		nes = nullptr;
+	}
+	return nes;
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point begin) {
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+}
+
+// best nanoseconds per loop of an opcode program, or a negative number if it fails to run
+static double timeLoop(const std::vector<uint8_t>& image, int cycles, int reps) {
+	NES* nes = loadImage(image);
+	if (!nes) return -1.0;
+	reserveAudio(nes, std::max(cycles, WARMUP_CYCLES) / CPU_FREQ);
+	emulateCycles(nes, WARMUP_CYCLES);
+	double best = -1.0;
+	for (int i = 0; i < reps; ++i) {
+		const uint16_t before = static_cast<uint16_t>(nes->RAM[0x200] | nes->RAM[0x201] << 8);
+		const auto begin = std::chrono::steady_clock::now();
+		emulateCycles(nes, cycles);
+		const double ns = elapsedNs(begin);
+		const uint16_t loops = static_cast<uint16_t>((nes->RAM[0x200] | nes->RAM[0x201] << 8) - before);
+		if (loops == 0) break;
+		if (best < 0.0 || ns / loops < best) best = ns / loops;
+	}
+	delete nes;
+	return best;
+}
+
+struct Workload {
+	const char* name;
+	SynthConfig config;
+};
+
+static std::vector<Workload> workloads() {
+	std::vector<Workload> w;
+	SynthConfig c;
+	c.rendering = false;
+	c.vram_writes = 0;
+	c.oam_dmas = 0;
+	w.push_back({ "cpu only", c });
+	c.rendering = true;
+	w.push_back({ "rendering", c });
+	c.vram_writes = 1024;
+	w.push_back({ "$2007 writes", c });
+	c.vram_writes = 0;
+	c.oam_dmas = 4;
+	w.push_back({ "OAM DMA", c });
+	c.oam_dmas = 1;
+	c.mapper = 1;
+	c.bank_writes = 16;
+	w.push_back({ "MMC1 banking", c });
+	c.mapper = 4;
+	c.bank_writes = 48;
+	w.push_back({ "MMC3 banking", c });
+	return w;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc > 3) {
+		std::cout << "Usage: opbench [cycles per run] [repetitions]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const int cycles = argc >= 2 ? atoi(argv[1]) : 300000;
+	const int reps = argc == 3 ? atoi(argv[2]) : 3;
+
+	std::vector<uint8_t> image;
+	int count = 0;
+	generateOpcodeROM(0xEA, &count, &image);
+	const double base = timeLoop(image, cycles, reps);
+	if (base < 0.0) {
+		std::cerr << "ERROR: the bare opcode loop did not run." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// loading prints, so the table comes after all the runs
+	double op_ns[256];
+	int counts[256];
+	for (int i = 0; i < 256; ++i) {
+		counts[i] = OPCODE_COPIES;
+		op_ns[i] = generateOpcodeROM(static_cast<uint8_t>(i), &counts[i], &image) ? timeLoop(image, cycles, reps) : 0.0;
+	}
+
+	bool all_ok = true;
+	std::cout << std::endl << "opcode  name  mode    cycles  ns/instruction" << std::endl;
+	for (int i = 0; i < 256; ++i) {
+		const Instruction& instruction = instructions[i];
+		char line[64];
+		snprintf(line, sizeof(line), "$%02X     %s   %-7s %d       ", i, instruction.name, MODE_NAMES[instruction.mode], instruction.cycles);
+		std::cout << line;
+		if (instruction.size == 0) {
+			std::cout << "not implemented" << std::endl;
+		}
+		else if (op_ns[i] < 0.0) {
+			std::cout << "FAILED to loop" << std::endl;
+			all_ok = false;
+		}
+		else {
+			std::cout << (op_ns[i] - base) / counts[i] << std::endl;
+		}
+	}
+
+	PerfCounters perf;
+	openPerfCounters(&perf);
+	for (const Workload& w : workloads()) {
+		if (!generateROM(w.config, &image)) return EXIT_FAILURE;
+		NES* nes = loadImage(image);
+		if (!nes) return EXIT_FAILURE;
+		for (int i = 0; i < WARMUP_FRAMES; ++i) {
+			emulateFrame(nes);
+		}
+		double best = -1.0;
+		PerfSample best_counts;
+		for (int r = 0; r < reps; ++r) {
+			PerfSample before, after;
+			readPerfCounters(&perf, &before);
+			const auto begin = std::chrono::steady_clock::now();
+			for (int i = 0; i < WORKLOAD_FRAMES; ++i) {
+				emulateFrame(nes);
+			}
+			const double ns = elapsedNs(begin);
+			readPerfCounters(&perf, &after);
+			subtractPerf(&after, before);
+			if (best < 0.0 || ns < best) {
+				best = ns;
+				best_counts = after;
+			}
+		}
+		std::cout << std::endl << w.name << " (mapper " << static_cast<int>(w.config.mapper) << "): "
+			<< WORKLOAD_FRAMES * 1e9 / best << " frames/s, " << best / WORKLOAD_FRAMES << " ns/frame" << std::endl;
+		printPerf(&perf, best_counts, WORKLOAD_FRAMES);
+		delete nes;
+	}
+	closePerfCounters(&perf);
+	return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
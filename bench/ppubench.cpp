@@ -0,0 +1,104 @@
+/*******************************************************************
+*   ppubench.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Standalone PPU benchmark. Replays a trace recorded with
+// 'KNES <rom file> <PPU trace file>' through each PPU implementation,
+// with the CPU and APU out of the picture, checks every finished frame
+// against the recording and reports the time per pixel and per scanline,
+// and the hardware counters per frame where the system allows them.
+//
+// Usage: ppubench <rom file> <PPU trace file> [repetitions]
+
+#include "../NES.h"
+
+#include <chrono>
+
+struct Renderer {
+	const char* name;
+	int(*replay)(NES*, const PPUTrace*, uint64_t*);
+};
+
+const Renderer renderers[] = {
+	{ "tickPPU", replayPPUTrace<false> },
+	{ "tickPPU with fetch hooks", replayPPUTrace<true> }
+};
+
+int main(int argc, char* argv[]) {
+	if (argc != 3 && argc != 4) {
+		std::cout << "Usage: ppubench <rom file> <PPU trace file> [repetitions]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const int reps = argc == 4 ? atoi(argv[3]) : 5;
+
+	PPUTrace trace;
+	if (!loadPPUTrace(&trace, argv[2])) return EXIT_FAILURE;
+
+	const double pixels = static_cast<double>(trace.frames.size()) * 256.0 * 240.0;
+	const double scanlines = static_cast<double>(trace.end_tick) / 341.0;
+	std::vector<uint64_t> hashes(trace.frames.size());
+	PerfCounters perf;
+	openPerfCounters(&perf);
+
+	bool all_ok = true;
+	for (const Renderer& r : renderers) {
+		// an NES that has only just been powered on, without the CPU ever running
+		NES* nes = new NES(argv[1], "");
+		if (!nes->initialized) return EXIT_FAILURE;
+		if (nes->cartridge->hash != trace.rom_hash) {
+			std::cerr << "ERROR: PPU trace was recorded with a different ROM!" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		const int frames = r.replay(nes, &trace, hashes.data());
+		int first_bad = -1;
+		for (int i = 0; i < static_cast<int>(trace.frames.size()); ++i) {
+			if (i >= frames || hashes[i] != trace.frames[i]) {
+				first_bad = i;
+				break;
+			}
+		}
+
+		double best = 1e300;
+		PerfSample best_counts;
+		for (int i = 0; i < reps; ++i) {
+			delete nes;
+			nes = new NES(argv[1], "");
+			PerfSample counts;
+			PerfSample before;
+			readPerfCounters(&perf, &before);
+			const auto start = std::chrono::steady_clock::now();
+			r.replay(nes, &trace, nullptr);
+			const auto end = std::chrono::steady_clock::now();
+			readPerfCounters(&perf, &counts);
+			subtractPerf(&counts, before);
+			const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			if (ns < best) {
+				best = ns;
+				best_counts = counts;
+			}
+		}
+		delete nes;
+
+		std::cout << std::endl << r.name << ": " << frames << " frames, ";
+		if (first_bad < 0) {
+			std::cout << "all match" << std::endl;
+		}
+		else {
+			std::cout << "MISMATCH from frame " << first_bad << std::endl;
+			all_ok = false;
+		}
+		std::cout << "    " << best / pixels << " ns/pixel, " << best / scanlines << " ns/scanline" << std::endl;
+		printPerf(&perf, best_counts, static_cast<double>(trace.frames.size()));
+	}
+
+	closePerfCounters(&perf);
+
+	return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -772,7 +772,7 @@ constexpr Instruction instructions[256] = {
 	{ 47 , "RLA", nop, 1, 0, 6, 0 },
 	{ 48 , "BMI", bmi, 10, 2, 2, 1 },
 	{ 49 , "AND", and_instruction, 9, 2, 5, 1 },
-	{ 50 , "KIL", and_instruction, 6, 0, 2, 0 },
+	{ 50 , "KIL", nop, 6, 0, 2, 0 },
 	{ 51 , "RLA", nop, 9, 0, 8, 0 },
 	{ 52 , "NOP", nop, 12, 2, 4, 0 },
 	{ 53 , "AND", nop, 12, 2, 4, 0 },
@@ -957,7 +957,7 @@ constexpr Instruction instructions[256] = {
 	{ 232, "INX", inx, 6, 1, 2, 0 },
 	{ 233, "SBC", sbc, 5, 2, 2, 0 },
 	{ 234, "NOP", nop, 6, 1, 2, 0 },
-	{ 235, "SBC", sbc, 5, 0, 2, 0 },
+	{ 235, "SBC", sbc, 5, 2, 2, 0 },
 	{ 236, "CPX", cpx, 1, 3, 4, 0 },
 	{ 237, "SBC", sbc, 1, 3, 4, 0 },
 	{ 238, "INC", inc, 1, 3, 6, 0 },
@@ -980,6 +980,18 @@ constexpr Instruction instructions[256] = {
 	{ 255, "ISC", nop, 2, 0, 7, 0 }
 };
 
+// Instructions that store to the address they operate on. The
+// read-modify-write ones only do in their memory forms.
+bool writesOperand(const Instruction& instruction) {
+	const auto dispatch = instruction.dispatch;
+	if (dispatch == sta || dispatch == stx || dispatch == sty) return true;
+	return instruction.mode != modeAccumulator && (dispatch == asl || dispatch == lsr || dispatch == rol || dispatch == ror || dispatch == inc || dispatch == dec);
+}
+
+bool pushesStack(const Instruction& instruction) {
+	return instruction.dispatch == pha || instruction.dispatch == php || instruction.dispatch == jsr || instruction.dispatch == brk;
+}
+
 void execute(NES* nes, uint8_t opcode) {
 	const Instruction& instruction = instructions[opcode];
 	CPU* cpu = nes->cpu;
@@ -0,0 +1,362 @@
+/*******************************************************************
+*   dataset.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Chunked trajectory datasets for training pipelines.
+//
+// A file is a header, then chunks of up to DATASET_CHUNK_STEPS steps of one
+// instance in whatever order the workers finish them, then an index of the
+// chunks and a footer pointing at it. Each chunk stores its steps column by
+// column: the frames as video packets of the streaming codec (see
+// 'stream.cpp', starting from a keyframe so every chunk decodes on its
+// own), RAM as the bytes that changed since the step before, run-length
+// coded, then the controller bytes and the rewards as they are.
+//
+// Steps are only copied on the emulation threads; compression and writing
+// happen on the writer's worker threads. The chunks come from a fixed pool
+// allocated when the file is opened, so recording allocates nothing, and
+// an emulation thread that runs ahead of the workers waits for one to be
+// written rather than buffering without bound.
+
+#include "NES.h"
+
+constexpr uint32_t DATASET_MAGIC = 0x53444E4B; // "KNDS"
+constexpr uint32_t DATASET_CHUNK_MAGIC = 0x48434E4B; // "KNCH"
+constexpr uint32_t DATASET_INDEX_MAGIC = 0x58444E4B; // "KNDX"
+constexpr uint32_t DATASET_VERSION = 1;
+
+struct DatasetHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t rom_hash;
+};
+
+struct ChunkHeader {
+	uint32_t magic;
+	uint32_t instance;
+	uint64_t first_step;
+	uint32_t steps;
+	uint32_t frames_size;
+	uint32_t ram_size;
+	uint32_t inputs_size;
+	uint32_t rewards_size;
+	uint32_t reserved;
+};
+
+struct DatasetFooter {
+	uint64_t index_offset;
+	uint32_t chunk_count;
+	uint32_t magic;
+};
+
+// RAM deltas: a byte below 0x80 stands for that many + 1 unchanged bytes,
+// anything else for that many - 0x7F changed bytes, which follow it.
+static void packRAM(const uint8_t* ram, const uint8_t* prev, std::vector<uint8_t>* out) {
+	int i = 0;
+	while (i < 2048) {
+		int run = 0;
+		while (i + run < 2048 && run < 128 && ram[i + run] == prev[i + run]) ++run;
+		if (run > 0) {
+			out->push_back(static_cast<uint8_t>(run - 1));
+			i += run;
+			continue;
+		}
+		while (i + run < 2048 && run < 128 && ram[i + run] != prev[i + run]) ++run;
+		out->push_back(static_cast<uint8_t>(0x7F + run));
+		out->insert(out->end(), ram + i, ram + i + run);
+		i += run;
+	}
+}
+
+static bool unpackRAM(const uint8_t** p, const uint8_t* end, uint8_t* ram, const uint8_t* prev) {
+	int i = 0;
+	while (i < 2048) {
+		if (*p == end) return false;
+		const int code = *(*p)++;
+		const int run = code < 0x80 ? code + 1 : code - 0x7F;
+		if (i + run > 2048) return false;
+		if (code < 0x80) {
+			memcpy(ram + i, prev + i, run);
+		}
+		else {
+			if (end - *p < run) return false;
+			memcpy(ram + i, *p, run);
+			*p += run;
+		}
+		i += run;
+	}
+	return true;
+}
+
+static void compressChunk(FrameStream* stream, const TrajectoryChunk* c, std::vector<uint8_t>* out) {
+	out->assign(sizeof(ChunkHeader), 0);
+	ChunkHeader header;
+	header.magic = DATASET_CHUNK_MAGIC;
+	header.instance = c->instance;
+	header.first_step = c->first_step;
+	header.steps = static_cast<uint32_t>(c->steps);
+	header.reserved = 0;
+
+	stream->keyframe = true;
+	for (int i = 0; i < c->steps; ++i) {
+		encodeFrame(stream, c->frames.data() + static_cast<size_t>(i) * 256 * 240);
+		out->insert(out->end(), stream->packet.begin(), stream->packet.end());
+	}
+	header.frames_size = static_cast<uint32_t>(out->size() - sizeof(ChunkHeader));
+
+	const uint8_t zeros[2048] = {};
+	for (int i = 0; i < c->steps; ++i) {
+		const uint8_t* ram = c->ram.data() + i * 2048;
+		packRAM(ram, i == 0 ? zeros : ram - 2048, out);
+	}
+	header.ram_size = static_cast<uint32_t>(out->size() - sizeof(ChunkHeader) - header.frames_size);
+
+	header.inputs_size = static_cast<uint32_t>(2 * c->steps);
+	out->insert(out->end(), c->inputs.begin(), c->inputs.begin() + header.inputs_size);
+	header.rewards_size = static_cast<uint32_t>(sizeof(float) * c->steps);
+	const uint8_t* rewards = reinterpret_cast<const uint8_t*>(c->rewards.data());
+	out->insert(out->end(), rewards, rewards + header.rewards_size);
+
+	memcpy(out->data(), &header, sizeof(header));
+}
+
+static void datasetWorker(DatasetWriter* w) {
+	FrameStream* stream = new FrameStream();
+	std::vector<uint8_t> out;
+	for (;;) {
+		TrajectoryChunk* c;
+		{
+			std::unique_lock<std::mutex> lock(w->lock);
+			w->wake.wait(lock, [w] { return !w->pending.empty() || w->closing; });
+			if (w->pending.empty()) break;
+			c = w->pending.front();
+			w->pending.erase(w->pending.begin());
+		}
+
+		compressChunk(stream, c, &out);
+
+		{
+			std::lock_guard<std::mutex> lock(w->file_lock);
+			DatasetIndexEntry e;
+			e.instance = c->instance;
+			e.steps = static_cast<uint32_t>(c->steps);
+			e.first_step = c->first_step;
+			e.offset = w->end;
+			e.size = out.size();
+			if (fwrite(out.data(), out.size(), 1, w->fp) == 1) {
+				w->end += out.size();
+				w->index.push_back(e);
+			}
+			else {
+				w->failed = true;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(w->lock);
+		w->spare.push_back(c);
+		w->returned.notify_one();
+	}
+	delete stream;
+}
+
+bool openDataset(DatasetWriter* w, const char* path, uint64_t rom_hash, int threads, int chunks) {
+	w->fp = fopen(path, "wb");
+	if (w->fp == nullptr) {
+		std::cerr << "ERROR: failed to open dataset file for writing!" << std::endl;
+		return false;
+	}
+	DatasetHeader header;
+	header.magic = DATASET_MAGIC;
+	header.version = DATASET_VERSION;
+	header.rom_hash = rom_hash;
+	if (fwrite(&header, sizeof(header), 1, w->fp) != 1) {
+		std::cerr << "ERROR: failed to write dataset header!" << std::endl;
+		fclose(w->fp);
+		w->fp = nullptr;
+		return false;
+	}
+	w->end = sizeof(header);
+	w->closing = false;
+	w->failed = false;
+	w->pending.reserve(static_cast<size_t>(chunks));
+	w->spare.reserve(static_cast<size_t>(chunks));
+	for (int i = 0; i < chunks; ++i) {
+		TrajectoryChunk* c = new TrajectoryChunk();
+		c->frames.resize(DATASET_CHUNK_STEPS * 256 * 240);
+		c->ram.resize(DATASET_CHUNK_STEPS * 2048);
+		c->inputs.resize(DATASET_CHUNK_STEPS * 2);
+		c->rewards.resize(DATASET_CHUNK_STEPS);
+		w->spare.push_back(c);
+	}
+	for (int i = 0; i < (threads > 0 ? threads : 1); ++i) {
+		w->workers.emplace_back(datasetWorker, w);
+	}
+	return true;
+}
+
+static void submitChunk(Trajectory* t) {
+	DatasetWriter* w = t->writer;
+	std::lock_guard<std::mutex> lock(w->lock);
+	w->pending.push_back(t->chunk);
+	t->chunk = nullptr;
+	w->wake.notify_one();
+}
+
+void beginTrajectory(Trajectory* t, DatasetWriter* w, uint32_t instance) {
+	t->writer = w;
+	t->instance = instance;
+	t->steps = 0;
+	t->chunk = nullptr;
+}
+
+void recordStep(Trajectory* t, const NES* nes, float reward) {
+	if (t->chunk == nullptr) {
+		DatasetWriter* w = t->writer;
+		{
+			// every chunk is being filled or waiting to be written
+			std::unique_lock<std::mutex> lock(w->lock);
+			w->returned.wait(lock, [w] { return !w->spare.empty(); });
+			t->chunk = w->spare.back();
+			w->spare.pop_back();
+		}
+		t->chunk->instance = t->instance;
+		t->chunk->first_step = t->steps;
+		t->chunk->steps = 0;
+	}
+
+	TrajectoryChunk* c = t->chunk;
+	const int i = c->steps++;
+	memcpy(c->frames.data() + static_cast<size_t>(i) * 256 * 240, nes->ppu->front, 256 * 240 * sizeof(uint32_t));
+	memcpy(c->ram.data() + i * 2048, nes->RAM, 2048);
+	c->inputs[2 * i] = nes->controller1->buttons;
+	c->inputs[2 * i + 1] = nes->controller2->buttons;
+	c->rewards[i] = reward;
+	++t->steps;
+
+	if (c->steps == DATASET_CHUNK_STEPS) submitChunk(t);
+}
+
+void endTrajectory(Trajectory* t) {
+	if (t->chunk != nullptr) submitChunk(t);
+}
+
+bool closeDataset(DatasetWriter* w) {
+	{
+		std::lock_guard<std::mutex> lock(w->lock);
+		w->closing = true;
+		w->wake.notify_all();
+	}
+	for (std::thread& worker : w->workers) worker.join();
+	w->workers.clear();
+	for (TrajectoryChunk* c : w->spare) delete c;
+	w->spare.clear();
+
+	DatasetFooter footer;
+	footer.index_offset = w->end;
+	footer.chunk_count = static_cast<uint32_t>(w->index.size());
+	footer.magic = DATASET_INDEX_MAGIC;
+	bool ok = !w->failed;
+	if (ok && !w->index.empty()) {
+		ok = fwrite(w->index.data(), sizeof(DatasetIndexEntry), w->index.size(), w->fp) == w->index.size();
+	}
+	ok = ok && fwrite(&footer, sizeof(footer), 1, w->fp) == 1;
+	ok = fclose(w->fp) == 0 && ok;
+	w->fp = nullptr;
+	w->index.clear();
+	if (!ok) {
+		std::cerr << "ERROR: failed to write dataset!" << std::endl;
+	}
+	return ok;
+}
+
+bool loadDatasetIndex(const char* path, uint64_t* rom_hash, std::vector<DatasetIndexEntry>* index) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to open dataset file!" << std::endl;
+		return false;
+	}
+	DatasetHeader header;
+	DatasetFooter footer;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == DATASET_MAGIC && header.version == DATASET_VERSION;
+	ok = ok && fseek(fp, -static_cast<long>(sizeof(footer)), SEEK_END) == 0 && fread(&footer, sizeof(footer), 1, fp) == 1 && footer.magic == DATASET_INDEX_MAGIC;
+	if (ok) {
+		index->resize(footer.chunk_count);
+		ok = fseek(fp, static_cast<long>(footer.index_offset), SEEK_SET) == 0;
+		if (ok && footer.chunk_count != 0) {
+			ok = fread(index->data(), sizeof(DatasetIndexEntry), index->size(), fp) == index->size();
+		}
+	}
+	fclose(fp);
+	if (!ok) {
+		std::cerr << "ERROR: invalid dataset file!" << std::endl;
+		return false;
+	}
+	*rom_hash = header.rom_hash;
+	return true;
+}
+
+bool readDatasetChunk(const char* path, const DatasetIndexEntry& e, TrajectoryChunk* c) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to open dataset file!" << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> data(e.size);
+	bool ok = fseek(fp, static_cast<long>(e.offset), SEEK_SET) == 0 && fread(data.data(), data.size(), 1, fp) == 1;
+	fclose(fp);
+
+	ChunkHeader header;
+	ok = ok && data.size() >= sizeof(header);
+	if (ok) {
+		memcpy(&header, data.data(), sizeof(header));
+		ok = header.magic == DATASET_CHUNK_MAGIC && header.steps <= DATASET_CHUNK_STEPS
+			&& header.inputs_size == 2 * header.steps && header.rewards_size == sizeof(float) * header.steps
+			&& sizeof(header) + static_cast<uint64_t>(header.frames_size) + header.ram_size + header.inputs_size + header.rewards_size == data.size();
+	}
+	if (!ok) {
+		std::cerr << "ERROR: invalid dataset chunk!" << std::endl;
+		return false;
+	}
+
+	c->instance = header.instance;
+	c->first_step = header.first_step;
+	c->steps = static_cast<int>(header.steps);
+	c->frames.resize(static_cast<size_t>(c->steps) * 256 * 240);
+	c->ram.resize(c->steps * 2048);
+	c->inputs.resize(c->steps * 2);
+	c->rewards.resize(c->steps);
+
+	const uint8_t* p = data.data() + sizeof(header);
+	const uint8_t* end = p + header.frames_size;
+	FrameDecoder* decoder = new FrameDecoder();
+	for (int i = 0; i < c->steps && ok; ++i) {
+		const size_t size = end - p >= static_cast<ptrdiff_t>(STREAM_HEADER) ? STREAM_HEADER + (p[1] | (p[2] << 8) | (p[3] << 16) | (static_cast<size_t>(p[4]) << 24)) : 0;
+		ok = size != 0 && size <= static_cast<size_t>(end - p) && decodePacket(decoder, p, size) == STREAM_VIDEO;
+		if (ok) memcpy(c->frames.data() + static_cast<size_t>(i) * 256 * 240, decoder->pixels, sizeof(decoder->pixels));
+		p += size;
+	}
+	delete decoder;
+	ok = ok && p == end;
+
+	const uint8_t zeros[2048] = {};
+	end = p + header.ram_size;
+	for (int i = 0; i < c->steps && ok; ++i) {
+		uint8_t* ram = c->ram.data() + i * 2048;
+		ok = unpackRAM(&p, end, ram, i == 0 ? zeros : ram - 2048);
+	}
+	ok = ok && p == end;
+	if (ok) {
+		memcpy(c->inputs.data(), p, header.inputs_size);
+		memcpy(c->rewards.data(), p + header.inputs_size, header.rewards_size);
+	}
+	else {
+		std::cerr << "ERROR: corrupt dataset chunk!" << std::endl;
+	}
+	return ok;
+}
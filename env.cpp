@@ -0,0 +1,178 @@
+/*******************************************************************
+*   env.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Atari-style environment stepping for reinforcement learning, done natively
+// so that a whole step costs one call: action repeat, sticky actions,
+// max-pooling of the last two frames and a stack of recent observations.
+
+#include "NES.h"
+
+// xorshift64*, so runs with the same seed stick the same way
+static float nextRandom(uint64_t* state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return static_cast<float>((*state * 0x2545F4914F6CDD1DULL) >> 40) / 16777216.0f;
+}
+
+Env* createEnv(NES* nes, const EnvConfig& config) {
+	Env* env = new Env();
+	env->nes = nes;
+	env->start = cloneNES(nes);
+	env->config = config;
+	if (env->config.frame_skip < 1) env->config.frame_skip = 1;
+	if (env->config.stack < 1) env->config.stack = 1;
+	env->rng = config.seed != 0 ? config.seed : 0x9E3779B97F4A7C15ULL;
+	env->frames.resize(static_cast<size_t>(env->config.stack) * 256 * 240);
+	env->pool.resize(256 * 240);
+	resetEnv(env);
+	return env;
+}
+
+void resetEnv(Env* env) {
+	copyState(env->nes, env->start);
+	env->buttons = 0;
+	env->newest = 0;
+	env->reward = 0.0f;
+	env->done = false;
+	if (env->config.rules != nullptr) resetRules(env->config.rules, &env->rule_state, env->nes);
+	resetWatchdog(&env->watchdog, env->nes);
+	// the stack starts out as copies of the first picture
+	for (int i = 0; i < env->config.stack; ++i) {
+		memcpy(env->frames.data() + static_cast<size_t>(i) * 256 * 240, env->nes->ppu->front, 256 * 240 * sizeof(uint32_t));
+	}
+}
+
+void stepEnv(Env* env, uint8_t action) {
+	NES* nes = env->nes;
+	const int skip = env->config.frame_skip;
+	env->reward = 0.0f;
+	int f = 0;
+	while (f < skip && !env->done) {
+		// a sticky frame keeps whatever the controller had before
+		if (env->config.sticky <= 0.0f || nextRandom(&env->rng) >= env->config.sticky) {
+			env->buttons = action;
+		}
+		nes->controller1->buttons = env->buttons;
+		emulateFrame(nes);
+		if (env->config.max_pool && f == skip - 2) {
+			memcpy(env->pool.data(), nes->ppu->front, 256 * 240 * sizeof(uint32_t));
+		}
+		++f;
+		if (env->config.rules != nullptr) {
+			float reward;
+			evaluateRules(env->config.rules, &env->rule_state, nes, &reward, &env->done);
+			env->reward += reward;
+		}
+		if (watchdogFrame(&env->watchdog, nes)) {
+			env->done = true;
+		}
+	}
+
+	env->newest = (env->newest + 1) % env->config.stack;
+	uint32_t* out = env->frames.data() + static_cast<size_t>(env->newest) * 256 * 240;
+	// a step cut short by the end of the episode has no second last frame
+	if (!env->config.max_pool || skip < 2 || f < skip) {
+		memcpy(out, nes->ppu->front, 256 * 240 * sizeof(uint32_t));
+		return;
+	}
+	// per channel, as sprites that flicker show up on alternate frames
+	const uint32_t* a = env->pool.data();
+	const uint32_t* b = nes->ppu->front;
+	for (int i = 0; i < 256 * 240; ++i) {
+		uint32_t v = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			const uint32_t ca = (a[i] >> shift) & 0xFF;
+			const uint32_t cb = (b[i] >> shift) & 0xFF;
+			v |= (ca > cb ? ca : cb) << shift;
+		}
+		out[i] = v;
+	}
+}
+
+static void stepEnvRange(Env* const* envs, const uint8_t* actions, int begin, int end, float* rewards, bool* dones) {
+	for (int i = begin; i < end; ++i) {
+		stepEnv(envs[i], actions[i]);
+		if (rewards != nullptr) rewards[i] = envs[i]->reward;
+		if (dones != nullptr) dones[i] = envs[i]->done;
+	}
+}
+
+// Threads for stepEnvs(), started as first needed and kept, so that a
+// batch step neither spawns threads nor allocates. One batch runs at a
+// time; thread t takes part in it if t is below its 'threads'.
+struct StepWorkers {
+	std::mutex busy;
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable finished;
+	int started;
+	uint64_t batch;
+	int remaining; // threads still stepping the batch
+
+	Env* const* envs;
+	const uint8_t* actions;
+	int count;
+	int threads;
+	float* rewards;
+	bool* dones;
+
+	StepWorkers() : started(0), batch(0), remaining(0), envs(nullptr), actions(nullptr), count(0), threads(0), rewards(nullptr), dones(nullptr) {}
+};
+
+static void stepWorker(StepWorkers* w, int t) {
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(w->mutex);
+	for (;;) {
+		w->start.wait(lock, [&] { return w->batch != seen; });
+		seen = w->batch;
+		if (t >= w->threads) continue;
+		lock.unlock();
+		stepEnvRange(w->envs, w->actions, w->count * t / w->threads, w->count * (t + 1) / w->threads, w->rewards, w->dones);
+		lock.lock();
+		if (--w->remaining == 0) w->finished.notify_one();
+	}
+}
+
+void stepEnvs(Env* const* envs, const uint8_t* actions, int count, int threads, float* rewards, bool* dones) {
+	if (threads > count) threads = count;
+	if (threads <= 1) {
+		stepEnvRange(envs, actions, 0, count, rewards, dones);
+		return;
+	}
+
+	// never freed, as the threads wait on it until the process exits
+	static StepWorkers* workers = new StepWorkers();
+	std::lock_guard<std::mutex> busy(workers->busy);
+	{
+		std::lock_guard<std::mutex> lock(workers->mutex);
+		while (workers->started < threads - 1) {
+			std::thread(stepWorker, workers, ++workers->started).detach();
+		}
+		workers->envs = envs;
+		workers->actions = actions;
+		workers->count = count;
+		workers->threads = threads;
+		workers->rewards = rewards;
+		workers->dones = dones;
+		workers->remaining = threads - 1;
+		++workers->batch;
+	}
+	workers->start.notify_all();
+	stepEnvRange(envs, actions, 0, count / threads, rewards, dones);
+	std::unique_lock<std::mutex> lock(workers->mutex);
+	workers->finished.wait(lock, [&] { return workers->remaining == 0; });
+}
+
+const uint32_t* envObservation(const Env* env, int age) {
+	const int stack = env->config.stack;
+	const int i = ((env->newest - age) % stack + stack) % stack;
+	return env->frames.data() + static_cast<size_t>(i) * 256 * 240;
+}
@@ -0,0 +1,691 @@
+/*******************************************************************
+*   jobs.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Sweeps of (ROM, input script, seed) jobs over a pool of headless worker
+// processes.
+//
+// The coordinator listens on a Unix or TCP socket and workers connect to
+// it: ones it forks itself, or ones started by hand on other machines that
+// see the ROMs and scripts at the same paths. Each worker is sent up to
+// 'depth' jobs, runs the first and holds the rest. Once the queue runs dry,
+// an idle worker steals a job another worker is still holding. A busy
+// worker reports every second and sends a save state every
+// CHECKPOINT_FRAMES frames; one that disconnects or goes quiet is dropped
+// and its jobs go back on the queue, to resume from their last checkpoint.
+//
+// Result lines are appended to the output file as jobs finish, each
+// starting with the job's number in the list. Checkpoints are also kept as
+// '<output>.<job>.state', so a coordinator started again on the same list
+// skips the jobs already in the output and resumes the others.
+//
+// An input script is lines of '<frames> <buttons>', where the buttons are
+// '-' for none, names from A B SELECT START UP DOWN LEFT RIGHT joined by
+// '+', or RANDOM for a fresh set every 4 frames drawn from the job's seed.
+// '#' starts a comment.
+
+#include "NES.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <chrono>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr uint32_t CHECKPOINT_FRAMES = 1800;
+constexpr double REPORT_SECONDS = 1.0;
+constexpr int RANDOM_HOLD = 4; // frames each RANDOM set is held for
+
+// Packets are framed as for streaming, see receivePacket().
+constexpr uint8_t JOB_START = 1;      // index, seed, frame, ROM, script, save state
+constexpr uint8_t JOB_REVOKE = 2;     // index of a held job to hand back
+constexpr uint8_t JOB_STOP = 3;       // no more jobs
+constexpr uint8_t JOB_PROGRESS = 4;   // index, frame
+constexpr uint8_t JOB_CHECKPOINT = 5; // index, frame, save state
+constexpr uint8_t JOB_REVOKED = 6;    // index, whether it was handed back
+constexpr uint8_t JOB_RESULT = 7;     // index, result text
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point t) {
+	return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+static void beginJobPacket(std::vector<uint8_t>* out, uint8_t type) {
+	out->assign(STREAM_HEADER, 0);
+	(*out)[0] = type;
+}
+
+static void putBytes(std::vector<uint8_t>* out, const void* data, size_t size) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	out->insert(out->end(), p, p + size);
+}
+
+static void put32(std::vector<uint8_t>* out, uint32_t v) {
+	for (int i = 0; i < 4; ++i) out->push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+static void put64(std::vector<uint8_t>* out, uint64_t v) {
+	for (int i = 0; i < 8; ++i) out->push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+static void putString(std::vector<uint8_t>* out, const std::string& s) {
+	put32(out, static_cast<uint32_t>(s.size()));
+	putBytes(out, s.data(), s.size());
+}
+
+static bool sendJobPacket(int fd, std::vector<uint8_t>* packet) {
+	const uint32_t size = static_cast<uint32_t>(packet->size() - STREAM_HEADER);
+	for (int i = 0; i < 4; ++i) (*packet)[1 + i] = static_cast<uint8_t>(size >> (8 * i));
+	return sendAll(fd, packet->data(), packet->size());
+}
+
+// Reads a packet's payload front to back, failing once it runs short.
+struct PacketReader {
+	const uint8_t* p;
+	const uint8_t* end;
+	bool ok;
+
+	explicit PacketReader(const std::vector<uint8_t>& packet) : p(packet.data() + STREAM_HEADER), end(packet.data() + packet.size()), ok(true) {}
+};
+
+static uint64_t getInt(PacketReader* r, int bytes) {
+	if (r->end - r->p < bytes) {
+		r->ok = false;
+		return 0;
+	}
+	uint64_t v = 0;
+	for (int i = 0; i < bytes; ++i) v |= static_cast<uint64_t>(*r->p++) << (8 * i);
+	return v;
+}
+
+static std::string getString(PacketReader* r) {
+	const uint32_t size = static_cast<uint32_t>(getInt(r, 4));
+	if (static_cast<size_t>(r->end - r->p) < size) {
+		r->ok = false;
+		return std::string();
+	}
+	std::string s(reinterpret_cast<const char*>(r->p), size);
+	r->p += size;
+	return s;
+}
+
+bool loadJobs(std::vector<JobSpec>* jobs, const char* path) {
+	FILE* fp = fopen(path, "r");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to open job list!" << std::endl;
+		return false;
+	}
+	char line[4096];
+	int number = 0;
+	bool ok = true;
+	while (fgets(line, sizeof(line), fp) != nullptr) {
+		++number;
+		char* comment = strchr(line, '#');
+		if (comment != nullptr) *comment = '\0';
+		char rom[2048];
+		char script[2048];
+		unsigned long long seed = 0;
+		const int fields = sscanf(line, "%2047s %2047s %llu", rom, script, &seed);
+		if (fields <= 0) continue;
+		if (fields != 3) {
+			std::cerr << "ERROR: " << path << ':' << number << ": expected '<ROM> <input script> <seed>'!" << std::endl;
+			ok = false;
+			break;
+		}
+		JobSpec job;
+		job.rom = rom;
+		job.script = script;
+		job.seed = seed;
+		jobs->push_back(job);
+	}
+	fclose(fp);
+	return ok;
+}
+
+// ---- worker ----
+
+struct InputScript {
+	std::vector<uint32_t> ends;   // frame each line ends on
+	std::vector<int16_t> buttons; // of each line, -1 for RANDOM
+};
+
+static bool loadInputScript(InputScript* script, const char* path) {
+	static const char* const names[8] = { "A", "B", "SELECT", "START", "UP", "DOWN", "LEFT", "RIGHT" };
+	FILE* fp = fopen(path, "r");
+	if (fp == nullptr) return false;
+	char line[1024];
+	uint32_t end = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), fp) != nullptr) {
+		char* comment = strchr(line, '#');
+		if (comment != nullptr) *comment = '\0';
+		unsigned frames = 0;
+		char spec[256];
+		const int fields = sscanf(line, "%u %255s", &frames, spec);
+		if (fields <= 0) continue;
+		if (fields != 2) {
+			ok = false;
+			break;
+		}
+
+		int16_t buttons = 0;
+		if (strcmp(spec, "RANDOM") == 0) {
+			buttons = -1;
+		}
+		else if (strcmp(spec, "-") != 0) {
+			for (char* name = strtok(spec, "+"); name != nullptr; name = strtok(nullptr, "+")) {
+				int bit = 0;
+				while (bit < 8 && strcmp(name, names[bit]) != 0) ++bit;
+				if (bit == 8) {
+					ok = false;
+					break;
+				}
+				buttons = static_cast<int16_t>(buttons | (1 << bit));
+			}
+		}
+		end += frames;
+		script->ends.push_back(end);
+		script->buttons.push_back(buttons);
+	}
+	fclose(fp);
+	return ok;
+}
+
+static uint32_t scriptLength(const InputScript* script) {
+	return script->ends.empty() ? 0 : script->ends.back();
+}
+
+// only depends on the seed and frame, so a resumed job presses the same
+static uint8_t scriptButtons(const InputScript* script, uint64_t seed, uint32_t frame) {
+	const size_t line = static_cast<size_t>(std::upper_bound(script->ends.begin(), script->ends.end(), frame) - script->ends.begin());
+	if (line == script->ends.size()) return 0;
+	if (script->buttons[line] >= 0) return static_cast<uint8_t>(script->buttons[line]);
+	const uint32_t block = frame / RANDOM_HOLD;
+	return static_cast<uint8_t>(hashBytes(HASH_SEED ^ seed, reinterpret_cast<const uint8_t*>(&block), sizeof(block)) >> 56);
+}
+
+struct WorkerJob {
+	uint32_t index;
+	uint64_t seed;
+	uint32_t frame; // script frames already run
+	std::string rom;
+	std::string script;
+	std::vector<uint8_t> state; // to resume from, if not empty
+};
+
+struct RunningJob {
+	WorkerJob job;
+	NES* nes;
+	InputScript script;
+	Watchdog watchdog;
+
+	RunningJob() : nes(nullptr) {}
+};
+
+static bool sendResult(int fd, uint32_t index, const std::string& text) {
+	std::vector<uint8_t> packet;
+	beginJobPacket(&packet, JOB_RESULT);
+	put32(&packet, index);
+	putBytes(&packet, text.data(), text.size());
+	return sendJobPacket(fd, &packet);
+}
+
+static bool startJob(RunningJob* run, const WorkerJob& job, std::string* error) {
+	run->job = job;
+	run->script = InputScript();
+	if (!loadInputScript(&run->script, job.script.c_str())) {
+		*error = "error=bad-input-script";
+		return false;
+	}
+	run->nes = new NES(job.rom.c_str(), "");
+	if (!run->nes->initialized) {
+		*error = "error=bad-rom";
+	}
+	else if (!job.state.empty() && !loadState(run->nes, job.state.data(), job.state.size())) {
+		*error = "error=bad-checkpoint";
+	}
+	else {
+		resetWatchdog(&run->watchdog, run->nes);
+		return true;
+	}
+	delete run->nes;
+	run->nes = nullptr;
+	return false;
+}
+
+static std::string jobResult(const RunningJob* run) {
+	static const char* const reasons[] = { "ok", "jam", "hang", "no-vblank" };
+	const NES* nes = run->nes;
+	const uint64_t ram = hashBytes(HASH_SEED, nes->RAM, 2048);
+	const uint64_t screen = hashBytes(HASH_SEED, reinterpret_cast<const uint8_t*>(nes->ppu->front), 256 * 240 * static_cast<int>(sizeof(uint32_t)));
+	char text[128];
+	snprintf(text, sizeof(text), "frames=%u ram=%016llx screen=%016llx watchdog=%s", run->job.frame,
+		static_cast<unsigned long long>(ram), static_cast<unsigned long long>(screen), reasons[run->watchdog.reason]);
+	return text;
+}
+
+bool runJobWorker(const char* address) {
+	const int fd = connectSocket(address);
+	if (fd < 0) return false;
+
+	std::deque<WorkerJob> held;
+	RunningJob run;
+	std::vector<uint8_t> packet;
+	std::vector<uint8_t> out;
+	Clock::time_point reported = Clock::now();
+	bool ok = true;
+	bool stop = false;
+	while (ok && !stop) {
+		// take in what the coordinator sent, waiting for it if there's nothing to run
+		pollfd p = { fd, POLLIN, 0 };
+		while (!stop && poll(&p, 1, run.nes == nullptr && held.empty() ? -1 : 0) > 0) {
+			if (!receivePacket(fd, &packet)) {
+				std::cerr << "ERROR: lost the job coordinator!" << std::endl;
+				ok = false;
+				break;
+			}
+			PacketReader r(packet);
+			if (packet[0] == JOB_START) {
+				WorkerJob job;
+				job.index = static_cast<uint32_t>(getInt(&r, 4));
+				job.seed = getInt(&r, 8);
+				job.frame = static_cast<uint32_t>(getInt(&r, 4));
+				job.rom = getString(&r);
+				job.script = getString(&r);
+				if (r.ok) {
+					job.state.assign(r.p, r.end);
+					held.push_back(job);
+				}
+			}
+			else if (packet[0] == JOB_REVOKE) {
+				const uint32_t index = static_cast<uint32_t>(getInt(&r, 4));
+				bool handed = false;
+				for (auto it = held.begin(); it != held.end(); ++it) {
+					if (it->index == index) {
+						held.erase(it);
+						handed = true;
+						break;
+					}
+				}
+				beginJobPacket(&out, JOB_REVOKED);
+				put32(&out, index);
+				out.push_back(handed);
+				ok = sendJobPacket(fd, &out);
+			}
+			else if (packet[0] == JOB_STOP) {
+				stop = true;
+			}
+		}
+		if (!ok || stop) break;
+
+		if (run.nes == nullptr) {
+			if (held.empty()) continue;
+			const WorkerJob job = held.front();
+			held.pop_front();
+			std::string error;
+			if (!startJob(&run, job, &error)) {
+				ok = sendResult(fd, job.index, error);
+				continue;
+			}
+			reported = Clock::now();
+		}
+
+		NES* nes = run.nes;
+		nes->controller1->buttons = scriptButtons(&run.script, run.job.seed, run.job.frame);
+		emulateFrame(nes);
+		++run.job.frame;
+		const bool stuck = watchdogFrame(&run.watchdog, nes);
+
+		if (stuck || run.job.frame >= scriptLength(&run.script)) {
+			ok = sendResult(fd, run.job.index, jobResult(&run));
+			delete run.nes;
+			run.nes = nullptr;
+			continue;
+		}
+		if (run.job.frame % CHECKPOINT_FRAMES == 0) {
+			beginJobPacket(&out, JOB_CHECKPOINT);
+			put32(&out, run.job.index);
+			put32(&out, run.job.frame);
+			saveState(nes, &run.job.state);
+			putBytes(&out, run.job.state.data(), run.job.state.size());
+			ok = sendJobPacket(fd, &out);
+			reported = Clock::now();
+		}
+		else if (secondsSince(reported) >= REPORT_SECONDS) {
+			beginJobPacket(&out, JOB_PROGRESS);
+			put32(&out, run.job.index);
+			put32(&out, run.job.frame);
+			ok = sendJobPacket(fd, &out);
+			reported = Clock::now();
+		}
+	}
+
+	delete run.nes;
+	close(fd);
+	return ok;
+}
+
+// ---- coordinator ----
+
+struct JobRecord {
+	uint32_t frame; // of the checkpoint
+	std::vector<uint8_t> state;
+	int attempts; // workers lost while running it
+	bool done;
+
+	JobRecord() : frame(0), attempts(0), done(false) {}
+};
+
+struct JobWorker {
+	int fd;
+	std::deque<uint32_t> jobs; // sent to it, the first one running
+	Clock::time_point heard;
+	bool revoking; // waiting to hear whether a held job was handed back
+
+	JobWorker() : fd(-1), revoking(false) {}
+};
+
+struct Coordinator {
+	const std::vector<JobSpec>* specs;
+	CoordinatorConfig config;
+	std::vector<JobRecord> records;
+	std::deque<uint32_t> queue;
+	size_t remaining;
+	FILE* out;
+	std::vector<JobWorker> workers;
+	std::vector<pid_t> children;
+};
+
+static std::string checkpointPath(const Coordinator* c, uint32_t index) {
+	return std::string(c->config.output) + '.' + std::to_string(index) + ".state";
+}
+
+static void saveCheckpoint(const Coordinator* c, uint32_t index) {
+	const JobRecord& record = c->records[index];
+	const std::string path = checkpointPath(c, index);
+	const std::string temp = path + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "wb");
+	if (fp == nullptr) return;
+	const bool ok = fwrite(&record.frame, sizeof(record.frame), 1, fp) == 1 &&
+		fwrite(record.state.data(), 1, record.state.size(), fp) == record.state.size();
+	if (fclose(fp) == 0 && ok) {
+		rename(temp.c_str(), path.c_str());
+	}
+	else {
+		std::cerr << "ERROR: failed to write checkpoint of job " << index << '!' << std::endl;
+		unlink(temp.c_str());
+	}
+}
+
+static void loadCheckpoint(Coordinator* c, uint32_t index) {
+	FILE* fp = fopen(checkpointPath(c, index).c_str(), "rb");
+	if (fp == nullptr) return;
+	JobRecord& record = c->records[index];
+	if (fread(&record.frame, sizeof(record.frame), 1, fp) == 1) {
+		uint8_t buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+			record.state.insert(record.state.end(), buf, buf + n);
+		}
+	}
+	if (record.state.empty()) record.frame = 0;
+	fclose(fp);
+}
+
+// Picks up where an earlier coordinator on the same output left off.
+static void resumeJobs(Coordinator* c) {
+	FILE* fp = fopen(c->config.output, "r");
+	if (fp != nullptr) {
+		char line[8192];
+		while (fgets(line, sizeof(line), fp) != nullptr) {
+			char* end;
+			const unsigned long index = strtoul(line, &end, 10);
+			if (end != line && index < c->records.size()) c->records[index].done = true;
+		}
+		fclose(fp);
+	}
+	for (uint32_t i = 0; i < c->records.size(); ++i) {
+		if (c->records[i].done) continue;
+		loadCheckpoint(c, i);
+		c->queue.push_back(i);
+	}
+	c->remaining = c->queue.size();
+}
+
+static void finishJob(Coordinator* c, uint32_t index, const std::string& text) {
+	JobRecord& record = c->records[index];
+	if (record.done) return;
+	const JobSpec& spec = (*c->specs)[index];
+	fprintf(c->out, "%u %s %s %llu %s\n", index, spec.rom.c_str(), spec.script.c_str(), static_cast<unsigned long long>(spec.seed), text.c_str());
+	fflush(c->out);
+	record.done = true;
+	record.state.clear();
+	unlink(checkpointPath(c, index).c_str());
+	--c->remaining;
+}
+
+static bool sendJob(Coordinator* c, JobWorker* w, uint32_t index) {
+	const JobSpec& spec = (*c->specs)[index];
+	const JobRecord& record = c->records[index];
+	std::vector<uint8_t> packet;
+	beginJobPacket(&packet, JOB_START);
+	put32(&packet, index);
+	put64(&packet, spec.seed);
+	put32(&packet, record.frame);
+	putString(&packet, spec.rom);
+	putString(&packet, spec.script);
+	putBytes(&packet, record.state.data(), record.state.size());
+	if (w->jobs.empty()) w->heard = Clock::now();
+	w->jobs.push_back(index);
+	return sendJobPacket(w->fd, &packet);
+}
+
+// Its jobs go back to the front of the queue. The one it was running
+// counts an attempt against that job.
+static void dropWorker(Coordinator* c, JobWorker* w) {
+	close(w->fd);
+	w->fd = -1;
+	for (size_t i = w->jobs.size(); i-- > 0;) {
+		const uint32_t index = w->jobs[i];
+		if (c->records[index].done) continue;
+		if (i == 0 && ++c->records[index].attempts >= c->config.max_attempts) {
+			std::cerr << "ERROR: giving up on job " << index << " after losing " << c->records[index].attempts << " workers to it!" << std::endl;
+			finishJob(c, index, "error=worker-lost");
+			continue;
+		}
+		c->queue.push_front(index);
+	}
+	w->jobs.clear();
+}
+
+static void removeJob(JobWorker* w, uint32_t index) {
+	for (auto it = w->jobs.begin(); it != w->jobs.end(); ++it) {
+		if (*it == index) {
+			w->jobs.erase(it);
+			return;
+		}
+	}
+}
+
+static void handleWorker(Coordinator* c, JobWorker* w, const std::vector<uint8_t>& packet) {
+	w->heard = Clock::now();
+	PacketReader r(packet);
+	const uint32_t index = static_cast<uint32_t>(getInt(&r, 4));
+	if (!r.ok || index >= c->records.size()) return;
+	JobRecord& record = c->records[index];
+	if (packet[0] == JOB_CHECKPOINT) {
+		const uint32_t frame = static_cast<uint32_t>(getInt(&r, 4));
+		if (!r.ok || record.done) return;
+		record.frame = frame;
+		record.state.assign(r.p, r.end);
+		saveCheckpoint(c, index);
+	}
+	else if (packet[0] == JOB_REVOKED) {
+		w->revoking = false;
+		if (getInt(&r, 1) != 0) {
+			removeJob(w, index);
+			c->queue.push_front(index);
+		}
+	}
+	else if (packet[0] == JOB_RESULT) {
+		removeJob(w, index);
+		finishJob(c, index, std::string(reinterpret_cast<const char*>(r.p), r.end - r.p));
+	}
+}
+
+static void spawnWorker(Coordinator* c, int server) {
+	const pid_t pid = fork();
+	if (pid == 0) {
+		close(server);
+		for (const JobWorker& w : c->workers) close(w.fd);
+		const bool ok = runJobWorker(c->config.address);
+		std::cout.flush();
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (pid < 0) {
+		std::cerr << "ERROR: failed to start a worker process!" << std::endl;
+		return;
+	}
+	c->children.push_back(pid);
+}
+
+bool runCoordinator(const std::vector<JobSpec>& jobs, const CoordinatorConfig& config) {
+	Coordinator* c = new Coordinator();
+	c->specs = &jobs;
+	c->config = config;
+	c->records.resize(jobs.size());
+	resumeJobs(c);
+	std::cout << c->remaining << " of " << jobs.size() << " jobs to run" << std::endl;
+
+	c->out = fopen(config.output, "a");
+	if (c->out == nullptr) {
+		std::cerr << "ERROR: failed to open job output file!" << std::endl;
+		delete c;
+		return false;
+	}
+	const int server = listenSocket(config.address, 64);
+	if (server < 0) {
+		fclose(c->out);
+		delete c;
+		return false;
+	}
+	for (int i = 0; i < config.local_workers; ++i) {
+		spawnWorker(c, server);
+	}
+
+	std::vector<pollfd> fds;
+	std::vector<uint8_t> packet;
+	while (c->remaining > 0) {
+		fds.clear();
+		fds.push_back({ server, POLLIN, 0 });
+		for (const JobWorker& w : c->workers) fds.push_back({ w.fd, POLLIN, 0 });
+		poll(fds.data(), fds.size(), 250);
+
+		if (fds[0].revents & POLLIN) {
+			JobWorker w;
+			w.fd = accept(server, nullptr, nullptr);
+			w.heard = Clock::now();
+			if (w.fd >= 0) c->workers.push_back(w);
+		}
+		for (size_t i = 1; i < fds.size(); ++i) {
+			JobWorker* w = &c->workers[i - 1];
+			if (fds[i].revents == 0) continue;
+			if (!receivePacket(w->fd, &packet)) {
+				if (!w->jobs.empty()) std::cerr << "ERROR: a worker disconnected with jobs!" << std::endl;
+				dropWorker(c, w);
+				continue;
+			}
+			handleWorker(c, w, packet);
+		}
+		for (JobWorker& w : c->workers) {
+			if (w.fd >= 0 && !w.jobs.empty() && secondsSince(w.heard) > config.timeout) {
+				std::cerr << "ERROR: a worker stopped responding!" << std::endl;
+				dropWorker(c, &w);
+			}
+		}
+
+		// local workers that died are replaced
+		int status;
+		pid_t pid;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			c->children.erase(std::remove(c->children.begin(), c->children.end(), pid), c->children.end());
+			if (c->remaining > 0) spawnWorker(c, server);
+		}
+
+		// hand out the queue, idle workers first, then let idle workers
+		// steal jobs others hold
+		for (int pass = 0; pass < 2; ++pass) {
+			for (JobWorker& w : c->workers) {
+				const int depth = pass == 0 ? 1 : config.depth;
+				while (w.fd >= 0 && !c->queue.empty() && static_cast<int>(w.jobs.size()) < depth) {
+					const uint32_t index = c->queue.front();
+					c->queue.pop_front();
+					if (c->records[index].done) continue;
+					if (!sendJob(c, &w, index)) dropWorker(c, &w);
+				}
+			}
+		}
+		for (JobWorker& thief : c->workers) {
+			if (thief.fd < 0 || !thief.jobs.empty() || !c->queue.empty()) continue;
+			for (JobWorker& w : c->workers) {
+				if (w.fd >= 0 && w.jobs.size() >= 2 && !w.revoking) {
+					beginJobPacket(&packet, JOB_REVOKE);
+					put32(&packet, w.jobs.back());
+					w.revoking = true;
+					if (!sendJobPacket(w.fd, &packet)) dropWorker(c, &w);
+					break;
+				}
+			}
+		}
+
+		c->workers.erase(std::remove_if(c->workers.begin(), c->workers.end(), [](const JobWorker& w) { return w.fd < 0; }), c->workers.end());
+	}
+
+	beginJobPacket(&packet, JOB_STOP);
+	for (JobWorker& w : c->workers) {
+		sendJobPacket(w.fd, &packet);
+		close(w.fd);
+	}
+	close(server);
+	if (strncmp(config.address, "unix:", 5) == 0) unlink(config.address + 5);
+	for (pid_t child : c->children) {
+		waitpid(child, nullptr, 0);
+	}
+	fclose(c->out);
+	delete c;
+	return true;
+}
+
+#else
+
+bool loadJobs(std::vector<JobSpec>* jobs, const char* path) {
+	static_cast<void>(jobs);
+	static_cast<void>(path);
+	std::cerr << "ERROR: job sweeps need BSD sockets!" << std::endl;
+	return false;
+}
+
+bool runCoordinator(const std::vector<JobSpec>& jobs, const CoordinatorConfig& config) {
+	static_cast<void>(jobs);
+	static_cast<void>(config);
+	std::cerr << "ERROR: job sweeps need BSD sockets!" << std::endl;
+	return false;
+}
+
+bool runJobWorker(const char* address) {
+	static_cast<void>(address);
+	std::cerr << "ERROR: job sweeps need BSD sockets!" << std::endl;
+	return false;
+}
+
+#endif
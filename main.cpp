@@ -178,8 +178,28 @@ void printState(NES* nes) {
 }
 
 int main(int argc, char* argv[]) {
-	if (argc != 2) {
-		std::cout << "Usage: KNES <rom file>" << std::endl;
+	// optional recordings, written on quit
+	const char* ppu_trace_path = nullptr;
+	const char* vgm_path = nullptr;
+	// optional thin client to stream to
+	const char* stream_address = nullptr;
+	bool usage = argc < 2;
+	for (int i = 2; i < argc; ++i) {
+		if (i + 1 < argc && strcmp(argv[i], "--ppu-trace") == 0) {
+			ppu_trace_path = argv[++i];
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--vgm") == 0) {
+			vgm_path = argv[++i];
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--stream") == 0) {
+			stream_address = argv[++i];
+		}
+		else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cout << "Usage: KNES <rom file> [--ppu-trace <file>] [--vgm <file>] [--stream <address>]" << std::endl;
 		return EXIT_FAILURE;
 	}
 
@@ -191,6 +211,22 @@ int main(int argc, char* argv[]) {
 	NES* nes = new NES(argv[1], SRAM_path);
 	if (!nes->initialized) return EXIT_FAILURE;
 
+	if (ppu_trace_path != nullptr) {
+		std::cout << "Recording PPU trace..." << std::endl;
+		nes->ppu_trace = new PPUTrace(nes->cartridge->hash);
+	}
+	if (vgm_path != nullptr) {
+		std::cout << "Recording APU log..." << std::endl;
+		nes->apu_log = new APULog();
+	}
+
+	FrameStream* frame_stream = nullptr;
+	if (stream_address != nullptr) {
+		std::cout << "Waiting for stream client on " << stream_address << "..." << std::endl;
+		frame_stream = new FrameStream();
+		if (!openStream(frame_stream, stream_address)) return EXIT_FAILURE;
+	}
+
 	std::cout << "Initializing PortAudio..." << std::endl;
 	PaError err = Pa_Initialize();
 	if (err != paNoError) {
@@ -213,14 +249,15 @@ int main(int argc, char* argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	outputParameters.channelCount = 2;
+	outputParameters.channelCount = 1;
 	outputParameters.sampleFormat = paFloat32;
 	outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
 	outputParameters.hostApiSpecificStreamInfo = nullptr;
 
 	std::cout << "Opening audio stream..." << std::endl;
+	PaStream* stream;
 	err = Pa_OpenStream(
-		&nes->apu->stream,
+		&stream,
 		nullptr,
 		&outputParameters,
 		44100,
@@ -297,16 +334,19 @@ int main(int argc, char* argv[]) {
 
 	// decrease pops on linux
 #ifdef __linux__
-	PaAlsa_EnableRealtimeScheduling(nes->apu->stream, 1);
+	PaAlsa_EnableRealtimeScheduling(stream, 1);
 #endif
 
 	std::cout << "Starting audio stream..." << std::endl;
-	Pa_StartStream(nes->apu->stream);
+	Pa_StartStream(stream);
 	if (err != paNoError) {
 		notifyPaError(err);
 		return EXIT_FAILURE;
 	}
 
+	// steps go up to a second, four in fast-forward
+	reserveAudio(nes, 4.0);
+
 	double prevtime = 0.0;
 	while (!glfwWindowShouldClose(window)) {
 		const double time = glfwGetTime();
@@ -323,6 +363,13 @@ int main(int argc, char* argv[]) {
 		// step the NES state forward by 'dt' seconds, or more if in fast-forward
 		emulate(nes, getKey(window, GLFW_KEY_GRAVE_ACCENT) ? 4.0 * dt : dt);
 
+		// queue the audio for that stretch, dropping whatever doesn't fit
+		const long available = Pa_GetStreamWriteAvailable(stream);
+		const long count = nes->apu->sample_count < available ? nes->apu->sample_count : available;
+		if (count > 0) Pa_WriteStream(stream, nes->apu->samples, static_cast<unsigned long>(count));
+
+		if (frame_stream != nullptr) streamOutput(frame_stream, nes);
+
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 240, 0, GL_RGBA, GL_UNSIGNED_BYTE, nes->ppu->front);
 		glfwGetFramebufferSize(window, &w, &h);
 		if (w != old_w || h != old_h) {
@@ -358,7 +405,7 @@ int main(int argc, char* argv[]) {
 	if (nes->cartridge->battery_present) {
 		std::cout << std::endl << "Writing SRAM..." << std::endl;
 		FILE* fp = fopen(SRAM_path, "wb");
-		if (fp == nullptr || (fwrite(nes->cartridge->SRAM, 8192, 1, fp) != 1)) {
+		if (fp == nullptr || (fwrite(nes->cartridge->SRAM, static_cast<size_t>(nes->cartridge->sram_size), 1, fp) != 1)) {
 			std::cout << "WARN: failed to save SRAM file!" << std::endl;
 		}
 		else {
@@ -366,11 +413,22 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
+	if (nes->ppu_trace != nullptr) {
+		std::cout << std::endl << "Writing PPU trace..." << std::endl;
+		nes->ppu_trace->end_tick = nes->ppu->ticks;
+		savePPUTrace(nes->ppu_trace, ppu_trace_path);
+	}
+	if (nes->apu_log != nullptr) {
+		std::cout << std::endl << "Writing APU log..." << std::endl;
+		nes->apu_log->end_cycle = nes->apu->cycle;
+		saveAPULog(nes->apu_log, vgm_path);
+	}
+
 	std::cout << std::endl << "Stopping audio stream..." << std::endl;
-	Pa_StopStream(nes->apu->stream);
+	Pa_StopStream(stream);
 
 	std::cout << "Closing audio stream..." << std::endl;
-	Pa_CloseStream(nes->apu->stream);
+	Pa_CloseStream(stream);
 
 	std::cout << "Terminating GLFW..." << std::endl;
 	glfwTerminate();
@@ -0,0 +1,248 @@
+/*******************************************************************
+*   memo.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// An on-disk memo of deterministic runs. Emulation is a pure function of
+// the ROM, the state it starts from and the inputs of every frame, so a
+// run seen before can be answered from its end state, frame hashes and
+// metrics without emulating it again.
+//
+// Each entry is a file named after its key. The store keeps them in least
+// recently used order, touching a file whenever it is hit so the order
+// survives into the next process, and deletes from the cold end once the
+// entries take more than the budget.
+//
+// The start of the key is the hash of the save state the run starts from.
+// saveState() writes the same bytes for the same console state, whichever
+// console or process saved it: pointers are saved zeroed, and so are the
+// vtable pointers of the mapper and of any expansion sound chip on it,
+// which differ between processes. So equal runs hit from anywhere, on
+// every board ('make check' holds saveState() to this).
+
+#include "NES.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+constexpr uint32_t MEMO_MAGIC = 0x4F4D4E4B; // "KNMO"
+constexpr uint32_t MEMO_VERSION = 1;
+
+static uint64_t keyHash(const MemoKey& key) {
+	return hashBytes(HASH_SEED, reinterpret_cast<const uint8_t*>(&key), sizeof(key));
+}
+
+static std::string entryPath(const MemoStore* store, const MemoKey& key) {
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx%016llx%016llx.memo", static_cast<unsigned long long>(key.rom),
+		static_cast<unsigned long long>(key.start), static_cast<unsigned long long>(key.inputs));
+	return store->dir + name;
+}
+
+static bool parseEntryName(const char* name, MemoKey* key) {
+	unsigned long long parts[3];
+	char hex[17];
+	if (strlen(name) != 48 + 5 || strcmp(name + 48, ".memo") != 0) return false;
+	for (int i = 0; i < 3; ++i) {
+		memcpy(hex, name + 16 * i, 16);
+		hex[16] = '\0';
+		char* end;
+		parts[i] = strtoull(hex, &end, 16);
+		if (end != hex + 16) return false;
+	}
+	key->rom = parts[0];
+	key->start = parts[1];
+	key->inputs = parts[2];
+	return true;
+}
+
+// Takes 'key' out of the store's accounting, leaving the file alone.
+static void forgetEntry(MemoStore* store, const MemoKey& key) {
+	auto it = store->index.find(keyHash(key));
+	if (it == store->index.end()) return;
+	store->used -= it->second->size;
+	store->entries.erase(it->second);
+	store->index.erase(it);
+}
+
+static void addEntry(MemoStore* store, const MemoKey& key, uint64_t size) {
+	forgetEntry(store, key);
+	store->entries.push_front({ key, size });
+	store->index[keyHash(key)] = store->entries.begin();
+	store->used += size;
+}
+
+// Deletes the coldest entries until the store fits its budget.
+static void evictMemo(MemoStore* store) {
+	while (store->used > store->budget && !store->entries.empty()) {
+		const MemoEntry entry = store->entries.back();
+		remove(entryPath(store, entry.key).c_str());
+		forgetEntry(store, entry.key);
+	}
+}
+
+bool openMemo(MemoStore* store, const char* dir, uint64_t budget) {
+	store->dir = dir;
+	store->budget = budget;
+	store->used = 0;
+	store->entries.clear();
+	store->index.clear();
+
+	DIR* d = opendir(dir);
+	if (d == nullptr) {
+		std::cerr << "ERROR: failed to open memo directory!" << std::endl;
+		return false;
+	}
+	struct Found {
+		MemoKey key;
+		uint64_t size;
+		time_t used;
+	};
+	std::vector<Found> found;
+	for (dirent* e = readdir(d); e != nullptr; e = readdir(d)) {
+		MemoKey key;
+		struct stat st;
+		if (!parseEntryName(e->d_name, &key) || stat(entryPath(store, key).c_str(), &st) != 0) continue;
+		found.push_back({ key, static_cast<uint64_t>(st.st_size), st.st_mtime });
+	}
+	closedir(d);
+
+	std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.used < b.used; });
+	for (const Found& f : found) {
+		addEntry(store, f.key, f.size);
+	}
+	evictMemo(store);
+	return true;
+}
+
+MemoKey memoKey(const NES* nes, const std::vector<uint8_t>& start, const uint8_t* inputs, int frames, const RuleProgram* rules) {
+	MemoKey key;
+	key.rom = nes->cartridge->hash;
+	key.start = hashBytes(HASH_SEED, start.data(), static_cast<int>(start.size()));
+	key.inputs = hashBytes(HASH_SEED, inputs, 2 * frames);
+	if (rules != nullptr) {
+		key.inputs = hashBytes(key.inputs, reinterpret_cast<const uint8_t*>(rules->code.data()), static_cast<int>(rules->code.size() * sizeof(int32_t)));
+	}
+	return key;
+}
+
+template <typename T>
+static bool readVector(FILE* fp, std::vector<T>* v) {
+	uint32_t count;
+	if (fread(&count, sizeof(count), 1, fp) != 1) return false;
+	v->resize(count);
+	return count == 0 || fread(v->data(), sizeof(T), count, fp) == count;
+}
+
+template <typename T>
+static bool writeVector(FILE* fp, const std::vector<T>& v) {
+	const uint32_t count = static_cast<uint32_t>(v.size());
+	return fwrite(&count, sizeof(count), 1, fp) == 1 && (count == 0 || fwrite(v.data(), sizeof(T), count, fp) == count);
+}
+
+bool lookupMemo(MemoStore* store, const MemoKey& key, MemoResult* result) {
+	const std::string path = entryPath(store, key);
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (fp == nullptr) {
+		// another process may have evicted it
+		forgetEntry(store, key);
+		++store->misses;
+		return false;
+	}
+	uint32_t header[2];
+	MemoKey stored;
+	const bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == MEMO_MAGIC && header[1] == MEMO_VERSION &&
+		fread(&stored, sizeof(stored), 1, fp) == 1 && memcmp(&stored, &key, sizeof(key)) == 0 &&
+		readVector(fp, &result->state) && readVector(fp, &result->frame_hashes) && readVector(fp, &result->metrics);
+	fclose(fp);
+	if (!ok) {
+		std::cerr << "ERROR: dropping damaged memo entry '" << path << "'!" << std::endl;
+		remove(path.c_str());
+		forgetEntry(store, key);
+		++store->misses;
+		return false;
+	}
+
+	utime(path.c_str(), nullptr);
+	auto it = store->index.find(keyHash(key));
+	if (it != store->index.end()) {
+		store->entries.splice(store->entries.begin(), store->entries, it->second);
+	}
+	else {
+		struct stat st;
+		addEntry(store, key, stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0);
+	}
+	++store->hits;
+	return true;
+}
+
+void storeMemo(MemoStore* store, const MemoKey& key, const MemoResult& result) {
+	const std::string path = entryPath(store, key);
+	const std::string temp = path + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "wb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to write memo entry!" << std::endl;
+		return;
+	}
+	const uint32_t header[2] = { MEMO_MAGIC, MEMO_VERSION };
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(&key, sizeof(key), 1, fp) == 1 &&
+		writeVector(fp, result.state) && writeVector(fp, result.frame_hashes) && writeVector(fp, result.metrics);
+	const uint64_t size = static_cast<uint64_t>(ftell(fp));
+	ok = fclose(fp) == 0 && ok;
+	// one entry over the whole budget would only evict everything else
+	if (!ok || size > store->budget || rename(temp.c_str(), path.c_str()) != 0) {
+		if (!ok) std::cerr << "ERROR: failed to write memo entry!" << std::endl;
+		remove(temp.c_str());
+		return;
+	}
+	addEntry(store, key, size);
+	evictMemo(store);
+}
+
+bool runMemoized(MemoStore* store, NES* nes, const std::vector<uint8_t>& start, const uint8_t* inputs, int frames,
+	const RuleProgram* rules, MemoResult* result) {
+	const MemoKey key = memoKey(nes, start, inputs, frames, rules);
+	if (lookupMemo(store, key, result) && loadState(nes, result->state.data(), result->state.size())) {
+		return true;
+	}
+	if (!loadState(nes, start.data(), start.size())) {
+		result->state.clear();
+		result->frame_hashes.clear();
+		result->metrics.clear();
+		return false;
+	}
+
+	result->frame_hashes.clear();
+	result->metrics.clear();
+	RuleState rule_state;
+	if (rules != nullptr) resetRules(rules, &rule_state, nes);
+	double total = 0.0;
+	int frame = 0;
+	bool done = false;
+	while (frame < frames && !done) {
+		nes->controller1->buttons = inputs[2 * frame];
+		nes->controller2->buttons = inputs[2 * frame + 1];
+		emulateFrame(nes);
+		++frame;
+		result->frame_hashes.push_back(hashFrame(nes->ppu->front));
+		if (rules != nullptr) {
+			float reward = 0.0f;
+			evaluateRules(rules, &rule_state, nes, &reward, &done);
+			total += reward;
+		}
+	}
+	if (rules != nullptr) {
+		result->metrics.push_back(total);
+		result->metrics.push_back(frame);
+	}
+	saveState(nes, &result->state);
+	storeMemo(store, key, *result);
+	return false;
+}
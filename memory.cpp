@@ -105,6 +105,7 @@ uint8_t readPPURegister(NES* nes, uint16_t address) {
 		status |= ppu->flag_sprite_zero_hit << 6;
 		if (ppu->nmi_occurred) {
 			status |= 1 << 7;
+			++nes->vblanks_seen;
 		}
 		ppu->nmi_occurred = false;
 		PPUnmiShift(ppu);
@@ -146,7 +147,12 @@ uint8_t readByte(NES* nes, uint16_t address) {
 		return nes->RAM[address & 2047];
 	}
 	else if (address < 0x4000) {
-		return readPPURegister(nes, 0x2000 + (address & 7));
+		address = 0x2000 + (address & 7);
+		// a PPUSTATUS read only matters to rendering if it resets the write toggle
+		if (nes->ppu_trace != nullptr && (address == 0x2007 || (address == 0x2002 && nes->ppu->w != 0))) {
+			nes->ppu_trace->record(nes->ppu->ticks, TraceRead, address, 0);
+		}
+		return readPPURegister(nes, address);
 	}
 	else if (address == 0x4014) {
 		return readPPURegister(nes, address);
@@ -178,10 +184,10 @@ uint8_t readByte(NES* nes, uint16_t address) {
 	else if (address == 0x4017) {
 		return readController(nes->controller2);
 	}
-	else if (address < 0x6000) {
+	else if (address < 0x4020) {
 		// I/O registers
 	}
-	else if (address >= 0x6000) {
+	else if (address >= 0x4020) {
 		return nes->mapper->read(nes->cartridge, address);
 	}
 	else {
@@ -332,28 +338,43 @@ void writeRegisterAPU(APU* apu, uint16_t address, uint8_t value) {
 	}
 }
 
-int Mapper1::prgBankOffset(Cartridge* c, int index) {
-	if (index >= 0x80) {
-		index -= 0x100;
+// smallest all-ones mask covering 'banks' bank numbers
+int bankMask(int banks) {
+	int mask = 0;
+	while (mask + 1 < banks) {
+		mask = (mask << 1) | 1;
 	}
-	index %= c->prg_size >> 14;
-	int offset = index << 14;
-	if (offset < 0) {
-		offset += c->prg_size;
-	}
-	return offset;
+	return mask;
+}
+
+void PagedMapper::initPages(Cartridge* cartridge) {
+	prg_banks = cartridge->prg_size >> 13;
+	chr_banks = cartridge->chr_size >> 10;
+	prg_mask = bankMask(prg_banks);
+	chr_mask = bankMask(chr_banks);
+	mapPRG16(0, 0);
+	mapPRG16(1, -1);
+	mapCHR8(0);
 }
 
-int Mapper1::chrBankOffset(Cartridge* cartridge, int index) {
-	if (index >= 0x80) {
-		index -= 0x100;
+// Bank counts are almost always powers of two, where the mask alone
+// does the wrapping. Odd sizes fold anything past the end back once, and
+// negative banks are counted from the end before masking so -1 is still
+// the last bank there.
+int PagedMapper::prgBank(int bank) {
+	if (bank < 0) {
+		bank += prg_banks;
 	}
-	index %= cartridge->chr_size >> 12;
-	int offset = index << 12;
-	if (offset < 0) {
-		offset += cartridge->chr_size;
+	bank &= prg_mask;
+	return bank < prg_banks ? bank : bank - prg_banks;
+}
+
+int PagedMapper::chrBank(int bank) {
+	if (bank < 0) {
+		bank += chr_banks;
 	}
-	return offset;
+	bank &= chr_mask;
+	return bank < chr_banks ? bank : bank - chr_banks;
 }
 
 // PRG ROM bank mode  0-1: switch 32k at $8000,     ignore low bit of bank number
@@ -362,31 +383,31 @@ int Mapper1::chrBankOffset(Cartridge* cartridge, int index) {
 //
 // CHR ROM bank mode  0  : switch 8k
 //                    1  : switch two 4k banks
-void Mapper1::updateOffsets(Cartridge* cartridge) {
+void Mapper1::updateOffsets() {
 	switch (prg_mode) {
 	case 0:
 	case 1:
-		prg_offsets[0] = prgBankOffset(cartridge, static_cast<int>(prg_bank & 0xFE));
-		prg_offsets[1] = prgBankOffset(cartridge, static_cast<int>(prg_bank | 0x01));
+		mapPRG16(0, static_cast<int>(prg_bank & 0xFE));
+		mapPRG16(1, static_cast<int>(prg_bank | 0x01));
 		break;
 	case 2:
-		prg_offsets[0] = 0;
-		prg_offsets[1] = prgBankOffset(cartridge, static_cast<int>(prg_bank));
+		mapPRG16(0, 0);
+		mapPRG16(1, static_cast<int>(prg_bank));
 		break;
 	case 3:
-		prg_offsets[0] = prgBankOffset(cartridge, static_cast<int>(prg_bank));
-		prg_offsets[1] = prgBankOffset(cartridge, -1);
+		mapPRG16(0, static_cast<int>(prg_bank));
+		mapPRG16(1, -1);
 		break;
 	}
 
 	switch (chr_mode) {
 	case 0:
-		chr_offsets[0] = chrBankOffset(cartridge, static_cast<int>(chr_bank0 & 0xFE));
-		chr_offsets[1] = chrBankOffset(cartridge, static_cast<int>(chr_bank0 | 0x01));
+		mapCHR4(0, static_cast<int>(chr_bank0 & 0xFE));
+		mapCHR4(1, static_cast<int>(chr_bank0 | 0x01));
 		break;
 	case 1:
-		chr_offsets[0] = chrBankOffset(cartridge, static_cast<int>(chr_bank0));
-		chr_offsets[1] = chrBankOffset(cartridge, static_cast<int>(chr_bank1));
+		mapCHR4(0, static_cast<int>(chr_bank0));
+		mapCHR4(1, static_cast<int>(chr_bank1));
 		break;
 	}
 }
@@ -413,133 +434,997 @@ void Mapper1::writeCtrl(Cartridge* cartridge, uint8_t value) {
 	}
 }
 
-int Mapper4::prgBankOffset(Cartridge* c, int index) {
-	if (index >= 0x80) {
-		index -= 0x100;
+void Mapper4::updateOffsets() {
+	switch (prg_mode) {
+	case 0:
+		mapPRG8(0, static_cast<int>(regs[6]));
+		mapPRG8(1, static_cast<int>(regs[7]));
+		mapPRG8(2, -2);
+		mapPRG8(3, -1);
+		break;
+	case 1:
+		mapPRG8(0, -2);
+		mapPRG8(1, static_cast<int>(regs[7]));
+		mapPRG8(2, static_cast<int>(regs[6]));
+		mapPRG8(3, -1);
+		break;
+	}
+
+	switch (chr_mode) {
+	case 0:
+		mapCHR1(0, static_cast<int>(regs[0] & 0xFE));
+		mapCHR1(1, static_cast<int>(regs[0] | 0x01));
+		mapCHR1(2, static_cast<int>(regs[1] & 0xFE));
+		mapCHR1(3, static_cast<int>(regs[1] | 0x01));
+		mapCHR1(4, static_cast<int>(regs[2]));
+		mapCHR1(5, static_cast<int>(regs[3]));
+		mapCHR1(6, static_cast<int>(regs[4]));
+		mapCHR1(7, static_cast<int>(regs[5]));
+		break;
+	case 1:
+		mapCHR1(0, static_cast<int>(regs[2]));
+		mapCHR1(1, static_cast<int>(regs[3]));
+		mapCHR1(2, static_cast<int>(regs[4]));
+		mapCHR1(3, static_cast<int>(regs[5]));
+		mapCHR1(4, static_cast<int>(regs[0] & 0xFE));
+		mapCHR1(5, static_cast<int>(regs[0] | 0x01));
+		mapCHR1(6, static_cast<int>(regs[1] & 0xFE));
+		mapCHR1(7, static_cast<int>(regs[1] | 0x01));
+		break;
+	}
+}
+
+// Number of scanline counter clocks (dot 280 of lines 0-239 and the pre-render
+// line) the PPU has passed since power on, as if rendering had always been on.
+static uint64_t mmc3Clocks(PPU* ppu) {
+	uint64_t line;
+	if (ppu->scanline < 240) {
+		line = static_cast<uint64_t>(ppu->scanline) + (ppu->cycle >= 280 ? 1 : 0);
+	}
+	else {
+		line = ppu->scanline < 261 ? 240 : 240 + (ppu->cycle >= 280 ? 1 : 0);
+	}
+	return ppu->frame * 241 + line;
+}
+
+// Applies the counter clocks since the last sync. Clocking a zero counter
+// reloads it and any other clock decrements it, so once it first reaches zero
+// it simply cycles through reload+1 states.
+void Mapper4::sync(NES* nes) {
+	const uint64_t now = mmc3Clocks(nes->ppu);
+	if (rendering) {
+		uint64_t n = now - clock_base;
+		if (n <= counter) {
+			counter = static_cast<uint8_t>(counter - n);
+		}
+		else {
+			n -= counter;
+			counter = (reload == 0 || n % (reload + 1) == 0) ? 0 : static_cast<uint8_t>(reload - (n - 1) % (reload + 1));
+		}
+	}
+	clock_base = now;
+}
+
+void Mapper4::schedule(NES* nes) {
+	PPU* ppu = nes->ppu;
+	sync(nes);
+	rendering = ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0;
+	nes->mapper_event = NO_EVENT;
+	if (rendering && IRQ_enable && (counter != 0 || reload != 0)) {
+		// the IRQ fires on the clock that decrements the counter to zero
+		const uint64_t k = clock_base + (counter != 0 ? counter : 1 + static_cast<uint64_t>(reload)) - 1;
+		const int line = static_cast<int>(k % 241);
+		nes->mapper_event = ppuTickAtFrame(ppu, k / 241, line < 240 ? line : 261, 280);
+	}
+}
+
+void Mapper4::runEvent(NES* nes) {
+	sync(nes);
+	if (IRQ_enable) {
+		triggerIRQ(nes->cpu);
+	}
+	schedule(nes);
+}
+
+void Mapper9::updateOffsets() {
+	if (mmc4) {
+		mapPRG16(0, static_cast<int>(prg_bank));
+		mapPRG16(1, -1);
+	}
+	else {
+		mapPRG8(0, static_cast<int>(prg_bank));
+		mapPRG8(1, -3);
+		mapPRG8(2, -2);
+		mapPRG8(3, -1);
+	}
+	mapCHR4(0, static_cast<int>(chr_regs[latch[0]]));
+	mapCHR4(1, static_cast<int>(chr_regs[2 + latch[1]]));
+}
+
+// MMC2 only watches $0FD8/$0FE8 in the low window, everything else
+// triggers on the whole row range $xFD8-$xFDF / $xFE8-$xFEF.
+// The fetch that trips the latch still comes from the old bank.
+void Mapper9::updateLatch(uint16_t address) {
+	const int window = (address >> 12) & 1;
+	const uint16_t tile = address & 0x0FF8;
+	if (!mmc4 && window == 0 && (address & 7) != 0) {
+		return;
+	}
+	if (tile == 0x0FD8 || tile == 0x0FE8) {
+		const uint8_t value = tile == 0x0FE8 ? 1 : 0;
+		if (latch[window] != value) {
+			latch[window] = value;
+			mapCHR4(window, static_cast<int>(chr_regs[(window << 1) + value]));
+		}
+	}
+}
+
+uint8_t Mapper9::fetchBackground(NES* nes, uint16_t address) {
+	const uint8_t value = read(nes->cartridge, address);
+	updateLatch(address);
+	return value;
+}
+
+uint8_t Mapper9::fetchSprite(NES* nes, uint16_t address) {
+	const uint8_t value = read(nes->cartridge, address);
+	updateLatch(address);
+	return value;
+}
+
+// VRC6, VRC7 and FME-7 mirroring control values
+constexpr uint8_t vrc_mirror_tbl[4] = { MirrorVertical, MirrorHorizontal, MirrorSingle0, MirrorSingle1 };
+
+void VRCIRQ::sync(NES* nes) {
+	if (control & 2) {
+		const uint64_t clocks = (nes->ppu->ticks - base) / period();
+		counter = static_cast<uint8_t>(counter + clocks);
+		base += clocks * period();
+	}
+}
+
+void VRCIRQ::writeControl(NES* nes, uint8_t value) {
+	control = value & 7;
+	if (control & 2) {
+		counter = latch;
+		base = nes->ppu->ticks;
+	}
+	schedule(nes);
+}
+
+void VRCIRQ::acknowledge(NES* nes) {
+	const bool was_enabled = (control & 2) == 2;
+	sync(nes);
+	control = static_cast<uint8_t>((control & 5) | ((control & 1) << 1));
+	if (!was_enabled) {
+		base = nes->ppu->ticks;
+	}
+	schedule(nes);
+}
+
+// the counter overflows after 256 - counter clocks
+void VRCIRQ::schedule(NES* nes) {
+	nes->mapper_event = (control & 2) ? base + (0x100 - static_cast<uint64_t>(counter)) * period() : NO_EVENT;
+}
+
+void VRCIRQ::runEvent(NES* nes) {
+	base = nes->mapper_event;
+	counter = latch;
+	triggerIRQ(nes->cpu);
+	schedule(nes);
+}
+
+void Mapper24::write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+	if (address < 0x8000) {
+		PagedMapper::write(cartridge, address, value);
+		return;
+	}
+	if (cartridge->mapper == 26) {
+		address = static_cast<uint16_t>((address & 0xFFFC) | ((address & 1) << 1) | ((address >> 1) & 1));
+	}
+	const uint16_t reg = address & 0xF003;
+	const uint16_t base = address & 0xF000;
+	if (base == 0x8000) {
+		mapPRG16(0, value & 0x0F);
+	}
+	else if (reg == 0xB003) {
+		cartridge->mirror = vrc_mirror_tbl[(value >> 2) & 3];
+	}
+	else if (base <= 0xB000) {
+		mixAudio(console);
+		vrc6.write(reg, value);
+	}
+	else if (base == 0xC000) {
+		mapPRG8(2, value & 0x1F);
+	}
+	else if (base == 0xD000 || base == 0xE000) {
+		mapCHR1(((base - 0xD000) >> 10) | (reg & 3), value);
+	}
+	else if (reg == 0xF000) {
+		irq.latch = value;
+	}
+	else if (reg == 0xF001) {
+		irq.writeControl(console, value);
+	}
+	else if (reg == 0xF002) {
+		irq.acknowledge(console);
+	}
+}
+
+// VRC7a decodes its second register at each address on A4, VRC7b on A3
+void Mapper85::write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+	if (address < 0x8000) {
+		PagedMapper::write(cartridge, address, value);
+		return;
+	}
+	const bool odd = (address & 0x18) != 0;
+	const uint16_t base = address & 0xF000;
+	if ((address & 0xF030) == 0x9010) {
+		vrc7.address = value;
+	}
+	else if ((address & 0xF030) == 0x9030) {
+		mixAudio(console);
+		vrc7.write(value);
+	}
+	else if (base == 0x8000) {
+		mapPRG8(odd ? 1 : 0, value & 0x3F);
+	}
+	else if (base == 0x9000) {
+		if (!odd) {
+			mapPRG8(2, value & 0x3F);
+		}
+	}
+	else if (base <= 0xD000) {
+		mapCHR1(((base - 0xA000) >> 11) | (odd ? 1 : 0), value);
+	}
+	else if (base == 0xE000) {
+		if (odd) {
+			irq.latch = value;
+		}
+		else {
+			cartridge->mirror = vrc_mirror_tbl[value & 3];
+			mixAudio(console);
+			vrc7.silenced = (value & 0x40) == 0x40;
+		}
+	}
+	else {
+		if (odd) {
+			irq.acknowledge(console);
+		}
+		else {
+			irq.writeControl(console, value);
+		}
+	}
+}
+
+void Mapper19::syncCounter(NES* nes) {
+	if (irq_enable && irq_counter < 0x7FFF) {
+		const uint64_t cycles = (nes->ppu->ticks - irq_base) / 3;
+		irq_counter = static_cast<uint16_t>(cycles >= static_cast<uint64_t>(0x7FFF - irq_counter) ? 0x7FFF : irq_counter + cycles);
+		irq_base += cycles * 3;
+	}
+}
+
+uint8_t Mapper19::read(Cartridge* cartridge, uint16_t address) {
+	if (address >= 0x4800 && address < 0x5000) {
+		mixAudio(console);
+		return n163.read();
+	}
+	else if (address >= 0x5000 && address < 0x5800) {
+		syncCounter(console);
+		return irq_counter & 0xFF;
+	}
+	else if (address >= 0x5800 && address < 0x6000) {
+		syncCounter(console);
+		return static_cast<uint8_t>((irq_counter >> 8) | (irq_enable ? 0x80 : 0));
+	}
+	return PagedMapper::read(cartridge, address);
+}
+
+void Mapper19::write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+	if (address >= 0x4800 && address < 0x5000) {
+		mixAudio(console);
+		n163.writeData(value);
+	}
+	else if (address >= 0x5000 && address < 0x6000) {
+		syncCounter(console);
+		if (address < 0x5800) {
+			irq_counter = (irq_counter & 0x7F00) | value;
+		}
+		else {
+			irq_counter = static_cast<uint16_t>((irq_counter & 0xFF) | ((value & 0x7F) << 8));
+			irq_enable = (value & 0x80) == 0x80;
+		}
+		irq_base = console->ppu->ticks;
+		schedule(console);
+	}
+	else if (address < 0x8000) {
+		PagedMapper::write(cartridge, address, value);
+	}
+	else if (address < 0xC000) {
+		mapCHR1((address - 0x8000) >> 11, value);
+	}
+	else if (address < 0xE000) {
+		nt_regs[(address - 0xC000) >> 11] = value;
+	}
+	else if (address < 0xE800) {
+		mapPRG8(0, value & 0x3F);
+		mixAudio(console);
+		n163.disabled = (value & 0x40) == 0x40;
+	}
+	else if (address < 0xF000) {
+		mapPRG8(1, value & 0x3F);
+	}
+	else if (address < 0xF800) {
+		mapPRG8(2, value & 0x3F);
+	}
+	else {
+		n163.writeAddress(value);
+	}
+}
+
+// $E0-$FF select a CIRAM page, anything else a 1k page of CHR-ROM
+uint8_t Mapper19::readNametable(NES* nes, uint16_t address) {
+	const uint8_t reg = nt_regs[(address >> 10) & 3];
+	const int offset = address & 1023;
+	if (reg >= 0xE0) {
+		return nes->ppu->name_tbl[((reg & 1) << 10) + offset];
+	}
+	return nes->cartridge->CHR[(chrBank(reg) << 10) + offset];
+}
+
+void Mapper19::writeNametable(NES* nes, uint16_t address, uint8_t value) {
+	const uint8_t reg = nt_regs[(address >> 10) & 3];
+	if (reg >= 0xE0) {
+		nes->ppu->name_tbl[((reg & 1) << 10) + (address & 1023)] = value;
+	}
+}
+
+void Mapper19::schedule(NES* nes) {
+	nes->mapper_event = (irq_enable && irq_counter < 0x7FFF) ? irq_base + (0x7FFF - static_cast<uint64_t>(irq_counter)) * 3 : NO_EVENT;
+}
+
+void Mapper19::runEvent(NES* nes) {
+	irq_counter = 0x7FFF;
+	irq_base = nes->mapper_event;
+	triggerIRQ(nes->cpu);
+	schedule(nes);
+}
+
+void Mapper69::syncCounter(NES* nes) {
+	if (irq_control & 0x80) {
+		const uint64_t cycles = (nes->ppu->ticks - irq_base) / 3;
+		irq_counter = static_cast<uint16_t>(irq_counter - cycles);
+		irq_base += cycles * 3;
+	}
+}
+
+uint8_t Mapper69::read(Cartridge* cartridge, uint16_t address) {
+	if (address >= 0x6000 && address < 0x8000) {
+		if ((ram_bank & 0x40) == 0) {
+			return cartridge->PRG[(prgBank(ram_bank & 0x3F) << 13) + static_cast<int>(address & 8191)];
+		}
+		return (ram_bank & 0x80) ? cartridge->SRAM[address - 0x6000] : 0;
+	}
+	return PagedMapper::read(cartridge, address);
+}
+
+void Mapper69::write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+	if (address >= 0x6000 && address < 0x8000) {
+		if ((ram_bank & 0xC0) == 0xC0) {
+			cartridge->SRAM[address - 0x6000] = value;
+		}
+	}
+	else if (address < 0x8000) {
+		PagedMapper::write(cartridge, address, value);
+	}
+	else if (address < 0xA000) {
+		command = value & 0x0F;
+	}
+	else if (address < 0xC000) {
+		if (command < 8) {
+			mapCHR1(command, value);
+		}
+		else if (command == 8) {
+			ram_bank = value;
+		}
+		else if (command < 0x0C) {
+			mapPRG8(command - 9, value & 0x3F);
+		}
+		else if (command == 0x0C) {
+			cartridge->mirror = vrc_mirror_tbl[value & 3];
+		}
+		else {
+			const bool was_counting = (irq_control & 0x80) == 0x80;
+			syncCounter(console);
+			if (command == 0x0D) {
+				irq_control = value;
+				if (!was_counting) {
+					irq_base = console->ppu->ticks;
+				}
+			}
+			else if (command == 0x0E) {
+				irq_counter = (irq_counter & 0xFF00) | value;
+			}
+			else {
+				irq_counter = static_cast<uint16_t>((irq_counter & 0x00FF) | (value << 8));
+			}
+			schedule(console);
+		}
+	}
+	else if (address < 0xE000) {
+		s5b.address = value & 0x0F;
+	}
+	else {
+		mixAudio(console);
+		s5b.write(value);
+	}
+}
+
+// the counter fires when it wraps from 0 to $FFFF
+void Mapper69::schedule(NES* nes) {
+	nes->mapper_event = (irq_control & 0x81) == 0x81 ? irq_base + (static_cast<uint64_t>(irq_counter) + 1) * 3 : NO_EVENT;
+}
+
+void Mapper69::runEvent(NES* nes) {
+	irq_counter = 0xFFFF;
+	irq_base = nes->mapper_event;
+	triggerIRQ(nes->cpu);
+	schedule(nes);
+}
+
+// Discrete-logic boards. Supporting another one is a line here.
+//
+//  mapper  name               $8000 $C000  registers: { mask, match, shift, bits, target }
+constexpr BoardDescriptor boards[] = {
+	{ 0,   "NROM",            0, -1, 0, {} },
+	{ 2,   "UxROM",           0, -1, 1, { { 0x8000, 0x8000, 0, 8, TargetPRG16Lo } } },
+	{ 3,   "CNROM",           0, -1, 1, { { 0x8000, 0x8000, 0, 8, TargetCHR8 } } },
+	{ 7,   "AxROM",           0,  1, 2, { { 0x8000, 0x8000, 0, 3, TargetPRG32 }, { 0x8000, 0x8000, 4, 1, TargetMirror } } },
+	{ 11,  "Color Dreams",    0,  1, 2, { { 0x8000, 0x8000, 0, 2, TargetPRG32 }, { 0x8000, 0x8000, 4, 4, TargetCHR8 } } },
+	{ 34,  "BNROM",           0,  1, 1, { { 0x8000, 0x8000, 0, 8, TargetPRG32 } } },
+	{ 38,  "Crime Busters",   0,  1, 2, { { 0xF000, 0x7000, 0, 2, TargetPRG32 }, { 0xF000, 0x7000, 2, 2, TargetCHR8 } } },
+	{ 66,  "GxROM",           0,  1, 2, { { 0x8000, 0x8000, 4, 2, TargetPRG32 }, { 0x8000, 0x8000, 0, 2, TargetCHR8 } } },
+	{ 94,  "UN1ROM",          0, -1, 1, { { 0x8000, 0x8000, 2, 3, TargetPRG16Lo } } },
+	{ 101, "JF-10",           0, -1, 1, { { 0xE000, 0x6000, 0, 8, TargetCHR8 } } },
+	{ 140, "Jaleco JF-11/14", 0,  1, 2, { { 0xE000, 0x6000, 4, 2, TargetPRG32 }, { 0xE000, 0x6000, 0, 4, TargetCHR8 } } },
+	{ 180, "UNROM (Crazy Climber)", 0, -1, 1, { { 0x8000, 0x8000, 0, 3, TargetPRG16Hi } } },
+};
+
+const BoardDescriptor* findBoard(uint8_t mapper) {
+	for (const BoardDescriptor& board : boards) {
+		if (board.mapper == mapper) {
+			return &board;
+		}
+	}
+	return nullptr;
+}
+
+DiscreteMapper::DiscreteMapper(Cartridge* cartridge, const BoardDescriptor* _board) : board(_board), num_regs(_board->num_regs), banks{ 0, 0 } {
+	initPages(cartridge);
+	mapPRG16(0, board->prg_lo);
+	mapPRG16(1, board->prg_hi);
+
+	// fold the size of the cartridge into each register's value mask
+	for (int i = 0; i < num_regs; ++i) {
+		const BankRegister& r = board->regs[i];
+		int size_mask = 1;
+		switch (r.target) {
+		case TargetPRG32:
+			size_mask = prg_mask >> 2;
+			break;
+		case TargetPRG16Lo:
+		case TargetPRG16Hi:
+			size_mask = prg_mask >> 1;
+			break;
+		case TargetCHR8:
+			size_mask = chr_mask >> 3;
+			break;
+		}
+		regs[i].mask = r.mask;
+		regs[i].match = r.match;
+		regs[i].shift = r.shift;
+		regs[i].value_mask = static_cast<uint8_t>(((1 << r.bits) - 1) & size_mask);
+		regs[i].target = r.target;
+	}
+}
+
+void DiscreteMapper::rebind(NES* nes) {
+	board = nes != nullptr ? findBoard(nes->cartridge->mapper) : nullptr;
+}
+
+void DiscreteMapper::setBank(Cartridge* cartridge, int index, uint8_t bank) {
+	banks[index] = bank;
+	switch (regs[index].target) {
+	case TargetPRG32:
+		mapPRG32(bank);
+		break;
+	case TargetPRG16Lo:
+		mapPRG16(0, bank);
+		break;
+	case TargetPRG16Hi:
+		mapPRG16(1, bank);
+		break;
+	case TargetCHR8:
+		mapCHR8(bank);
+		break;
+	case TargetMirror:
+		cartridge->mirror = bank ? MirrorSingle1 : MirrorSingle0;
+		break;
 	}
-	index %= c->prg_size >> 13;
-	int offset = index << 13;
-	if (offset < 0) {
-		offset += c->prg_size;
+}
+
+uint8_t Mapper::readNametable(NES* nes, uint16_t address) {
+	static_cast<void>(nes);
+	static_cast<void>(address);
+	return 0;
+}
+
+void Mapper::writeNametable(NES* nes, uint16_t address, uint8_t value) {
+	static_cast<void>(nes);
+	static_cast<void>(address);
+	static_cast<void>(value);
+}
+
+void Mapper::schedule(NES* nes) {
+	static_cast<void>(nes);
+}
+
+void Mapper::runEvent(NES* nes) {
+	static_cast<void>(nes);
+}
+
+uint8_t Mapper::fetchTile(NES* nes, uint16_t address) {
+	return readPPU(nes, address);
+}
+
+uint8_t Mapper::fetchAttribute(NES* nes, uint16_t address) {
+	return readPPU(nes, address);
+}
+
+uint8_t Mapper::fetchBackground(NES* nes, uint16_t address) {
+	return readPPU(nes, address);
+}
+
+uint8_t Mapper::fetchSprite(NES* nes, uint16_t address) {
+	return readPPU(nes, address);
+}
+
+void Mapper::mixAudio(NES* nes) {
+	if (audio != nullptr) {
+		APU* apu = nes->apu;
+		audio->render(apu->samples + apu->mixed, apu->sample_count - apu->mixed);
+		apu->mixed = apu->sample_count;
 	}
-	return offset;
 }
 
-int Mapper4::chrBankOffset(Cartridge* cartridge, int index) {
-	if (index >= 0x80) {
-		index -= 0x100;
+Mapper5::Mapper5(NES* _console, Cartridge* cartridge) : console(_console), prg_mode(3), chr_mode(0), ram_protect{ 0, 0 }, exram_mode(0), nt_mapping(0),
+	fill_tile(0), fill_attrib(0), prg_regs{ 0, 0, 0, 0, 0xFF }, chr_regs{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }, chr_upper(0), chr_last_b(false),
+	split_ctrl(0), split_scroll(0), split_bank(0), irq_target(0), irq_enable(false), irq_pending(false), mul{ 0, 0 },
+	ram_pages{ 0, 0, 0, 0, 0 }, prg_is_ram{ false, false, false, false }, chr_a{ 0, 0, 0, 0, 0, 0, 0, 0 }, chr_b{ 0, 0, 0, 0, 0, 0, 0, 0 },
+	in_split(false), split_fine_y(0), split_attrib(0), ext_byte(0)
+{
+	fetch_hooks = true;
+	cartridge->mirror = MirrorMapper;
+	memset(exram, 0, 1024);
+	initPages(cartridge);
+	updatePRG();
+	updateCHR();
+}
+
+// 'bank' is in 8k units. Bit 7 of the register selects ROM, except at $E000 which is always ROM.
+void Mapper5::setPRGPage(int page, uint8_t value, int bank, bool rom_only) {
+	prg_is_ram[page] = !rom_only && (value & 0x80) == 0;
+	if (prg_is_ram[page]) {
+		ram_pages[page + 1] = (bank & 7) << 13;
 	}
-	index %= cartridge->chr_size >> 10;
-	int offset = index << 10;
-	if (offset < 0) {
-		offset += cartridge->chr_size;
+	else {
+		mapPRG8(page, bank & 0x7F);
 	}
-	return offset;
 }
 
-void Mapper4::updateOffsets(Cartridge* cartridge) {
+// PRG mode  0: 32k at $8000 ($5117)
+//           1: 16k at $8000 ($5115), 16k at $C000 ($5117)
+//           2: 16k at $8000 ($5115), 8k at $C000 ($5116), 8k at $E000 ($5117)
+//           3: 8k each ($5114-$5117)
+void Mapper5::updatePRG() {
+	ram_pages[0] = (prg_regs[0] & 7) << 13;
 	switch (prg_mode) {
 	case 0:
-		prg_offsets[0] = prgBankOffset(cartridge, static_cast<int>(regs[6]));
-		prg_offsets[1] = prgBankOffset(cartridge, static_cast<int>(regs[7]));
-		prg_offsets[2] = prgBankOffset(cartridge, -2);
-		prg_offsets[3] = prgBankOffset(cartridge, -1);
+		for (int i = 0; i < 4; ++i) {
+			setPRGPage(i, prg_regs[4], (prg_regs[4] & 0x7C) | i, true);
+		}
 		break;
 	case 1:
-		prg_offsets[0] = prgBankOffset(cartridge, -2);
-		prg_offsets[1] = prgBankOffset(cartridge, static_cast<int>(regs[7]));
-		prg_offsets[2] = prgBankOffset(cartridge, static_cast<int>(regs[6]));
-		prg_offsets[3] = prgBankOffset(cartridge, -1);
+		setPRGPage(0, prg_regs[2], prg_regs[2] & 0x7E, false);
+		setPRGPage(1, prg_regs[2], (prg_regs[2] & 0x7E) | 1, false);
+		setPRGPage(2, prg_regs[4], prg_regs[4] & 0x7E, true);
+		setPRGPage(3, prg_regs[4], (prg_regs[4] & 0x7E) | 1, true);
+		break;
+	case 2:
+		setPRGPage(0, prg_regs[2], prg_regs[2] & 0x7E, false);
+		setPRGPage(1, prg_regs[2], (prg_regs[2] & 0x7E) | 1, false);
+		setPRGPage(2, prg_regs[3], prg_regs[3], false);
+		setPRGPage(3, prg_regs[4], prg_regs[4], true);
+		break;
+	case 3:
+		setPRGPage(0, prg_regs[1], prg_regs[1], false);
+		setPRGPage(1, prg_regs[2], prg_regs[2], false);
+		setPRGPage(2, prg_regs[3], prg_regs[3], false);
+		setPRGPage(3, prg_regs[4], prg_regs[4], true);
 		break;
 	}
+}
 
-	switch (chr_mode) {
+// CHR mode  0: 8k  ($5127 / $512B)
+//           1: 4k  ($5123, $5127 / $512B)
+//           2: 2k  ($5121, $5123, $5125, $5127 / $5129, $512B)
+//           3: 1k  ($5120-$5127 / $5128-$512B)
+// The background set only covers 4k and is mirrored into both halves.
+void Mapper5::updateCHR() {
+	const int upper = chr_upper << 8;
+	for (int i = 0; i < 8; ++i) {
+		switch (chr_mode) {
+		case 0:
+			chr_a[i] = chrBank(((chr_regs[7] | upper) << 3) | i) << 10;
+			chr_b[i] = chrBank(((chr_regs[11] | upper) << 3) | (i & 3)) << 10;
+			break;
+		case 1:
+			chr_a[i] = chrBank(((chr_regs[((i >> 2) << 2) + 3] | upper) << 2) | (i & 3)) << 10;
+			chr_b[i] = chrBank(((chr_regs[11] | upper) << 2) | (i & 3)) << 10;
+			break;
+		case 2:
+			chr_a[i] = chrBank(((chr_regs[((i >> 1) << 1) + 1] | upper) << 1) | (i & 1)) << 10;
+			chr_b[i] = chrBank(((chr_regs[8 + (i & 2) + 1] | upper) << 1) | (i & 1)) << 10;
+			break;
+		case 3:
+			chr_a[i] = chrBank(chr_regs[i] | upper) << 10;
+			chr_b[i] = chrBank(chr_regs[8 + (i & 3)] | upper) << 10;
+			break;
+		}
+	}
+	// CPU accesses and 8x8 sprite mode use whichever set was written last
+	memcpy(chr_pages, chr_last_b ? chr_b : chr_a, sizeof(chr_pages));
+}
+
+bool Mapper5::inFrame() {
+	PPU* ppu = console->ppu;
+	return (ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0) && ppu->scanline < 240;
+}
+
+uint8_t Mapper5::readCHR(Cartridge* cartridge, const int* pages, uint16_t address) {
+	return cartridge->CHR[pages[(address >> 10) & 7] + static_cast<int>(address & 1023)];
+}
+
+uint8_t Mapper5::read(Cartridge* cartridge, uint16_t address) {
+	if (address < 0x2000) {
+		return readCHR(cartridge, chr_pages, address);
+	}
+	else if (address >= 0x8000) {
+		const int page = (address >> 13) & 3;
+		if (prg_is_ram[page]) {
+			return cartridge->SRAM[ram_pages[page + 1] + static_cast<int>(address & 8191)];
+		}
+		return cartridge->PRG[prg_pages[page] + static_cast<int>(address & 8191)];
+	}
+	else if (address >= 0x6000) {
+		return cartridge->SRAM[ram_pages[0] + static_cast<int>(address & 8191)];
+	}
+	else if (address >= 0x5C00) {
+		return exram_mode >= 2 ? exram[address & 1023] : 0;
+	}
+	else if (address == 0x5204) {
+		uint8_t status = 0;
+		if (irq_pending) {
+			status |= 0x80;
+		}
+		if (inFrame()) {
+			status |= 0x40;
+		}
+		irq_pending = false;
+		return status;
+	}
+	else if (address == 0x5205) {
+		return static_cast<uint8_t>(mul[0] * mul[1]);
+	}
+	else if (address == 0x5206) {
+		return static_cast<uint8_t>((mul[0] * mul[1]) >> 8);
+	}
+	return 0;
+}
+
+void Mapper5::write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+	const bool ram_writable = ram_protect[0] == 2 && ram_protect[1] == 1;
+	if (address < 0x2000) {
+		PagedMapper::write(cartridge, address, value);
+	}
+	else if (address >= 0x8000) {
+		const int page = (address >> 13) & 3;
+		if (prg_is_ram[page] && ram_writable) {
+			cartridge->SRAM[ram_pages[page + 1] + static_cast<int>(address & 8191)] = value;
+		}
+	}
+	else if (address >= 0x6000) {
+		if (ram_writable) {
+			cartridge->SRAM[ram_pages[0] + static_cast<int>(address & 8191)] = value;
+		}
+	}
+	else if (address >= 0x5C00) {
+		// in modes 0-1 ExRAM is the PPU's, and only writable while it's rendering
+		if (exram_mode <= 1) {
+			exram[address & 1023] = inFrame() ? value : 0;
+		}
+		else if (exram_mode == 2) {
+			exram[address & 1023] = value;
+		}
+	}
+	else if (address == 0x5100) {
+		prg_mode = value & 3;
+		updatePRG();
+	}
+	else if (address == 0x5101) {
+		chr_mode = value & 3;
+		updateCHR();
+	}
+	else if (address == 0x5102 || address == 0x5103) {
+		ram_protect[address - 0x5102] = value & 3;
+	}
+	else if (address == 0x5104) {
+		exram_mode = value & 3;
+	}
+	else if (address == 0x5105) {
+		nt_mapping = value;
+	}
+	else if (address == 0x5106) {
+		fill_tile = value;
+	}
+	else if (address == 0x5107) {
+		fill_attrib = value & 3;
+	}
+	else if (address >= 0x5113 && address <= 0x5117) {
+		prg_regs[address - 0x5113] = value;
+		updatePRG();
+	}
+	else if (address >= 0x5120 && address <= 0x512B) {
+		chr_regs[address - 0x5120] = value;
+		chr_last_b = address >= 0x5128;
+		updateCHR();
+	}
+	else if (address == 0x5130) {
+		chr_upper = value & 3;
+		updateCHR();
+	}
+	else if (address == 0x5200) {
+		split_ctrl = value;
+	}
+	else if (address == 0x5201) {
+		split_scroll = value;
+	}
+	else if (address == 0x5202) {
+		split_bank = value;
+	}
+	else if (address == 0x5203) {
+		irq_target = value;
+		schedule(console);
+	}
+	else if (address == 0x5204) {
+		irq_enable = (value & 0x80) == 0x80;
+		if (irq_enable && irq_pending) {
+			triggerIRQ(console->cpu);
+		}
+	}
+	else if (address == 0x5205 || address == 0x5206) {
+		mul[address - 0x5205] = value;
+	}
+}
+
+// $5105 maps each nametable slot to  0: CIRAM page 0   1: CIRAM page 1
+//                                    2: ExRAM          3: fill mode
+uint8_t Mapper5::readNametable(NES* nes, uint16_t address) {
+	const int offset = address & 1023;
+	switch ((nt_mapping >> (((address >> 10) & 3) << 1)) & 3) {
+	case 0:
+		return nes->ppu->name_tbl[offset];
+	case 1:
+		return nes->ppu->name_tbl[1024 + offset];
+	case 2:
+		return exram_mode <= 1 ? exram[offset] : 0;
+	default:
+		return offset >= 0x3C0 ? static_cast<uint8_t>(fill_attrib * 0x55) : fill_tile;
+	}
+}
+
+void Mapper5::writeNametable(NES* nes, uint16_t address, uint8_t value) {
+	const int offset = address & 1023;
+	switch ((nt_mapping >> (((address >> 10) & 3) << 1)) & 3) {
 	case 0:
-		chr_offsets[0] = chrBankOffset(cartridge, static_cast<int>(regs[0] & 0xFE));
-		chr_offsets[1] = chrBankOffset(cartridge, static_cast<int>(regs[0] | 0x01));
-		chr_offsets[2] = chrBankOffset(cartridge, static_cast<int>(regs[1] & 0xFE));
-		chr_offsets[3] = chrBankOffset(cartridge, static_cast<int>(regs[1] | 0x01));
-		chr_offsets[4] = chrBankOffset(cartridge, static_cast<int>(regs[2]));
-		chr_offsets[5] = chrBankOffset(cartridge, static_cast<int>(regs[3]));
-		chr_offsets[6] = chrBankOffset(cartridge, static_cast<int>(regs[4]));
-		chr_offsets[7] = chrBankOffset(cartridge, static_cast<int>(regs[5]));
+		nes->ppu->name_tbl[offset] = value;
 		break;
 	case 1:
-		chr_offsets[0] = chrBankOffset(cartridge, static_cast<int>(regs[2]));
-		chr_offsets[1] = chrBankOffset(cartridge, static_cast<int>(regs[3]));
-		chr_offsets[2] = chrBankOffset(cartridge, static_cast<int>(regs[4]));
-		chr_offsets[3] = chrBankOffset(cartridge, static_cast<int>(regs[5]));
-		chr_offsets[4] = chrBankOffset(cartridge, static_cast<int>(regs[0] & 0xFE));
-		chr_offsets[5] = chrBankOffset(cartridge, static_cast<int>(regs[0] | 0x01));
-		chr_offsets[6] = chrBankOffset(cartridge, static_cast<int>(regs[1] & 0xFE));
-		chr_offsets[7] = chrBankOffset(cartridge, static_cast<int>(regs[1] | 0x01));
+		nes->ppu->name_tbl[1024 + offset] = value;
+		break;
+	case 2:
+		if (exram_mode <= 1) {
+			exram[offset] = value;
+		}
 		break;
 	}
 }
 
-NES::NES(const char* path, const char* SRAM_path) : initialized(false) {
-	std::cout << "Initializing cartridge..." << std::endl;
-	cartridge = new Cartridge(path, SRAM_path);
-	if (!cartridge->initialized) return;
+// The scanline counter starts at line 0 and counts each rendered line,
+// so the IRQ for target N lands at the start of line N.
+void Mapper5::schedule(NES* nes) {
+	PPU* ppu = nes->ppu;
+	nes->mapper_event = NO_EVENT;
+	if (irq_target != 0 && irq_target < 240 && (ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0)) {
+		nes->mapper_event = ppuTickAt(ppu, irq_target, 1);
+	}
+}
 
-	std::cout << "Initializing controllers..." << std::endl;
-	controller1 = new Controller;
-	controller2 = new Controller;
+void Mapper5::runEvent(NES* nes) {
+	irq_pending = true;
+	if (irq_enable) {
+		triggerIRQ(nes->cpu);
+	}
+	schedule(nes);
+}
 
-	RAM = new uint8_t[2048];
-	memset(RAM, 0, 2048);
+uint8_t Mapper5::fetchTile(NES* nes, uint16_t address) {
+	in_split = false;
+	if ((split_ctrl & 0x80) && exram_mode <= 1) {
+		PPU* ppu = nes->ppu;
+		// the two tiles fetched at dots 321-336 are the first two of the next line
+		const bool next_line = ppu->cycle > 256;
+		const int col = next_line ? (ppu->cycle - 321) >> 3 : ((ppu->cycle - 1) >> 3) + 2;
+		const int split_col = split_ctrl & 0x1F;
+		in_split = (split_ctrl & 0x40) ? col >= split_col : col < split_col;
+		if (in_split) {
+			int line = next_line ? ppu->scanline + 1 : ppu->scanline;
+			if (line >= 261) {
+				line = 0;
+			}
+			const int y = (static_cast<int>(split_scroll) + line) % 240;
+			const int x = col & 31;
+			split_fine_y = static_cast<uint8_t>(y & 7);
+			const uint8_t attrib = exram[0x3C0 + ((y >> 5) << 3) + (x >> 2)];
+			split_attrib = (attrib >> (((y >> 2) & 4) | (x & 2))) & 3;
+			return exram[((y >> 3) << 5) + x];
+		}
+	}
+	if (exram_mode == 1) {
+		ext_byte = exram[address & 1023];
+	}
+	return readPPU(nes, address);
+}
+
+// attribute bytes handed back with the palette in all four quadrants,
+// so the PPU's quadrant shift picks it regardless of scroll
+uint8_t Mapper5::fetchAttribute(NES* nes, uint16_t address) {
+	if (in_split) {
+		return static_cast<uint8_t>(split_attrib * 0x55);
+	}
+	if (exram_mode == 1) {
+		return static_cast<uint8_t>((ext_byte >> 6) * 0x55);
+	}
+	return readPPU(nes, address);
+}
+
+uint8_t Mapper5::fetchBackground(NES* nes, uint16_t address) {
+	Cartridge* cartridge = nes->cartridge;
+	if (in_split) {
+		const int page = chrBank((split_bank << 2) | ((address >> 10) & 3));
+		return cartridge->CHR[(page << 10) + static_cast<int>((address & 0x3F8) | split_fine_y)];
+	}
+	if (exram_mode == 1) {
+		const int page = chrBank((((chr_upper << 6) | (ext_byte & 0x3F)) << 2) | ((address >> 10) & 3));
+		return cartridge->CHR[(page << 10) + static_cast<int>(address & 1023)];
+	}
+	return readCHR(cartridge, nes->ppu->flag_sprite_size ? chr_b : chr_pages, address);
+}
+
+uint8_t Mapper5::fetchSprite(NES* nes, uint16_t address) {
+	return readCHR(nes->cartridge, nes->ppu->flag_sprite_size ? chr_a : chr_pages, address);
+}
+
+NES::NES(const char* path, const char* SRAM_path) : initialized(false), cpu(nullptr), apu(nullptr), ppu(nullptr), cartridge(nullptr),
+	controller1(nullptr), controller2(nullptr), mapper(nullptr), RAM(nullptr), mapper_event(NO_EVENT), io_writes(0), vblanks_seen(0), ppu_trace(nullptr), apu_log(nullptr) {
+	std::cout << "Initializing cartridge...\n";
+	cartridge = new Cartridge(path, SRAM_path);
+	if (!cartridge->initialized) return;
 
-	std::cout << "Initializing mapper..." << std::endl;
-	if (cartridge->mapper == 0) {
-		const int prg_banks = cartridge->prg_size >> 14;
-		mapper = new Mapper2(prg_banks, 0, prg_banks - 1);
+	std::cout << "Initializing mapper...\n";
+	const BoardDescriptor* board = findBoard(cartridge->mapper);
+	if (board != nullptr) {
+		mapper = new DiscreteMapper(cartridge, board);
 	}
 	else if (cartridge->mapper == 1) {
 		Mapper1* m = new Mapper1();
+		m->initPages(cartridge);
 		m->shift_reg = 0x10;
-		m->prg_offsets[1] = m->prgBankOffset(cartridge, -1);
 		mapper = m;
 	}
-	else if (cartridge->mapper == 2) {
-		const int prg_banks = cartridge->prg_size >> 14;
-		mapper = new Mapper2(prg_banks, 0, prg_banks - 1);
-	}
-	else if (cartridge->mapper == 3) {
-		const int prg_banks = cartridge->prg_size >> 14;
-		mapper = new Mapper3(0, 0, prg_banks - 1);
-	}
 	else if (cartridge->mapper == 4) {
-		Mapper4* m = new Mapper4();
-		m->prg_offsets[0] = m->prgBankOffset(cartridge, 0);
-		m->prg_offsets[1] = m->prgBankOffset(cartridge, 1);
-		m->prg_offsets[2] = m->prgBankOffset(cartridge, -2);
-		m->prg_offsets[3] = m->prgBankOffset(cartridge, -1);
+		Mapper4* m = new Mapper4(this);
+		m->initPages(cartridge);
 		mapper = m;
 	}
-	else if (cartridge->mapper == 7) {
-		mapper = new Mapper7();
+	else if (cartridge->mapper == 5) {
+		mapper = new Mapper5(this, cartridge);
+	}
+	else if (cartridge->mapper == 9 || cartridge->mapper == 10) {
+		mapper = new Mapper9(cartridge);
+	}
+	else if (cartridge->mapper == 19) {
+		mapper = new Mapper19(this, cartridge);
+	}
+	else if (cartridge->mapper == 24 || cartridge->mapper == 26) {
+		mapper = new Mapper24(this, cartridge);
+	}
+	else if (cartridge->mapper == 69) {
+		mapper = new Mapper69(this, cartridge);
+	}
+	else if (cartridge->mapper == 85) {
+		mapper = new Mapper85(this, cartridge);
 	}
 	else {
 		std::cerr << "ERROR: cartridge uses Mapper " << static_cast<int>(cartridge->mapper) << ", which isn't currently supported by KNES!" << std::endl;
 		return;
 	}
 
-	std::cout << "Mapper " << static_cast<int>(cartridge->mapper) << " activated." << std::endl;
+	std::cout << "Mapper " << static_cast<int>(cartridge->mapper) << " activated.\n";
+
+	powerOn();
+}
+
+NES::NES(Mapper* _mapper) : initialized(false), cpu(nullptr), apu(nullptr), ppu(nullptr), cartridge(nullptr),
+	controller1(nullptr), controller2(nullptr), mapper(_mapper), RAM(nullptr), mapper_event(NO_EVENT), io_writes(0), vblanks_seen(0), ppu_trace(nullptr), apu_log(nullptr) {
+	powerOn();
+}
+
+NES::~NES() {
+	if (apu != nullptr) {
+		delete[] apu->samples;
+	}
+	if (ppu != nullptr) {
+		delete[] ppu->front;
+		delete[] ppu->back;
+	}
+	delete cpu;
+	delete apu;
+	delete ppu;
+	delete controller1;
+	delete controller2;
+	delete[] RAM;
+	delete mapper;
+	delete cartridge;
+	delete ppu_trace;
+	delete apu_log;
+}
+
+void NES::powerOn() {
+	std::cout << "Initializing controllers...\n";
+	controller1 = new Controller;
+	controller2 = new Controller;
 
-	std::cout << "Initializing NES CPU..." << std::endl;
+	RAM = new uint8_t[2048];
+	memset(RAM, 0, 2048);
+
+	std::cout << "Initializing NES CPU...\n";
 	cpu = new CPU();
 
 	cpu->PC = read16(this, 0xFFFC);
 	cpu->SP = 0xFD;
 	cpu->flags = 0x24;
 
-	std::cout << "Initializing NES APU..." << std::endl;
+	std::cout << "Initializing NES APU...\n";
 	apu = new APU();
 	apu->noise.shift_reg = 1;
 	apu->pulse1.channel = 1;
 	apu->pulse2.channel = 2;
+	// room for two frames of audio, so stepping doesn't have to grow it
+	apu->sample_capacity = static_cast<int>(CPU_FREQ / 30.0 / SAMPLE_RATE) + 2;
+	apu->samples = new float[apu->sample_capacity];
 
-	std::cout << "Initializing NES PPU..." << std::endl;
+	std::cout << "Initializing NES PPU...\n";
 	ppu = new PPU();
 	ppu->front = new uint32_t[256 * 240];
 	ppu->back = new uint32_t[256 * 240];
@@ -567,7 +1452,12 @@ void writePPU(NES* nes, uint16_t address, uint8_t value) {
 	}
 	else if (address < 0x3F00) {
 		const uint8_t mode = nes->cartridge->mirror;
-		nes->ppu->name_tbl[mirrorAddress(mode, address) & 2047] = value;
+		if (mode == MirrorMapper) {
+			nes->mapper->writeNametable(nes, address, value);
+		}
+		else {
+			nes->ppu->name_tbl[mirrorAddress(mode, address) & 2047] = value;
+		}
 	}
 	else if (address < 0x4000) {
 		// palette
@@ -591,6 +1481,8 @@ void writeRegisterPPU(NES* nes, uint16_t address, uint8_t value) {
 		break;
 	case 0x2001:
 		writePPUMask(ppu, value);
+		// mapper events depend on whether the PPU is rendering
+		nes->mapper->schedule(nes);
 		break;
 	case 0x2003:
 		ppu->oam_addr = value;
@@ -633,6 +1525,9 @@ void writeRegisterPPU(NES* nes, uint16_t address, uint8_t value) {
 		address = static_cast<uint16_t>(value) << 8;
 		for (int i = 0; i < 256; ++i) {
 			ppu->oam_tbl[ppu->oam_addr] = readByte(nes, address);
+			if (nes->ppu_trace != nullptr) {
+				nes->ppu_trace->record(ppu->ticks, TraceOAM, 0x2004, ppu->oam_tbl[ppu->oam_addr]);
+			}
 			++ppu->oam_addr;
 			++address;
 		}
@@ -646,30 +1541,41 @@ void writeRegisterPPU(NES* nes, uint16_t address, uint8_t value) {
 void writeByte(NES* nes, uint16_t address, uint8_t value) {
 	if (address < 0x2000) {
 		nes->RAM[address & 2047] = value;
+		return;
 	}
-	else if (address < 0x4000) {
-		writeRegisterPPU(nes, 0x2000 + (address & 7), value);
+
+	// cartridge writes don't count: a game spinning on PRG-RAM is still hung
+	if (address <= 0x4017) {
+		++nes->io_writes;
 	}
-	else if (address < 0x4014) {
-		writeRegisterAPU(nes->apu, address, value);
+	if (address < 0x4000) {
+		address = 0x2000 + (address & 7);
+		if (nes->ppu_trace != nullptr) {
+			nes->ppu_trace->record(nes->ppu->ticks, TraceWrite, address, value);
+		}
+		writeRegisterPPU(nes, address, value);
 	}
 	else if (address == 0x4014) {
 		writeRegisterPPU(nes, address, value);
 	}
-	else if (address == 0x4015) {
-		writeRegisterAPU(nes->apu, address, value);
-	}
 	else if (address == 0x4016) {
 		writeController(nes->controller1, value);
 		writeController(nes->controller2, value);
 	}
-	else if (address == 0x4017) {
+	else if (address <= 0x4017) {
+		if (nes->apu_log != nullptr) {
+			nes->apu_log->record(nes->apu->cycle, TraceWrite, address, value);
+		}
 		writeRegisterAPU(nes->apu, address, value);
 	}
-	else if (address < 0x6000) {
+	else if (address < 0x4020) {
 		// I/O registers
 	}
-	else if (address >= 0x6000) {
+	else if (address >= 0x4020) {
+		// PRG-RAM writes can't affect the PPU, but some boards decode registers there
+		if (nes->ppu_trace != nullptr && nes->mapper->writesRegister(address)) {
+			nes->ppu_trace->record(nes->ppu->ticks, TraceWrite, address, value);
+		}
 		nes->mapper->write(nes->cartridge, address, value);
 	}
 	else {
@@ -684,6 +1590,9 @@ uint8_t readPPU(NES* nes, uint16_t address) {
 	}
 	else if (address < 0x3F00) {
 		uint8_t mode = nes->cartridge->mirror;
+		if (mode == MirrorMapper) {
+			return nes->mapper->readNametable(nes, address);
+		}
 		return nes->ppu->name_tbl[mirrorAddress(mode, address) & 2047];
 	}
 	else if (address < 0x4000) {
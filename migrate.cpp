@@ -0,0 +1,191 @@
+/*******************************************************************
+*   migrate.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Live migration of a running session to another process over a Unix socket.
+//
+// The old worker sends a save state taken at a frame boundary and keeps
+// playing, noting the controller input of every frame it runs meanwhile.
+// The new worker loads the state and acknowledges. At the old worker's next
+// frame boundary it sends the inputs it noted and stops; the new worker
+// catches up on those few frames and carries on. Both sides must step with
+// emulateFrame() so that they agree on where frames begin.
+
+#include "NES.h"
+
+#ifndef _WIN32
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr uint32_t MIGRATE_STATE = 0x54415453; // "STAT"
+constexpr uint32_t MIGRATE_ACK = 0x204B4341;   // "ACK "
+constexpr uint32_t MIGRATE_HANDOFF = 0x444E4148; // "HAND"
+
+bool sendAll(int fd, const void* data, size_t size) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	while (size > 0) {
+		const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+		if (n <= 0) return false;
+		p += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+bool recvAll(int fd, void* data, size_t size) {
+	uint8_t* p = static_cast<uint8_t*>(data);
+	while (size > 0) {
+		const ssize_t n = recv(fd, p, size, 0);
+		if (n <= 0) return false;
+		p += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+static bool socketAddress(sockaddr_un* addr, const char* path) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		std::cerr << "ERROR: migration socket path is too long!" << std::endl;
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+bool startMigration(Migration* m, const NES* nes, const char* socket_path) {
+	sockaddr_un addr;
+	if (!socketAddress(&addr, socket_path)) return false;
+	m->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m->fd < 0 || connect(m->fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		std::cerr << "ERROR: failed to connect to migration socket!" << std::endl;
+		if (m->fd >= 0) close(m->fd);
+		m->fd = -1;
+		return false;
+	}
+
+	std::vector<uint8_t> state;
+	saveState(nes, &state);
+	const uint64_t size = state.size();
+	if (!sendAll(m->fd, &MIGRATE_STATE, 4) || !sendAll(m->fd, &size, 8) || !sendAll(m->fd, state.data(), state.size())) {
+		std::cerr << "ERROR: failed to send session state!" << std::endl;
+		close(m->fd);
+		m->fd = -1;
+		return false;
+	}
+	m->inputs.clear();
+	return true;
+}
+
+bool migrationFrame(Migration* m, const NES* nes) {
+	if (m->fd < 0) return false;
+
+	pollfd p;
+	p.fd = m->fd;
+	p.events = POLLIN;
+	p.revents = 0;
+	if (poll(&p, 1, 0) == 1) {
+		uint32_t reply = 0;
+		if (!recvAll(m->fd, &reply, 4) || reply != MIGRATE_ACK) {
+			// the new worker gave up, so this one keeps the session
+			std::cerr << "ERROR: migration was not acknowledged!" << std::endl;
+			close(m->fd);
+			m->fd = -1;
+			return false;
+		}
+		const uint32_t frames = static_cast<uint32_t>(m->inputs.size() / 2);
+		const bool ok = sendAll(m->fd, &MIGRATE_HANDOFF, 4) && sendAll(m->fd, &frames, 4) && sendAll(m->fd, m->inputs.data(), m->inputs.size());
+		close(m->fd);
+		m->fd = -1;
+		if (!ok) {
+			std::cerr << "ERROR: failed to hand off session!" << std::endl;
+		}
+		return ok;
+	}
+
+	m->inputs.push_back(nes->controller1->buttons);
+	m->inputs.push_back(nes->controller2->buttons);
+	return false;
+}
+
+bool acceptMigration(NES* nes, const char* socket_path) {
+	sockaddr_un addr;
+	if (!socketAddress(&addr, socket_path)) return false;
+	const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socket_path);
+	if (server < 0 || bind(server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server, 1) != 0) {
+		std::cerr << "ERROR: failed to listen on migration socket!" << std::endl;
+		if (server >= 0) close(server);
+		return false;
+	}
+	const int fd = accept(server, nullptr, nullptr);
+	close(server);
+	unlink(socket_path);
+	if (fd < 0) {
+		std::cerr << "ERROR: failed to accept migration!" << std::endl;
+		return false;
+	}
+
+	uint32_t tag = 0;
+	uint64_t size = 0;
+	std::vector<uint8_t> state;
+	bool ok = recvAll(fd, &tag, 4) && tag == MIGRATE_STATE && recvAll(fd, &size, 8);
+	if (ok) {
+		state.resize(size);
+		ok = recvAll(fd, state.data(), state.size()) && loadState(nes, state.data(), state.size());
+	}
+	// declining leaves the session with the old worker
+	ok = ok && sendAll(fd, &MIGRATE_ACK, 4);
+
+	uint32_t frames = 0;
+	ok = ok && recvAll(fd, &tag, 4) && tag == MIGRATE_HANDOFF && recvAll(fd, &frames, 4);
+	std::vector<uint8_t> inputs(frames * 2);
+	ok = ok && recvAll(fd, inputs.data(), inputs.size());
+	close(fd);
+	if (!ok) {
+		std::cerr << "ERROR: failed to receive migrated session!" << std::endl;
+		return false;
+	}
+
+	for (uint32_t i = 0; i < frames; ++i) {
+		nes->controller1->buttons = inputs[2 * i];
+		nes->controller2->buttons = inputs[2 * i + 1];
+		emulateFrame(nes);
+	}
+	return true;
+}
+
+#else
+
+bool startMigration(Migration* m, const NES* nes, const char* socket_path) {
+	static_cast<void>(m);
+	static_cast<void>(nes);
+	static_cast<void>(socket_path);
+	std::cerr << "ERROR: live migration needs Unix sockets!" << std::endl;
+	return false;
+}
+
+bool migrationFrame(Migration* m, const NES* nes) {
+	static_cast<void>(m);
+	static_cast<void>(nes);
+	return false;
+}
+
+bool acceptMigration(NES* nes, const char* socket_path) {
+	static_cast<void>(nes);
+	static_cast<void>(socket_path);
+	std::cerr << "ERROR: live migration needs Unix sockets!" << std::endl;
+	return false;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*******************************************************************
+*   netplay.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Rollback netplay speculation: the next frame is run on other threads
+// for a few guesses at the remote player's input, and a console that
+// guessed right is swapped in instead of simulating the frame again.
+
+#include "NES.h"
+
+static void speculationWorker(Speculation* spec, int i) {
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(spec->mutex);
+	for (;;) {
+		spec->start.wait(lock, [&] { return spec->closing || spec->round != seen; });
+		if (spec->closing) return;
+		seen = spec->round;
+		if (i >= spec->count) continue;
+		lock.unlock();
+		emulateFrame(spec->instances[i]);
+		lock.lock();
+		if (--spec->remaining == 0) spec->finished.notify_one();
+	}
+}
+
+void speculate(Speculation* spec, const NES* nes, int remote, const uint8_t* guesses, int count) {
+	if (count > MAX_SPECULATIONS) count = MAX_SPECULATIONS;
+	for (int i = 0; i < count; ++i) {
+		if (spec->instances[i] == nullptr) {
+			spec->instances[i] = cloneNES(nes);
+		}
+		else {
+			copyState(spec->instances[i], nes);
+		}
+		NES* instance = spec->instances[i];
+		spec->guesses[i] = guesses[i];
+		(remote == 1 ? instance->controller1 : instance->controller2)->buttons = guesses[i];
+	}
+
+	// 'count' only changes under the lock, as idle workers check it on waking
+	{
+		std::lock_guard<std::mutex> lock(spec->mutex);
+		spec->count = count;
+		while (spec->started < count) {
+			spec->workers[spec->started] = std::thread(speculationWorker, spec, spec->started);
+			++spec->started;
+		}
+		spec->remaining = count;
+		++spec->round;
+	}
+	spec->start.notify_all();
+}
+
+bool resolveSpeculation(Speculation* spec, NES** nes, uint8_t buttons) {
+	std::unique_lock<std::mutex> lock(spec->mutex);
+	spec->finished.wait(lock, [spec] { return spec->remaining == 0; });
+
+	int hit = -1;
+	for (int i = 0; i < spec->count; ++i) {
+		if (hit < 0 && spec->guesses[i] == buttons) {
+			hit = i;
+		}
+	}
+	spec->count = 0;
+	lock.unlock();
+	if (hit < 0) {
+		return false;
+	}
+
+	// the old console becomes the spare for the next speculation
+	NES* old = *nes;
+	*nes = spec->instances[hit];
+	spec->instances[hit] = old;
+	return true;
+}
@@ -0,0 +1,142 @@
+/*******************************************************************
+*   perf.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Hardware performance counters for the benchmarks, through Linux's
+// perf_event_open(). Each event is opened on its own, user space only, so
+// that whichever the CPU, kernel or container allows still get counted.
+// When the kernel has to time-share the counters between events, counts
+// are scaled up by the time each was actually running.
+
+#include "NES.h"
+
+#include <cmath>
+
+static const char* const perf_names[PERF_EVENTS] = {
+	"cycles", "instructions", "branch misses", "L1D misses", "LLC misses", "iTLB misses"
+};
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static uint64_t cacheMiss(uint64_t cache) {
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+bool openPerfCounters(PerfCounters* perf) {
+	const struct {
+		uint32_t type;
+		uint64_t config;
+	} events[PERF_EVENTS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1D) },
+		{ PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_LL) },
+		{ PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_ITLB) }
+	};
+
+	bool any = false;
+	int error = 0;
+	for (int i = 0; i < PERF_EVENTS; ++i) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		perf->fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		if (perf->fds[i] >= 0) {
+			any = true;
+		}
+		else if (error == 0) {
+			error = errno;
+		}
+	}
+
+	if (!any) {
+		perf->error = error == EACCES || error == EPERM ? "not permitted (see /proc/sys/kernel/perf_event_paranoid)" :
+			error == ENOSYS ? "perf_event_open is blocked" :
+			error == ENOENT || error == EOPNOTSUPP ? "no hardware counters (virtual machine?)" : "perf_event_open failed";
+	}
+	return any;
+}
+
+void readPerfCounters(const PerfCounters* perf, PerfSample* sample) {
+	for (int i = 0; i < PERF_EVENTS; ++i) {
+		uint64_t values[3]; // count, time enabled, time running
+		sample->valid[i] = perf->fds[i] >= 0 && read(perf->fds[i], values, sizeof(values)) == sizeof(values) && values[2] != 0;
+		sample->counts[i] = 0;
+		if (sample->valid[i]) {
+			sample->counts[i] = values[2] == values[1] ? values[0] :
+				static_cast<uint64_t>(static_cast<double>(values[0]) * static_cast<double>(values[1]) / static_cast<double>(values[2]));
+		}
+	}
+}
+
+void closePerfCounters(PerfCounters* perf) {
+	for (int& fd : perf->fds) {
+		if (fd >= 0) close(fd);
+		fd = -1;
+	}
+}
+
+#else
+
+bool openPerfCounters(PerfCounters* perf) {
+	perf->error = "only on Linux";
+	return false;
+}
+
+void readPerfCounters(const PerfCounters* perf, PerfSample* sample) {
+	static_cast<void>(perf);
+	for (int i = 0; i < PERF_EVENTS; ++i) {
+		sample->counts[i] = 0;
+		sample->valid[i] = false;
+	}
+}
+
+void closePerfCounters(PerfCounters* perf) {
+	static_cast<void>(perf);
+}
+
+#endif
+
+void subtractPerf(PerfSample* a, const PerfSample& b) {
+	for (int i = 0; i < PERF_EVENTS; ++i) {
+		a->valid[i] = a->valid[i] && b.valid[i];
+		a->counts[i] = a->valid[i] ? a->counts[i] - b.counts[i] : 0;
+	}
+}
+
+void printPerf(const PerfCounters* perf, const PerfSample& sample, double frames) {
+	if (perf->error != nullptr) {
+		std::cout << "    hardware counters unavailable: " << perf->error << std::endl;
+		return;
+	}
+	std::cout << "    ";
+	if (sample.valid[PerfCycles] && sample.valid[PerfInstructions] && sample.counts[PerfCycles] != 0) {
+		std::cout << static_cast<double>(sample.counts[PerfInstructions]) / static_cast<double>(sample.counts[PerfCycles]) << " IPC, ";
+	}
+	std::cout << "per frame:";
+	const char* separator = " ";
+	for (int i = 0; i < PERF_EVENTS; ++i) {
+		if (!sample.valid[i]) continue;
+		std::cout << separator << std::llround(static_cast<double>(sample.counts[i]) / frames) << ' ' << perf_names[i];
+		separator = ", ";
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,89 @@
+/*******************************************************************
+*   pool.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// A pool of consoles of one ROM kept ready at a snapshot, so that starting
+// a session is taking one off a list instead of loading and booting the
+// ROM. A background thread clones new instances up to the pool's size and
+// rewinds the ones handed back to the snapshot.
+
+#include "NES.h"
+
+static void refillPool(InstancePool* pool) {
+	std::unique_lock<std::mutex> lock(pool->lock);
+	for (;;) {
+		pool->wake.wait(lock, [pool] {
+			return pool->closing || !pool->returned.empty() || static_cast<int>(pool->ready.size()) < pool->size;
+		});
+		if (pool->closing) return;
+
+		NES* nes = nullptr;
+		if (!pool->returned.empty()) {
+			nes = pool->returned.back();
+			pool->returned.pop_back();
+		}
+		// the snapshot is only ever read, so this doesn't need the lock
+		lock.unlock();
+		if (nes != nullptr) {
+			copyState(nes, pool->snapshot);
+		}
+		else {
+			nes = cloneNES(pool->snapshot);
+		}
+		lock.lock();
+		pool->ready.push_back(nes);
+	}
+}
+
+void openPool(InstancePool* pool, const NES* snapshot, int size) {
+	pool->snapshot = cloneNES(snapshot);
+	pool->size = size;
+	pool->closing = false;
+	pool->refiller = std::thread(refillPool, pool);
+}
+
+NES* acquireInstance(InstancePool* pool) {
+	{
+		std::lock_guard<std::mutex> lock(pool->lock);
+		if (!pool->ready.empty()) {
+			NES* nes = pool->ready.back();
+			pool->ready.pop_back();
+			pool->wake.notify_one();
+			return nes;
+		}
+	}
+	// drained faster than it refills
+	return cloneNES(pool->snapshot);
+}
+
+void releaseInstance(InstancePool* pool, NES* nes) {
+	std::lock_guard<std::mutex> lock(pool->lock);
+	pool->returned.push_back(nes);
+	pool->wake.notify_one();
+}
+
+void closePool(InstancePool* pool) {
+	{
+		std::lock_guard<std::mutex> lock(pool->lock);
+		pool->closing = true;
+		pool->wake.notify_one();
+	}
+	pool->refiller.join();
+
+	for (NES* nes : pool->ready) {
+		delete nes;
+	}
+	for (NES* nes : pool->returned) {
+		delete nes;
+	}
+	pool->ready.clear();
+	pool->returned.clear();
+	delete pool->snapshot;
+	pool->snapshot = nullptr;
+}
@@ -0,0 +1,388 @@
+/*******************************************************************
+*   rules.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Per-game reward and episode-termination rules, read from a small text
+// file and compiled to a flat stack bytecode evaluated after every frame.
+//
+//     # Super Mario Bros.
+//     var score = digits(0x07DD, 6) * 10
+//     var lives = ram(0x075A)
+//     reward delta(score)
+//     done lives == 0xFF
+//
+// 'var' lines are evaluated in order and can use the vars before them.
+// All 'reward' lines are added up into the frame's reward, and the episode
+// is done once any 'done' line is non-zero. Values are 64-bit integers with
+// C operators (|| && == != < <= > >= | & + - * / % ! and unary -).
+//
+//     ram(a), ram16(a)   byte / little-endian word of the 2 KB of RAM
+//     bcd(a, n)          n bytes of packed BCD, most significant first
+//     digits(a, n)       n bytes holding one decimal digit each
+//     prev(v), delta(v)  v at the previous frame, and v - prev(v)
+
+#include "NES.h"
+
+#include <cctype>
+#include <string>
+
+enum RuleOp : int32_t {
+	OpPush,   // imm
+	OpRAM,    // address
+	OpRAM16,  // address
+	OpBCD,    // address, bytes
+	OpDigits, // address, digits
+	OpVar,    // var
+	OpPrev,   // var
+	OpStore,  // var
+	OpReward,
+	OpDone,
+	OpNot,
+	OpNeg,
+	OpOr,
+	OpAnd,
+	OpEq,
+	OpNe,
+	OpLt,
+	OpLe,
+	OpGt,
+	OpGe,
+	OpBitOr,
+	OpBitAnd,
+	OpAdd,
+	OpSub,
+	OpMul,
+	OpDiv,
+	OpMod
+};
+
+constexpr int MAX_RULE_STACK = 32;
+
+struct RuleParser {
+	const char* p;
+	const char* path;
+	int line;
+	int depth; // of the value stack at this point of the code
+	int max_depth;
+	bool failed;
+	std::vector<std::string> vars;
+	std::vector<int32_t>* code;
+};
+
+static void ruleError(RuleParser* r, const char* message) {
+	if (!r->failed) {
+		std::cerr << "ERROR: " << r->path << ":" << r->line << ": " << message << std::endl;
+	}
+	r->failed = true;
+}
+
+static void emit(RuleParser* r, int32_t op, int pushes) {
+	r->code->push_back(op);
+	r->depth += pushes;
+	if (r->depth > r->max_depth) r->max_depth = r->depth;
+}
+
+static void skipSpace(RuleParser* r) {
+	while (*r->p == ' ' || *r->p == '\t' || *r->p == '\r') ++r->p;
+	if (*r->p == '#') {
+		while (*r->p != '\0' && *r->p != '\n') ++r->p;
+	}
+}
+
+static bool accept(RuleParser* r, const char* token) {
+	skipSpace(r);
+	const size_t n = strlen(token);
+	if (strncmp(r->p, token, n) != 0) return false;
+	r->p += n;
+	return true;
+}
+
+static void expect(RuleParser* r, const char* token) {
+	if (!accept(r, token)) {
+		ruleError(r, (std::string("expected '") + token + "'").c_str());
+	}
+}
+
+static std::string identifier(RuleParser* r) {
+	skipSpace(r);
+	const char* start = r->p;
+	while (isalnum(static_cast<unsigned char>(*r->p)) || *r->p == '_') ++r->p;
+	return std::string(start, r->p);
+}
+
+static int64_t number(RuleParser* r) {
+	skipSpace(r);
+	char* end;
+	const bool hex = r->p[0] == '0' && (r->p[1] == 'x' || r->p[1] == 'X');
+	const int64_t v = strtoll(r->p, &end, hex ? 16 : 10);
+	if (end == r->p) ruleError(r, "expected a number");
+	r->p = end;
+	return v;
+}
+
+static int findVar(RuleParser* r, const std::string& name) {
+	for (size_t i = 0; i < r->vars.size(); ++i) {
+		if (r->vars[i] == name) return static_cast<int>(i);
+	}
+	ruleError(r, ("unknown var '" + name + "'").c_str());
+	return 0;
+}
+
+static int32_t ramAddress(RuleParser* r, int bytes) {
+	const int64_t a = number(r);
+	if (a < 0 || a + bytes > 0x800) ruleError(r, "RAM address out of range");
+	return static_cast<int32_t>(a);
+}
+
+static void expression(RuleParser* r);
+
+static void atom(RuleParser* r) {
+	skipSpace(r);
+	if (accept(r, "(")) {
+		expression(r);
+		expect(r, ")");
+		return;
+	}
+	if (isdigit(static_cast<unsigned char>(*r->p))) {
+		const int64_t v = number(r);
+		if (v < INT32_MIN || v > INT32_MAX) ruleError(r, "number out of range");
+		emit(r, OpPush, 1);
+		r->code->push_back(static_cast<int32_t>(v));
+		return;
+	}
+
+	const std::string name = identifier(r);
+	if (name.empty()) {
+		ruleError(r, "expected an expression");
+		return;
+	}
+	if (!accept(r, "(")) {
+		emit(r, OpVar, 1);
+		r->code->push_back(findVar(r, name));
+		return;
+	}
+	if (name == "ram" || name == "ram16") {
+		emit(r, name == "ram" ? OpRAM : OpRAM16, 1);
+		r->code->push_back(ramAddress(r, name == "ram" ? 1 : 2));
+	}
+	else if (name == "bcd" || name == "digits") {
+		const char* start = r->p;
+		number(r);
+		expect(r, ",");
+		const int64_t n = number(r);
+		if (n < 1 || n > (name == "bcd" ? 9 : 18)) ruleError(r, "too many digits");
+		const char* end = r->p;
+		r->p = start;
+		emit(r, name == "bcd" ? OpBCD : OpDigits, 1);
+		r->code->push_back(ramAddress(r, static_cast<int>(n)));
+		r->code->push_back(static_cast<int32_t>(n));
+		r->p = end;
+	}
+	else if (name == "prev" || name == "delta") {
+		const int var = findVar(r, identifier(r));
+		if (name == "delta") {
+			emit(r, OpVar, 1);
+			r->code->push_back(var);
+		}
+		emit(r, OpPrev, 1);
+		r->code->push_back(var);
+		if (name == "delta") emit(r, OpSub, -1);
+	}
+	else {
+		ruleError(r, ("unknown function '" + name + "'").c_str());
+	}
+	expect(r, ")");
+}
+
+static void unary(RuleParser* r) {
+	if (accept(r, "!")) {
+		unary(r);
+		emit(r, OpNot, 0);
+	}
+	else if (accept(r, "-")) {
+		unary(r);
+		emit(r, OpNeg, 0);
+	}
+	else {
+		atom(r);
+	}
+}
+
+struct BinaryOp {
+	const char* token;
+	RuleOp op;
+};
+
+// operators by precedence, loosest first; longer tokens before their prefixes
+static const BinaryOp binary_ops[][6] = {
+	{ { "||", OpOr } },
+	{ { "&&", OpAnd } },
+	{ { "==", OpEq }, { "!=", OpNe }, { "<=", OpLe }, { ">=", OpGe }, { "<", OpLt }, { ">", OpGt } },
+	{ { "|", OpBitOr } },
+	{ { "&", OpBitAnd } },
+	{ { "+", OpAdd }, { "-", OpSub } },
+	{ { "*", OpMul }, { "/", OpDiv }, { "%", OpMod } }
+};
+
+constexpr int PRECEDENCE_LEVELS = sizeof(binary_ops) / sizeof(binary_ops[0]);
+
+static void binary(RuleParser* r, int level) {
+	if (level == PRECEDENCE_LEVELS) {
+		unary(r);
+		return;
+	}
+	binary(r, level + 1);
+	for (;;) {
+		skipSpace(r);
+		const BinaryOp* match = nullptr;
+		for (const BinaryOp& b : binary_ops[level]) {
+			const size_t n = b.token != nullptr ? strlen(b.token) : 0;
+			// '|' and '&' are not the start of '||' and '&&'
+			if (n == 0 || strncmp(r->p, b.token, n) != 0) continue;
+			if (n == 1 && (*b.token == '|' || *b.token == '&') && r->p[1] == *b.token) continue;
+			match = &b;
+			break;
+		}
+		if (match == nullptr || r->failed) return;
+		r->p += strlen(match->token);
+		binary(r, level + 1);
+		emit(r, match->op, -1);
+	}
+}
+
+static void expression(RuleParser* r) {
+	binary(r, 0);
+}
+
+bool compileRules(RuleProgram* program, const char* source, const char* path) {
+	RuleParser r;
+	r.p = source;
+	r.path = path;
+	r.line = 1;
+	r.depth = 0;
+	r.max_depth = 0;
+	r.failed = false;
+	r.code = &program->code;
+	program->code.clear();
+
+	while (*r.p != '\0' && !r.failed) {
+		skipSpace(&r);
+		if (*r.p == '\n') {
+			++r.p;
+			++r.line;
+			continue;
+		}
+		if (*r.p == '\0') break;
+
+		const std::string keyword = identifier(&r);
+		if (keyword == "var") {
+			const std::string name = identifier(&r);
+			if (name.empty() || isdigit(static_cast<unsigned char>(name[0]))) ruleError(&r, "expected a var name");
+			expect(&r, "=");
+			expression(&r);
+			r.vars.push_back(name);
+			emit(&r, OpStore, -1);
+			program->code.push_back(static_cast<int32_t>(r.vars.size() - 1));
+		}
+		else if (keyword == "reward" || keyword == "done") {
+			expression(&r);
+			emit(&r, keyword == "reward" ? OpReward : OpDone, -1);
+		}
+		else {
+			ruleError(&r, "expected 'var', 'reward' or 'done'");
+		}
+		skipSpace(&r);
+		if (*r.p != '\n' && *r.p != '\0') ruleError(&r, "unexpected text at end of line");
+	}
+	if (r.max_depth > MAX_RULE_STACK) ruleError(&r, "expression is too deep");
+	program->var_count = static_cast<int>(r.vars.size());
+	return !r.failed;
+}
+
+bool loadRules(RuleProgram* program, const char* path) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to open rules file!" << std::endl;
+		return false;
+	}
+	std::string source;
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) source.append(buffer, n);
+	fclose(fp);
+	return compileRules(program, source.c_str(), path);
+}
+
+void resetRules(const RuleProgram* program, RuleState* state, const NES* nes) {
+	state->vars.assign(program->var_count, 0);
+	state->prev.assign(program->var_count, 0);
+	float reward;
+	bool done;
+	evaluateRules(program, state, nes, &reward, &done);
+}
+
+void evaluateRules(const RuleProgram* program, RuleState* state, const NES* nes, float* reward, bool* done) {
+	state->prev.swap(state->vars);
+	int64_t* const vars = state->vars.data();
+	const int64_t* const prev = state->prev.data();
+	const uint8_t* const ram = nes->RAM;
+	const int32_t* pc = program->code.data();
+	const int32_t* const end = pc + program->code.size();
+
+	int64_t stack[MAX_RULE_STACK];
+	int64_t* sp = stack; // one past the top
+	int64_t total = 0;
+	bool finished = false;
+	while (pc != end) {
+		switch (*pc++) {
+		case OpPush: *sp++ = *pc++; break;
+		case OpRAM: *sp++ = ram[*pc++]; break;
+		case OpRAM16: *sp++ = ram[pc[0]] | (ram[pc[0] + 1] << 8); ++pc; break;
+		case OpBCD: {
+			int64_t v = 0;
+			for (int i = 0; i < pc[1]; ++i) v = v * 100 + (ram[pc[0] + i] >> 4) * 10 + (ram[pc[0] + i] & 0xF);
+			*sp++ = v;
+			pc += 2;
+			break;
+		}
+		case OpDigits: {
+			int64_t v = 0;
+			for (int i = 0; i < pc[1]; ++i) v = v * 10 + ram[pc[0] + i];
+			*sp++ = v;
+			pc += 2;
+			break;
+		}
+		case OpVar: *sp++ = vars[*pc++]; break;
+		case OpPrev: *sp++ = prev[*pc++]; break;
+		case OpStore: vars[*pc++] = *--sp; break;
+		case OpReward: total += *--sp; break;
+		case OpDone: finished |= *--sp != 0; break;
+		case OpNot: sp[-1] = !sp[-1]; break;
+		case OpNeg: sp[-1] = -sp[-1]; break;
+		case OpOr: --sp; sp[-1] = sp[-1] || sp[0]; break;
+		case OpAnd: --sp; sp[-1] = sp[-1] && sp[0]; break;
+		case OpEq: --sp; sp[-1] = sp[-1] == sp[0]; break;
+		case OpNe: --sp; sp[-1] = sp[-1] != sp[0]; break;
+		case OpLt: --sp; sp[-1] = sp[-1] < sp[0]; break;
+		case OpLe: --sp; sp[-1] = sp[-1] <= sp[0]; break;
+		case OpGt: --sp; sp[-1] = sp[-1] > sp[0]; break;
+		case OpGe: --sp; sp[-1] = sp[-1] >= sp[0]; break;
+		case OpBitOr: --sp; sp[-1] |= sp[0]; break;
+		case OpBitAnd: --sp; sp[-1] &= sp[0]; break;
+		case OpAdd: --sp; sp[-1] += sp[0]; break;
+		case OpSub: --sp; sp[-1] -= sp[0]; break;
+		case OpMul: --sp; sp[-1] *= sp[0]; break;
+		// dividing by zero gives zero rather than bringing the process down
+		case OpDiv: --sp; sp[-1] = sp[0] != 0 ? sp[-1] / sp[0] : 0; break;
+		case OpMod: --sp; sp[-1] = sp[0] != 0 ? sp[-1] % sp[0] : 0; break;
+		}
+	}
+	*reward = static_cast<float>(total);
+	*done = finished;
+}
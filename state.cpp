@@ -0,0 +1,231 @@
+/*******************************************************************
+*   state.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Save states are whole consoles. PRG-ROM (and CHR-ROM) never change, so
+// copies share them with the original; everything else is duplicated.
+
+#include "NES.h"
+
+NES* cloneNES(const NES* src) {
+	NES* nes = new NES(*src);
+
+	nes->cpu = new CPU(*src->cpu);
+	nes->controller1 = new Controller(*src->controller1);
+	nes->controller2 = new Controller(*src->controller2);
+	nes->RAM = new uint8_t[2048];
+
+	nes->apu = new APU(*src->apu);
+	nes->apu->samples = new float[src->apu->sample_capacity];
+
+	nes->ppu = new PPU(*src->ppu);
+	nes->ppu->front = new uint32_t[256 * 240];
+	nes->ppu->back = new uint32_t[256 * 240];
+
+	nes->cartridge = new Cartridge(*src->cartridge);
+
+	nes->mapper = src->mapper->clone(nes);
+	nes->ppu_trace = nullptr;
+	nes->apu_log = nullptr;
+
+	copyState(nes, src);
+	return nes;
+}
+
+// Overwrites the state of 'dst', which must have been cloned from 'src' or
+// from a console sharing its cartridge. Audio output isn't part of the state.
+void copyState(NES* dst, const NES* src) {
+	*dst->cpu = *src->cpu;
+	*dst->controller1 = *src->controller1;
+	*dst->controller2 = *src->controller2;
+	memcpy(dst->RAM, src->RAM, 2048);
+
+	APU* apu = dst->apu;
+	float* samples = apu->samples;
+	const int sample_capacity = apu->sample_capacity;
+	*apu = *src->apu;
+	apu->samples = samples;
+	apu->sample_capacity = sample_capacity;
+	apu->sample_count = 0;
+	apu->mixed = 0;
+
+	PPU* ppu = dst->ppu;
+	uint32_t* front = ppu->front;
+	uint32_t* back = ppu->back;
+	*ppu = *src->ppu;
+	ppu->front = front;
+	ppu->back = back;
+	memcpy(front, src->ppu->front, 256 * 240 * sizeof(uint32_t));
+	memcpy(back, src->ppu->back, 256 * 240 * sizeof(uint32_t));
+
+	Cartridge* cartridge = dst->cartridge;
+	cartridge->mirror = src->cartridge->mirror;
+	memcpy(cartridge->SRAM, src->cartridge->SRAM, static_cast<size_t>(cartridge->sram_size));
+	if (cartridge->chr_ram) {
+		memcpy(cartridge->CHR, src->cartridge->CHR, static_cast<size_t>(cartridge->chr_size));
+	}
+
+	dst->mapper->copyFrom(dst, src->mapper);
+	dst->mapper_event = src->mapper_event;
+}
+
+// Serialized states are raw copies of the structs, so they only load into
+// a build with the same layout. The header catches a mismatched build or ROM.
+constexpr uint32_t STATE_MAGIC = 0x54534E4B; // "KNST"
+constexpr uint32_t STATE_VERSION = 1;
+
+// room for the largest mapper, so loading a state allocates nothing
+constexpr size_t MAX_MAPPER_STATE = 2048;
+static_assert(sizeof(Mapper1) <= MAX_MAPPER_STATE && sizeof(Mapper4) <= MAX_MAPPER_STATE && sizeof(Mapper5) <= MAX_MAPPER_STATE &&
+	sizeof(Mapper9) <= MAX_MAPPER_STATE && sizeof(Mapper19) <= MAX_MAPPER_STATE && sizeof(Mapper24) <= MAX_MAPPER_STATE &&
+	sizeof(Mapper69) <= MAX_MAPPER_STATE && sizeof(Mapper85) <= MAX_MAPPER_STATE && sizeof(DiscreteMapper) <= MAX_MAPPER_STATE,
+	"a mapper's state outgrew MAX_MAPPER_STATE");
+
+struct StateHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t rom_hash;
+	uint32_t sizes[6]; // CPU, APU, PPU, Controller, mapper, SRAM
+};
+
+static void fillStateHeader(StateHeader* header, const NES* nes) {
+	memset(header, 0, sizeof(*header));
+	header->magic = STATE_MAGIC;
+	header->version = STATE_VERSION;
+	header->rom_hash = nes->cartridge->hash;
+	header->sizes[0] = sizeof(CPU);
+	header->sizes[1] = sizeof(APU);
+	header->sizes[2] = sizeof(PPU);
+	header->sizes[3] = sizeof(Controller);
+	header->sizes[4] = static_cast<uint32_t>(nes->mapper->stateSize());
+	header->sizes[5] = static_cast<uint32_t>(nes->cartridge->sram_size);
+}
+
+static void put(std::vector<uint8_t>& out, const void* data, size_t size) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	out.insert(out.end(), p, p + size);
+}
+
+void saveState(const NES* nes, std::vector<uint8_t>* out) {
+	out->clear();
+	if (nes->mapper->stateSize() > MAX_MAPPER_STATE) {
+		std::cerr << "ERROR: mapper state is too large to save!" << std::endl;
+		return;
+	}
+	StateHeader header;
+	fillStateHeader(&header, nes);
+	put(*out, &header, sizeof(header));
+	put(*out, nes->cpu, sizeof(CPU));
+
+	// The pointers in the structs belong to this console, and the audio
+	// output isn't part of the state, so they're saved zeroed: the same
+	// state saves to the same bytes from any console in any process.
+	uint64_t apu_raw[(sizeof(APU) + 7) / 8];
+	memcpy(apu_raw, nes->apu, sizeof(APU));
+	APU* apu = reinterpret_cast<APU*>(apu_raw);
+	apu->samples = nullptr;
+	apu->sample_count = 0;
+	apu->sample_capacity = 0;
+	apu->mixed = 0;
+	put(*out, apu, sizeof(APU));
+
+	uint64_t ppu_raw[(sizeof(PPU) + 7) / 8];
+	memcpy(ppu_raw, nes->ppu, sizeof(PPU));
+	PPU* ppu = reinterpret_cast<PPU*>(ppu_raw);
+	ppu->front = nullptr;
+	ppu->back = nullptr;
+	put(*out, ppu, sizeof(PPU));
+
+	put(*out, nes->controller1, sizeof(Controller));
+	put(*out, nes->controller2, sizeof(Controller));
+	put(*out, nes->RAM, 2048);
+	put(*out, nes->ppu->front, 256 * 240 * sizeof(uint32_t));
+	put(*out, nes->ppu->back, 256 * 240 * sizeof(uint32_t));
+	put(*out, nes->cartridge->SRAM, static_cast<size_t>(nes->cartridge->sram_size));
+	if (nes->cartridge->chr_ram) {
+		put(*out, nes->cartridge->CHR, static_cast<size_t>(nes->cartridge->chr_size));
+	}
+	put(*out, &nes->cartridge->mirror, 1);
+	put(*out, &nes->mapper_event, sizeof(uint64_t));
+
+	// the mapper pointed at no console, with its sound chip and the vtable
+	// pointers of both cleared too. loadState() keeps the ones 'nes' has.
+	uint64_t mapper_raw[MAX_MAPPER_STATE / sizeof(uint64_t)];
+	memcpy(mapper_raw, nes->mapper, nes->mapper->stateSize());
+	Mapper* mapper = reinterpret_cast<Mapper*>(mapper_raw);
+	mapper->rebind(nullptr);
+	mapper->audio = nullptr;
+	memset(mapper_raw, 0, sizeof(void*));
+	put(*out, mapper_raw, nes->mapper->stateSize());
+}
+
+// Loads a state from saveState() into a console running the same ROM.
+// The pointers in the raw structs are saved zeroed, so the ones 'nes'
+// already has are kept, and the mapper is assigned from the raw bytes
+// member by member, leaving its vtables alone.
+bool loadState(NES* nes, const uint8_t* data, size_t size) {
+	StateHeader expected;
+	fillStateHeader(&expected, nes);
+	const size_t chr = nes->cartridge->chr_ram ? static_cast<size_t>(nes->cartridge->chr_size) : 0;
+	const size_t total = sizeof(StateHeader) + sizeof(CPU) + sizeof(APU) + sizeof(PPU) + 2 * sizeof(Controller) + 2048 +
+		2 * 256 * 240 * sizeof(uint32_t) + static_cast<size_t>(nes->cartridge->sram_size) + chr + 1 + sizeof(uint64_t) + nes->mapper->stateSize();
+	if (size != total || memcmp(data, &expected, sizeof(StateHeader)) != 0 || nes->mapper->stateSize() > MAX_MAPPER_STATE) {
+		std::cerr << "ERROR: save state is from a different ROM or build!" << std::endl;
+		return false;
+	}
+	data += sizeof(StateHeader);
+
+	memcpy(nes->cpu, data, sizeof(CPU));
+	data += sizeof(CPU);
+
+	APU* apu = nes->apu;
+	float* samples = apu->samples;
+	const int sample_capacity = apu->sample_capacity;
+	memcpy(apu, data, sizeof(APU));
+	apu->samples = samples;
+	apu->sample_capacity = sample_capacity;
+	apu->sample_count = 0;
+	apu->mixed = 0;
+	data += sizeof(APU);
+
+	PPU* ppu = nes->ppu;
+	uint32_t* front = ppu->front;
+	uint32_t* back = ppu->back;
+	memcpy(ppu, data, sizeof(PPU));
+	ppu->front = front;
+	ppu->back = back;
+	data += sizeof(PPU);
+
+	memcpy(nes->controller1, data, sizeof(Controller));
+	data += sizeof(Controller);
+	memcpy(nes->controller2, data, sizeof(Controller));
+	data += sizeof(Controller);
+	memcpy(nes->RAM, data, 2048);
+	data += 2048;
+	memcpy(front, data, 256 * 240 * sizeof(uint32_t));
+	data += 256 * 240 * sizeof(uint32_t);
+	memcpy(back, data, 256 * 240 * sizeof(uint32_t));
+	data += 256 * 240 * sizeof(uint32_t);
+	memcpy(nes->cartridge->SRAM, data, static_cast<size_t>(nes->cartridge->sram_size));
+	data += nes->cartridge->sram_size;
+	if (chr != 0) {
+		memcpy(nes->cartridge->CHR, data, chr);
+		data += chr;
+	}
+	nes->cartridge->mirror = *data;
+	++data;
+	memcpy(&nes->mapper_event, data, sizeof(uint64_t));
+	data += sizeof(uint64_t);
+
+	// copy to aligned storage first
+	uint64_t raw[MAX_MAPPER_STATE / sizeof(uint64_t)];
+	memcpy(raw, data, nes->mapper->stateSize());
+	nes->mapper->copyFrom(nes, reinterpret_cast<const Mapper*>(raw));
+	return true;
+}
@@ -0,0 +1,386 @@
+/*******************************************************************
+*   stream.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Frame streaming to thin clients over a TCP or Unix socket.
+//
+// Every packet is a type byte and a 32-bit payload size followed by the
+// payload. Video payloads carry the frame number, a keyframe flag and a
+// bitmap of which 8x8 tiles changed since the last frame sent, then each
+// changed tile as the palette entries it uses followed by its 64 pixels
+// packed at just enough bits to pick one of them. NES tiles rarely use
+// more than four colors, so most come out at 2 bits a pixel or less.
+// Audio payloads are a sample count and that many 16-bit samples.
+
+#include "NES.h"
+
+constexpr int TILES_X = 256 / 8;
+constexpr int TILES_Y = 240 / 8;
+constexpr int TILE_BITMAP = TILES_X * TILES_Y / 8;
+constexpr int STREAM_AUDIO_CHUNK = 4096; // samples per audio packet
+
+// bits needed to pick one of 'n' colors
+static int codeBits(int n) {
+	int bits = 0;
+	while ((1 << bits) < n) ++bits;
+	return bits;
+}
+
+// maps frame buffer colors back to palette entries with a single probe
+struct PaletteLookup {
+	uint32_t multiplier; // hashes the 64 colors without collisions
+	uint32_t colors[256]; // 0 is never a frame buffer color, so marks a free slot
+	uint8_t entries[256];
+
+	int slot(uint32_t color) const {
+		return static_cast<int>((color * multiplier) >> 24);
+	}
+
+	bool build() {
+		memset(colors, 0, sizeof(colors));
+		memset(entries, 0x0F, sizeof(entries)); // free slots give black, even for 0
+		for (int i = 0; i < 64; ++i) {
+			const int h = slot(palette[i]);
+			// entries sharing a color all decode to the first one
+			if (colors[h] == palette[i]) continue;
+			if (colors[h] != 0) return false;
+			colors[h] = palette[i];
+			entries[h] = static_cast<uint8_t>(i);
+		}
+		return true;
+	}
+
+	PaletteLookup() : multiplier(0x9E3779B1u) {
+		while (!build()) multiplier += 2;
+	}
+
+	// anything else, like the blank buffers before the first frame, is sent as black
+	uint8_t find(uint32_t color) const {
+		const int h = slot(color);
+		return colors[h] == color ? entries[h] : 0x0F;
+	}
+};
+
+static const PaletteLookup palette_lookup;
+
+static void put16(std::vector<uint8_t>* out, uint16_t v) {
+	out->push_back(static_cast<uint8_t>(v));
+	out->push_back(static_cast<uint8_t>(v >> 8));
+}
+
+static void put32(std::vector<uint8_t>* out, uint32_t v) {
+	put16(out, static_cast<uint16_t>(v));
+	put16(out, static_cast<uint16_t>(v >> 16));
+}
+
+static uint16_t get16(const uint8_t* p) {
+	return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t* p) {
+	return get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16);
+}
+
+static void beginPacket(std::vector<uint8_t>* out, uint8_t type) {
+	out->clear();
+	out->push_back(type);
+	put32(out, 0);
+}
+
+static void endPacket(std::vector<uint8_t>* out) {
+	const uint32_t size = static_cast<uint32_t>(out->size() - STREAM_HEADER);
+	for (int i = 0; i < 4; ++i) (*out)[1 + i] = static_cast<uint8_t>(size >> (8 * i));
+}
+
+// worst case: every tile changed and using 64 colors
+constexpr size_t MAX_VIDEO_PACKET = STREAM_HEADER + 5 + TILE_BITMAP + TILES_X * TILES_Y * (1 + 64 + 48);
+
+void encodeFrame(FrameStream* s, const uint32_t* pixels) {
+	std::vector<uint8_t>* out = &s->packet;
+	beginPacket(out, STREAM_VIDEO);
+	put32(out, s->frame++);
+	out->push_back(s->keyframe);
+	out->resize(MAX_VIDEO_PACKET, 0);
+	uint8_t* const bitmap = out->data() + STREAM_HEADER + 5;
+	memset(bitmap, 0, TILE_BITMAP);
+	uint8_t* p = bitmap + TILE_BITMAP;
+
+	for (int ty = 0; ty < TILES_Y; ++ty) {
+		for (int tx = 0; tx < TILES_X; ++tx) {
+			const int base = ty * 8 * 256 + tx * 8;
+			bool changed = s->keyframe;
+			for (int y = 0; y < 8 && !changed; ++y) {
+				changed = memcmp(pixels + base + y * 256, s->prev + base + y * 256, 8 * sizeof(uint32_t)) != 0;
+			}
+			if (!changed) continue;
+
+			const int tile = ty * TILES_X + tx;
+			bitmap[tile / 8] |= static_cast<uint8_t>(1 << (tile & 7));
+
+			// local palette of the tile, in order of first use
+			uint8_t codes[64];
+			uint8_t pixel_codes[64];
+			uint8_t* const used = p + 1;
+			int n = 0;
+			memset(codes, 0xFF, sizeof(codes));
+			for (int y = 0; y < 8; ++y) {
+				const uint32_t* row = pixels + base + y * 256;
+				memcpy(s->prev + base + y * 256, row, 8 * sizeof(uint32_t));
+				for (int x = 0; x < 8; ++x) {
+					const uint8_t entry = palette_lookup.find(row[x]);
+					if (codes[entry] == 0xFF) {
+						codes[entry] = static_cast<uint8_t>(n);
+						used[n++] = entry;
+					}
+					pixel_codes[y * 8 + x] = codes[entry];
+				}
+			}
+			*p = static_cast<uint8_t>(n);
+			p += 1 + n;
+
+			// each row of 8 pixels fills exactly 'bits' bytes
+			const int bits = codeBits(n);
+			for (int y = 0; y < 8 && bits > 0; ++y) {
+				uint64_t acc = 0;
+				for (int x = 0; x < 8; ++x) acc |= static_cast<uint64_t>(pixel_codes[y * 8 + x]) << (x * bits);
+				for (int i = 0; i < bits; ++i) *p++ = static_cast<uint8_t>(acc >> (8 * i));
+			}
+		}
+	}
+	s->keyframe = false;
+	out->resize(p - out->data());
+	endPacket(out);
+}
+
+void encodeAudio(FrameStream* s, const float* samples, int count) {
+	std::vector<uint8_t>* out = &s->packet;
+	beginPacket(out, STREAM_AUDIO);
+	put16(out, static_cast<uint16_t>(count));
+	for (int i = 0; i < count; ++i) {
+		const float v = samples[i] < -1.0f ? -1.0f : samples[i] > 1.0f ? 1.0f : samples[i];
+		put16(out, static_cast<uint16_t>(static_cast<int16_t>(v * 32767.0f)));
+	}
+	endPacket(out);
+}
+
+int decodePacket(FrameDecoder* d, const uint8_t* data, size_t size) {
+	if (size < STREAM_HEADER || get32(data + 1) != size - STREAM_HEADER) return -1;
+	const uint8_t type = data[0];
+	const uint8_t* p = data + STREAM_HEADER;
+	const uint8_t* const end = data + size;
+
+	if (type == STREAM_AUDIO) {
+		if (end - p < 2) return -1;
+		const int count = get16(p);
+		p += 2;
+		if (end - p != 2 * count) return -1;
+		d->audio.resize(count);
+		for (int i = 0; i < count; ++i) {
+			d->audio[i] = static_cast<int16_t>(get16(p + 2 * i)) / 32767.0f;
+		}
+		return type;
+	}
+
+	if (type != STREAM_VIDEO || end - p < 5 + TILE_BITMAP) return -1;
+	d->frame = get32(p);
+	const uint8_t* const bitmap = p + 5;
+	p += 5 + TILE_BITMAP;
+	for (int tile = 0; tile < TILES_X * TILES_Y; ++tile) {
+		if (!(bitmap[tile / 8] & (1 << (tile & 7)))) continue;
+		if (p == end) return -1;
+		const int n = *p++;
+		const int bits = codeBits(n);
+		if (n == 0 || n > 64 || end - p < n + 8 * bits) return -1;
+		uint32_t colors[64];
+		for (int i = 0; i < n; ++i) colors[i] = palette[p[i] & 0x3F];
+		p += n;
+
+		uint32_t* const base = d->pixels + (tile / TILES_X) * 8 * 256 + (tile % TILES_X) * 8;
+		const uint64_t mask = (1u << bits) - 1;
+		for (int y = 0; y < 8; ++y) {
+			uint64_t acc = 0;
+			for (int i = 0; i < bits; ++i) acc |= static_cast<uint64_t>(*p++) << (8 * i);
+			for (int x = 0; x < 8; ++x) {
+				const int code = static_cast<int>((acc >> (x * bits)) & mask);
+				if (code >= n) return -1;
+				base[y * 256 + x] = colors[code];
+			}
+		}
+	}
+	return p == end ? type : -1;
+}
+
+#ifndef _WIN32
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// "unix:<path>" or "tcp:<IPv4 address>:<port>"
+static int addressSocket(const char* address, sockaddr_storage* addr, socklen_t* length) {
+	memset(addr, 0, sizeof(*addr));
+	if (strncmp(address, "unix:", 5) == 0) {
+		sockaddr_un* un = reinterpret_cast<sockaddr_un*>(addr);
+		if (strlen(address + 5) >= sizeof(un->sun_path)) {
+			std::cerr << "ERROR: socket path is too long!" << std::endl;
+			return -1;
+		}
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, address + 5);
+		*length = sizeof(*un);
+		return socket(AF_UNIX, SOCK_STREAM, 0);
+	}
+	if (strncmp(address, "tcp:", 4) == 0) {
+		const char* colon = strrchr(address + 4, ':');
+		char host[64];
+		sockaddr_in* in = reinterpret_cast<sockaddr_in*>(addr);
+		in->sin_family = AF_INET;
+		if (colon != nullptr && colon - (address + 4) < static_cast<int>(sizeof(host))) {
+			memcpy(host, address + 4, colon - (address + 4));
+			host[colon - (address + 4)] = '\0';
+			in->sin_port = htons(static_cast<uint16_t>(atoi(colon + 1)));
+			if (inet_pton(AF_INET, host, &in->sin_addr) == 1) {
+				*length = sizeof(*in);
+				const int fd = socket(AF_INET, SOCK_STREAM, 0);
+				// frames are sent whole, so don't hold them back
+				const int one = 1;
+				if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				return fd;
+			}
+		}
+	}
+	std::cerr << "ERROR: bad socket address '" << address << "'!" << std::endl;
+	return -1;
+}
+
+int listenSocket(const char* address, int backlog) {
+	sockaddr_storage addr;
+	socklen_t length = 0;
+	const int server = addressSocket(address, &addr, &length);
+	if (server < 0) return -1;
+	const int one = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (addr.ss_family == AF_UNIX) unlink(reinterpret_cast<sockaddr_un*>(&addr)->sun_path);
+	if (bind(server, reinterpret_cast<sockaddr*>(&addr), length) != 0 || listen(server, backlog) != 0) {
+		std::cerr << "ERROR: failed to listen on '" << address << "'!" << std::endl;
+		close(server);
+		return -1;
+	}
+	return server;
+}
+
+int connectSocket(const char* address) {
+	sockaddr_storage addr;
+	socklen_t length = 0;
+	const int fd = addressSocket(address, &addr, &length);
+	if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), length) != 0) {
+		std::cerr << "ERROR: failed to connect to '" << address << "'!" << std::endl;
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool openStream(FrameStream* s, const char* address) {
+	const int server = listenSocket(address, 1);
+	if (server < 0) return false;
+	s->fd = accept(server, nullptr, nullptr);
+	close(server);
+	if (strncmp(address, "unix:", 5) == 0) unlink(address + 5);
+	if (s->fd < 0) {
+		std::cerr << "ERROR: failed to accept stream client!" << std::endl;
+		return false;
+	}
+	if (strncmp(address, "tcp:", 4) == 0) {
+		const int one = 1;
+		setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	s->keyframe = true;
+	return true;
+}
+
+int connectStream(const char* address) {
+	return connectSocket(address);
+}
+
+static bool sendPacket(FrameStream* s) {
+	if (sendAll(s->fd, s->packet.data(), s->packet.size())) return true;
+	std::cerr << "ERROR: stream client disconnected!" << std::endl;
+	close(s->fd);
+	s->fd = -1;
+	return false;
+}
+
+bool streamOutput(FrameStream* s, const NES* nes) {
+	if (s->fd < 0) return false;
+	if (nes->ppu->frame != s->last_frame) {
+		s->last_frame = nes->ppu->frame;
+		encodeFrame(s, nes->ppu->front);
+		if (!sendPacket(s)) return false;
+	}
+	for (int i = 0; i < nes->apu->sample_count; i += STREAM_AUDIO_CHUNK) {
+		const int count = nes->apu->sample_count - i < STREAM_AUDIO_CHUNK ? nes->apu->sample_count - i : STREAM_AUDIO_CHUNK;
+		encodeAudio(s, nes->apu->samples + i, count);
+		if (!sendPacket(s)) return false;
+	}
+	return true;
+}
+
+bool receivePacket(int fd, std::vector<uint8_t>* packet) {
+	packet->resize(STREAM_HEADER);
+	if (!recvAll(fd, packet->data(), STREAM_HEADER)) return false;
+	const uint32_t size = get32(packet->data() + 1);
+	packet->resize(STREAM_HEADER + size);
+	return recvAll(fd, packet->data() + STREAM_HEADER, size);
+}
+
+#else
+
+int listenSocket(const char* address, int backlog) {
+	static_cast<void>(address);
+	static_cast<void>(backlog);
+	std::cerr << "ERROR: sockets need BSD sockets!" << std::endl;
+	return -1;
+}
+
+int connectSocket(const char* address) {
+	static_cast<void>(address);
+	std::cerr << "ERROR: sockets need BSD sockets!" << std::endl;
+	return -1;
+}
+
+bool openStream(FrameStream* s, const char* address) {
+	static_cast<void>(s);
+	static_cast<void>(address);
+	std::cerr << "ERROR: frame streaming needs BSD sockets!" << std::endl;
+	return false;
+}
+
+int connectStream(const char* address) {
+	static_cast<void>(address);
+	std::cerr << "ERROR: frame streaming needs BSD sockets!" << std::endl;
+	return -1;
+}
+
+bool streamOutput(FrameStream* s, const NES* nes) {
+	static_cast<void>(s);
+	static_cast<void>(nes);
+	return false;
+}
+
+bool receivePacket(int fd, std::vector<uint8_t>* packet) {
+	static_cast<void>(fd);
+	static_cast<void>(packet);
+	return false;
+}
+
+#endif
@@ -0,0 +1,459 @@
+/*******************************************************************
+*   synth.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Synthetic 6502 programs wrapped in iNES images, so the benchmarks can
+// load the CPU, PPU and mappers in a controlled way without commercial
+// ROMs. generateROM() draws a main loop from an instruction mix and does
+// a fixed amount of I/O in every vblank; generateOpcodeROM() repeats one
+// opcode so its cost can be measured on its own.
+//
+// Both put their code in the last 16 KB of a 32 KB PRG, which every
+// supported mapper starts with at $C000, and copy it to the first half
+// so whatever is switched in at $8000 is runnable too.
+
+#include "NES.h"
+
+constexpr uint16_t CODE_ORIGIN = 0xC000;
+constexpr int CODE_SIZE = 0x4000;
+constexpr int CHR_SIZE = 0x2000;
+
+// fixed RAM of the programs
+constexpr uint8_t ZP_POINTER = 0x00;  // generateROM(): $0400, for (zp),Y
+constexpr uint8_t ZP_OPERAND = 0xF0;  // generateOpcodeROM()
+constexpr uint8_t ZP_INDIRECT = 0x40; // generateOpcodeROM(): every zero page pointer is $0303
+constexpr uint16_t OAM_PAGE = 0x0200;
+constexpr uint16_t FRAME_COUNT = 0x0700; // generateROM(): NMIs, out of reach of the main loop
+constexpr uint16_t LOOP_COUNT = 0x0200;
+
+struct Code {
+	std::vector<uint8_t> bytes;
+};
+
+static uint16_t here(const Code* code) {
+	return static_cast<uint16_t>(CODE_ORIGIN + code->bytes.size());
+}
+
+// KNES also runs the unofficial NOPs and SBC $EB; the programs stick to
+// the official set
+static bool official(int opcode) {
+	const Instruction& instruction = instructions[opcode];
+	if (instruction.size == 0 || opcode == 0xEB) return false;
+	return strcmp(instruction.name, "NOP") != 0 || opcode == 0xEA;
+}
+
+static uint8_t opcodeFor(const char* name, uint8_t mode) {
+	for (int i = 0; i < 256; ++i) {
+		if (official(i) && instructions[i].mode == mode && strcmp(instructions[i].name, name) == 0) return static_cast<uint8_t>(i);
+	}
+	return 0xEA;
+}
+
+static void emit(Code* code, const char* name, uint8_t mode) {
+	code->bytes.push_back(opcodeFor(name, mode));
+}
+
+static void emit(Code* code, const char* name, uint8_t mode, uint8_t operand) {
+	code->bytes.push_back(opcodeFor(name, mode));
+	code->bytes.push_back(operand);
+}
+
+static void emitWord(Code* code, const char* name, uint8_t mode, uint16_t operand) {
+	code->bytes.push_back(opcodeFor(name, mode));
+	code->bytes.push_back(static_cast<uint8_t>(operand));
+	code->bytes.push_back(static_cast<uint8_t>(operand >> 8));
+}
+
+// backwards only, to labels already emitted
+static void emitBranch(Code* code, const char* name, uint16_t target) {
+	emit(code, name, modeRelative, static_cast<uint8_t>(target - (here(code) + 2)));
+}
+
+static void emitStore(Code* code, uint16_t address, uint8_t value) {
+	emit(code, "LDA", modeImmediate, value);
+	emitWord(code, "STA", modeAbsolute, address);
+}
+
+static void emitWaitVBlank(Code* code) {
+	uint16_t wait = here(code);
+	emitWord(code, "BIT", modeAbsolute, 0x2002);
+	emitBranch(code, "BPL", wait);
+}
+
+// interrupts off, stack and PPU reset. Leaves A at 0
+static void emitInit(Code* code) {
+	emit(code, "SEI", modeImplied);
+	emit(code, "CLD", modeImplied);
+	emit(code, "LDX", modeImmediate, 0xFF);
+	emit(code, "TXS", modeImplied);
+	emitStore(code, 0x4017, 0x40);
+	emitStore(code, 0x2000, 0x00);
+	emitWord(code, "STA", modeAbsolute, 0x2001);
+	emitWord(code, "STA", modeAbsolute, 0x4010);
+}
+
+// xorshift64*, as in 'env.cpp'
+static uint32_t nextRandom(uint64_t* state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return static_cast<uint32_t>((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// index drawn from 'weights', or -1 if they are all zero
+static int pickWeighted(uint64_t* rng, const float* weights, int count) {
+	float total = 0.0f;
+	for (int i = 0; i < count; ++i) total += weights[i] > 0.0f ? weights[i] : 0.0f;
+	if (total <= 0.0f) return -1;
+	float r = static_cast<float>(nextRandom(rng) >> 8) / 16777216.0f * total;
+	int last = -1;
+	for (int i = 0; i < count; ++i) {
+		if (weights[i] <= 0.0f) continue;
+		last = i;
+		if (r < weights[i]) return i;
+		r -= weights[i];
+	}
+	return last;
+}
+
+// Lays out the image: iNES header, the 16 KB of code twice with the
+// vectors at its end, then 'chr'.
+static bool buildImage(Code* code, uint8_t mapper, uint16_t nmi, uint16_t reset, uint16_t irq, const std::vector<uint8_t>& chr, std::vector<uint8_t>* image) {
+	if (code->bytes.size() > static_cast<size_t>(CODE_SIZE - 6)) {
+		std::cerr << "ERROR: synthetic program needs " << code->bytes.size() << " bytes, more than 16 KB." << std::endl;
+		return false;
+	}
+	code->bytes.resize(CODE_SIZE, 0xFF);
+	const uint16_t vectors[3] = { nmi, reset, irq };
+	for (int i = 0; i < 3; ++i) {
+		code->bytes[CODE_SIZE - 6 + 2 * i] = static_cast<uint8_t>(vectors[i]);
+		code->bytes[CODE_SIZE - 5 + 2 * i] = static_cast<uint8_t>(vectors[i] >> 8);
+	}
+
+	const uint8_t header[16] = { 'N', 'E', 'S', 0x1A, 2, static_cast<uint8_t>(chr.size() / CHR_SIZE),
+		static_cast<uint8_t>((mapper & 0x0F) << 4 | 1), static_cast<uint8_t>(mapper & 0xF0) };
+	image->assign(header, header + 16);
+	image->insert(image->end(), code->bytes.begin(), code->bytes.end());
+	image->insert(image->end(), code->bytes.begin(), code->bytes.end());
+	image->insert(image->end(), chr.begin(), chr.end());
+	return true;
+}
+
+static const char* const CLASS_OPCODES[SYNTH_CLASSES] = {
+	"LDA LDX LDY",
+	"STA STX STY",
+	"ADC SBC AND ORA EOR CMP CPX CPY BIT INX INY DEX DEY",
+	"ASL LSR ROL ROR INC DEC",
+	"BPL BMI BVC BVS BCC BCS BNE BEQ",
+	"TAX TXA TAY TYA TSX NOP",
+	"PHA PHP JSR",
+	"CLC SEC CLI SEI CLV CLD SED"
+};
+
+// One instruction of the main loop. Branches don't go anywhere, stack
+// instructions come with their pull and JSR calls a bare RTS, so the
+// loop runs straight through. Stores and read-modify-writes stay in
+// zero page and $0300-$06FF; only reads go through pointers.
+static void emitRandom(Code* code, uint64_t* rng, uint8_t opcode, uint16_t subroutine) {
+	const Instruction& instruction = instructions[opcode];
+	const uint16_t address = static_cast<uint16_t>(0x0300 + nextRandom(rng) % 0x300);
+	const uint8_t zp = static_cast<uint8_t>(0x10 + nextRandom(rng) % 0xE0);
+
+	if (opcode == opcodeFor("JSR", modeAbsolute)) {
+		emitWord(code, "JSR", modeAbsolute, subroutine);
+		return;
+	}
+	code->bytes.push_back(opcode);
+	switch (instruction.mode) {
+	case modeAbsolute:
+	case modeAbsoluteX:
+	case modeAbsoluteY:
+		code->bytes.push_back(static_cast<uint8_t>(address));
+		code->bytes.push_back(static_cast<uint8_t>(address >> 8));
+		break;
+	case modeImmediate:
+		code->bytes.push_back(static_cast<uint8_t>(nextRandom(rng)));
+		break;
+	case modeIndexedIndirect:
+	case modeZeroPage:
+	case modeZeroPageX:
+	case modeZeroPageY:
+		code->bytes.push_back(zp);
+		break;
+	case modeIndirectIndexed:
+		code->bytes.push_back(ZP_POINTER);
+		break;
+	case modeRelative:
+		code->bytes.push_back(0);
+		break;
+	}
+	if (strcmp(instruction.name, "PHA") == 0) emit(code, "PLA", modeImplied);
+	if (strcmp(instruction.name, "PHP") == 0) emit(code, "PLP", modeImplied);
+}
+
+bool generateROM(const SynthConfig& config, std::vector<uint8_t>* image) {
+	if (config.mapper != 0 && config.mapper != 1 && config.mapper != 4 && config.mapper != 24) {
+		std::cerr << "ERROR: synthetic ROMs support mappers 0, 1, 4 and 24, not " << static_cast<int>(config.mapper) << "." << std::endl;
+		return false;
+	}
+	uint64_t rng = hashBytes(HASH_SEED, reinterpret_cast<const uint8_t*>(&config.seed), sizeof(config.seed)) | 1;
+
+	// candidates of each class
+	std::vector<uint8_t> candidates[SYNTH_CLASSES];
+	std::vector<float> weights[SYNTH_CLASSES];
+	float class_weights[SYNTH_CLASSES];
+	for (int c = 0; c < SYNTH_CLASSES; ++c) {
+		for (int i = 0; i < 256; ++i) {
+			const Instruction& instruction = instructions[i];
+			if (!official(i) || !strstr(CLASS_OPCODES[c], instruction.name)) continue;
+			if ((c == SynthStore || c == SynthShift) && (instruction.mode == modeIndexedIndirect || instruction.mode == modeIndirectIndexed)) continue;
+			float weight = instruction.mode < 14 ? config.modes[instruction.mode] : 0.0f;
+			if (weight <= 0.0f) continue;
+			candidates[c].push_back(static_cast<uint8_t>(i));
+			weights[c].push_back(weight);
+		}
+		class_weights[c] = candidates[c].empty() ? 0.0f : config.mix[c];
+	}
+
+	Code code;
+	const uint16_t irq = here(&code);
+	emit(&code, "RTI", modeImplied);
+	const uint16_t subroutine = here(&code);
+	emit(&code, "RTS", modeImplied);
+
+	const uint16_t reset = here(&code);
+	emitInit(&code);
+	emitWaitVBlank(&code);
+	emitWaitVBlank(&code);
+	emit(&code, "TAX", modeImplied);
+	uint16_t clear = here(&code);
+	emit(&code, "STA", modeZeroPageX, 0x00);
+	for (uint16_t page = 0x0100; page < 0x0800; page += 0x0100) emitWord(&code, "STA", modeAbsoluteX, page);
+	emit(&code, "INX", modeImplied);
+	emitBranch(&code, "BNE", clear);
+	emit(&code, "LDA", modeImmediate, 0x04);
+	emit(&code, "STA", modeZeroPage, ZP_POINTER + 1);
+
+	// sprites from a table after the code, patched in at the end
+	uint16_t copy = here(&code);
+	const size_t oam_operand = code.bytes.size() + 1;
+	emitWord(&code, "LDA", modeAbsoluteX, 0);
+	emitWord(&code, "STA", modeAbsoluteX, OAM_PAGE);
+	emit(&code, "INX", modeImplied);
+	emitBranch(&code, "BNE", copy);
+
+	// MMC1: 4 KB CHR banks, the last PRG bank fixed at $C000, vertical mirroring
+	if (config.mapper == 1) {
+		emitStore(&code, 0x8000, 0x80);
+		for (int bit = 0; bit < 5; ++bit) emitStore(&code, 0x8000, (0x1E >> bit) & 1);
+	}
+
+	// VRC6: the first pulse playing, so the sound chip has state to keep
+	if (config.mapper == 24) {
+		emitStore(&code, 0x9000, 0x38);
+		emitStore(&code, 0x9001, 0x00);
+		emitStore(&code, 0x9002, 0x82);
+	}
+
+	emitWord(&code, "LDA", modeAbsolute, 0x2002);
+	emitStore(&code, 0x2006, 0x3F);
+	emitStore(&code, 0x2006, 0x00);
+	for (int i = 0; i < 32; ++i) emitStore(&code, 0x2007, nextRandom(&rng) & 0x3F);
+	emitStore(&code, 0x2006, 0x20);
+	emitStore(&code, 0x2006, 0x00);
+	emit(&code, "LDY", modeImmediate, 8);
+	uint16_t fill = here(&code);
+	emit(&code, "TXA", modeImplied);
+	emitWord(&code, "STA", modeAbsolute, 0x2007);
+	emit(&code, "INX", modeImplied);
+	emitBranch(&code, "BNE", fill);
+	emit(&code, "DEY", modeImplied);
+	emitBranch(&code, "BNE", fill);
+	emitStore(&code, 0x2005, 0x00);
+	emitWord(&code, "STA", modeAbsolute, 0x2005);
+	emitWaitVBlank(&code);
+	emitStore(&code, 0x2000, 0x80);
+	emitStore(&code, 0x2001, config.rendering ? 0x1E : 0x00);
+
+	const uint16_t main = here(&code);
+	for (int i = 0; i < config.length; ++i) {
+		int c = pickWeighted(&rng, class_weights, SYNTH_CLASSES);
+		if (c < 0) break;
+		int k = pickWeighted(&rng, weights[c].data(), static_cast<int>(weights[c].size()));
+		emitRandom(&code, &rng, candidates[c][k], subroutine);
+		if (code.bytes.size() > static_cast<size_t>(CODE_SIZE)) break;
+	}
+	emitWord(&code, "JMP", modeAbsolute, main);
+
+	const uint16_t nmi = here(&code);
+	emit(&code, "PHA", modeImplied);
+	emit(&code, "TXA", modeImplied);
+	emit(&code, "PHA", modeImplied);
+	emit(&code, "TYA", modeImplied);
+	emit(&code, "PHA", modeImplied);
+	emitWord(&code, "INC", modeAbsolute, FRAME_COUNT);
+	for (int i = 0; i < config.oam_dmas; ++i) emitStore(&code, 0x4014, OAM_PAGE >> 8);
+	if (config.vram_writes > 0) {
+		emitWord(&code, "LDA", modeAbsolute, 0x2002);
+		emitStore(&code, 0x2006, 0x20);
+		emitStore(&code, 0x2006, 0x00);
+		emitWord(&code, "LDA", modeAbsolute, FRAME_COUNT);
+		for (int i = 0; i < config.vram_writes; ++i) emitWord(&code, "STA", modeAbsolute, 0x2007);
+	}
+	for (int i = 0; i < config.bank_writes; ++i) {
+		if (config.mapper == 1) {
+			const uint16_t reg = i & 1 ? 0xC000 : 0xA000;
+			uint8_t bank = nextRandom(&rng) & 1;
+			for (int bit = 0; bit < 5; ++bit) emitStore(&code, reg, (bank >> bit) & 1);
+		} else if (config.mapper == 4) {
+			// R0-R5, the CHR banks, with 2 KB banks at even numbers
+			uint8_t reg = i % 6;
+			uint8_t bank = nextRandom(&rng) & (reg < 2 ? 6 : 7);
+			emitStore(&code, 0x8000, reg);
+			emitStore(&code, 0x8001, bank);
+		} else if (config.mapper == 24) {
+			// the eight 1 KB CHR banks at $D000-$D003 and $E000-$E003
+			const uint16_t reg = static_cast<uint16_t>((i & 4 ? 0xE000 : 0xD000) | (i & 3));
+			emitStore(&code, reg, nextRandom(&rng) & 7);
+		}
+	}
+	emitStore(&code, 0x2005, 0x00);
+	emitWord(&code, "STA", modeAbsolute, 0x2005);
+	emitStore(&code, 0x2000, 0x80);
+	emit(&code, "PLA", modeImplied);
+	emit(&code, "TAY", modeImplied);
+	emit(&code, "PLA", modeImplied);
+	emit(&code, "TAX", modeImplied);
+	emit(&code, "PLA", modeImplied);
+	emit(&code, "RTI", modeImplied);
+
+	const uint16_t oam = here(&code);
+	code.bytes[oam_operand] = static_cast<uint8_t>(oam);
+	code.bytes[oam_operand + 1] = static_cast<uint8_t>(oam >> 8);
+	for (int i = 0; i < 256; ++i) code.bytes.push_back(static_cast<uint8_t>(nextRandom(&rng)));
+
+	std::vector<uint8_t> chr(CHR_SIZE);
+	for (uint8_t& b : chr) b = static_cast<uint8_t>(nextRandom(&rng));
+	return buildImage(&code, config.mapper, nmi, reset, irq, chr, image);
+}
+
+bool generateOpcodeROM(uint8_t opcode, int* count, std::vector<uint8_t>* image) {
+	const Instruction& instruction = instructions[opcode];
+	if (instruction.size == 0) return false;
+	const bool rts = strcmp(instruction.name, "RTS") == 0;
+	const bool rti = strcmp(instruction.name, "RTI") == 0;
+	// one page of return addresses, set up on every loop
+	if (rts) *count = std::min(*count, 127);
+	if (rti) *count = std::min(*count, 85);
+	*count = std::max(0, std::min(*count, (CODE_SIZE - 1024) / instruction.size));
+
+	Code code;
+	const uint16_t irq = here(&code);
+	emit(&code, "RTI", modeImplied);
+
+	const uint16_t reset = here(&code);
+	emitInit(&code);
+	emit(&code, "LDA", modeImmediate, 0x03);
+	emit(&code, "LDX", modeImmediate, 0x00);
+	uint16_t fill = here(&code);
+	emit(&code, "STA", modeZeroPageX, 0x00);
+	emit(&code, "INX", modeImplied);
+	emitBranch(&code, "BNE", fill);
+	emitStore(&code, LOOP_COUNT, 0x00);
+	emitWord(&code, "STA", modeAbsolute, LOOP_COUNT + 1);
+
+	// the stack image for RTS and RTI, from a table after the code
+	size_t stack_operand = 0;
+	if (rts || rti) {
+		uint16_t copy = here(&code);
+		stack_operand = code.bytes.size() + 1;
+		emitWord(&code, "LDA", modeAbsoluteX, 0);
+		emitWord(&code, "STA", modeAbsoluteX, 0x0100);
+		emit(&code, "INX", modeImplied);
+		emitBranch(&code, "BNE", copy);
+	}
+
+	const uint16_t loop = here(&code);
+	emitWord(&code, "INC", modeAbsolute, LOOP_COUNT);
+	emit(&code, "BNE", modeRelative, 3);
+	emitWord(&code, "INC", modeAbsolute, LOOP_COUNT + 1);
+	emit(&code, "LDX", modeImmediate, 0xFF);
+	emit(&code, "TXS", modeImplied);
+	emit(&code, "LDX", modeImmediate, 0x00);
+	emit(&code, "LDY", modeImmediate, 0x00);
+	emit(&code, "LDA", modeImmediate, 0x00);
+
+	const uint16_t block = here(&code);
+	const uint16_t end = static_cast<uint16_t>(block + *count * instruction.size);
+	const uint16_t pointers = static_cast<uint16_t>((end + 3 + 1) & ~1);
+	for (int i = 0; i < *count; ++i) {
+		const uint16_t next = static_cast<uint16_t>(block + (i + 1) * instruction.size);
+		code.bytes.push_back(opcode);
+		switch (instruction.mode) {
+		case modeAbsolute:
+		case modeAbsoluteX:
+		case modeAbsoluteY: {
+			// JMP and JSR go on to the next copy
+			const bool jump = strcmp(instruction.name, "JMP") == 0 || strcmp(instruction.name, "JSR") == 0;
+			const uint16_t address = jump ? next : 0x0300;
+			code.bytes.push_back(static_cast<uint8_t>(address));
+			code.bytes.push_back(static_cast<uint8_t>(address >> 8));
+			break;
+		}
+		case modeIndirect: {
+			const uint16_t address = static_cast<uint16_t>(pointers + 2 * i);
+			code.bytes.push_back(static_cast<uint8_t>(address));
+			code.bytes.push_back(static_cast<uint8_t>(address >> 8));
+			break;
+		}
+		case modeImmediate:
+			code.bytes.push_back(0x5A);
+			break;
+		case modeZeroPage:
+		case modeZeroPageX:
+		case modeZeroPageY:
+			code.bytes.push_back(ZP_OPERAND);
+			break;
+		case modeIndexedIndirect:
+		case modeIndirectIndexed:
+			code.bytes.push_back(ZP_INDIRECT);
+			break;
+		case modeRelative:
+			code.bytes.push_back(0);
+			break;
+		}
+	}
+	emitWord(&code, "JMP", modeAbsolute, loop);
+
+	if (instruction.mode == modeIndirect) {
+		code.bytes.resize(pointers - CODE_ORIGIN, 0xFF);
+		for (int i = 0; i < *count; ++i) {
+			const uint16_t next = static_cast<uint16_t>(block + (i + 1) * instruction.size);
+			code.bytes.push_back(static_cast<uint8_t>(next));
+			code.bytes.push_back(static_cast<uint8_t>(next >> 8));
+		}
+	}
+	if (rts || rti) {
+		const uint16_t table = here(&code);
+		code.bytes[stack_operand] = static_cast<uint8_t>(table);
+		code.bytes[stack_operand + 1] = static_cast<uint8_t>(table >> 8);
+		std::vector<uint8_t> stack;
+		for (int i = 0; i < *count; ++i) {
+			// RTS returns to one past the address it pulls
+			const uint16_t next = static_cast<uint16_t>(block + i + 1 - (rts ? 1 : 0));
+			if (rti) stack.push_back(0x24);
+			stack.push_back(static_cast<uint8_t>(next));
+			stack.push_back(static_cast<uint8_t>(next >> 8));
+		}
+		stack.resize(256, 0);
+		code.bytes.insert(code.bytes.end(), stack.begin(), stack.end());
+	}
+
+	return buildImage(&code, 0, irq, reset, irq, std::vector<uint8_t>(CHR_SIZE, 0), image);
+}
@@ -0,0 +1,38 @@
+/*******************************************************************
+*   coordinator.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Runs a sweep of (ROM, input script, seed) jobs over worker processes,
+// see 'jobs.cpp'. The coordinator forks the given number of local workers
+// and also takes any started with --worker on this or other machines.
+//
+// Usage: coordinator <job list> <output file> <address> [local workers]
+//        coordinator --worker <address>
+
+#include "../NES.h"
+
+int main(int argc, char* argv[]) {
+	if (argc == 3 && strcmp(argv[1], "--worker") == 0) {
+		return runJobWorker(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc != 4 && argc != 5) {
+		std::cout << "Usage: coordinator <job list> <output file> <address> [local workers]" << std::endl;
+		std::cout << "       coordinator --worker <address>" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<JobSpec> jobs;
+	if (!loadJobs(&jobs, argv[1])) return EXIT_FAILURE;
+
+	CoordinatorConfig config;
+	config.output = argv[2];
+	config.address = argv[3];
+	config.local_workers = argc == 5 ? atoi(argv[4]) : 1;
+	return runCoordinator(jobs, config) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,51 @@
+/*******************************************************************
+*   statehash.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Runs a ROM headless for a number of frames and prints the hash of its
+// save state. The same state has to save to the same bytes from any
+// console in any process, so a clone is checked against the original here
+// and 'make check' compares the hash between two runs.
+//
+// Usage: statehash <ROM file> [frames]
+
+#include "../NES.h"
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc > 3) {
+		std::cout << "Usage: statehash <ROM file> [frames]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const int frames = argc == 3 ? atoi(argv[2]) : 300;
+
+	NES* nes = new NES(argv[1], "");
+	if (!nes->initialized) return EXIT_FAILURE;
+	for (int i = 0; i < frames; ++i) {
+		nes->controller1->buttons = static_cast<uint8_t>(i >> 4);
+		emulateFrame(nes);
+	}
+
+	std::vector<uint8_t> state;
+	saveState(nes, &state);
+	if (state.empty()) return EXIT_FAILURE;
+
+	NES* copy = cloneNES(nes);
+	std::vector<uint8_t> copy_state;
+	saveState(copy, &copy_state);
+	const bool same = copy_state == state;
+	delete copy;
+	delete nes;
+	if (!same) {
+		std::cerr << "ERROR: a clone saves different bytes from the original!" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << std::hex << hashBytes(HASH_SEED, state.data(), static_cast<int>(state.size())) << std::endl;
+	return EXIT_SUCCESS;
+}
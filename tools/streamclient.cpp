@@ -0,0 +1,106 @@
+/*******************************************************************
+*   streamclient.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Reference client for 'KNES <rom file> --stream <address>'. Decodes the
+// stream and shows the picture, printing the size and decode time of the
+// video packets every second. Audio packets are decoded and counted but
+// not played.
+//
+// Usage: streamclient <address>
+
+#include "../NES.h"
+
+#include <chrono>
+#include <GLFW/glfw3.h>
+
+int main(int argc, char* argv[]) {
+	if (argc != 2) {
+		std::cout << "Usage: streamclient <address>" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const int fd = connectStream(argv[1]);
+	if (fd < 0) return EXIT_FAILURE;
+
+	if (!glfwInit()) {
+		std::cerr << "ERROR: Failed to initialize GLFW. Aborting." << std::endl;
+		return EXIT_FAILURE;
+	}
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	GLFWwindow* window = glfwCreateWindow(256 * 3, 240 * 3, "KNES stream", nullptr, nullptr);
+	if (!window) {
+		std::cerr << "ERROR: Failed to create window. Aborting." << std::endl;
+		return EXIT_FAILURE;
+	}
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(0);
+
+	GLuint texture;
+	glEnable(GL_TEXTURE_2D);
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	FrameDecoder* decoder = new FrameDecoder();
+	std::vector<uint8_t> packet;
+	int frames = 0;
+	size_t video_bytes = 0;
+	size_t audio_samples = 0;
+	double decode_ns = 0.0;
+	while (!glfwWindowShouldClose(window) && receivePacket(fd, &packet)) {
+		const auto start = std::chrono::steady_clock::now();
+		const int type = decodePacket(decoder, packet.data(), packet.size());
+		const auto end = std::chrono::steady_clock::now();
+		if (type < 0) {
+			std::cerr << "ERROR: malformed stream packet!" << std::endl;
+			break;
+		}
+		if (type == STREAM_AUDIO) {
+			audio_samples += decoder->audio.size();
+			continue;
+		}
+
+		++frames;
+		video_bytes += packet.size();
+		decode_ns += static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		if (frames == 60) {
+			printf("\rframe %u: %.0f bytes/frame, %.1f us decode, %zu audio samples", decoder->frame, static_cast<double>(video_bytes) / frames, decode_ns / frames / 1000.0, audio_samples);
+			fflush(stdout);
+			frames = 0;
+			video_bytes = 0;
+			audio_samples = 0;
+			decode_ns = 0.0;
+		}
+
+		int w, h;
+		glfwGetFramebufferSize(window, &w, &h);
+		glViewport(0, 0, w, h);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 240, 0, GL_RGBA, GL_UNSIGNED_BYTE, decoder->pixels);
+		glBegin(GL_QUADS);
+		glTexCoord2f(0.0f, 1.0f);
+		glVertex2f(-1.0f, -1.0f);
+		glTexCoord2f(1.0f, 1.0f);
+		glVertex2f(1.0f, -1.0f);
+		glTexCoord2f(1.0f, 0.0f);
+		glVertex2f(1.0f, 1.0f);
+		glTexCoord2f(0.0f, 0.0f);
+		glVertex2f(-1.0f, 1.0f);
+		glEnd();
+		glfwSwapBuffers(window);
+		glfwPollEvents();
+		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(window, GLFW_TRUE);
+	}
+
+	std::cout << std::endl << "Stream closed." << std::endl;
+	glfwTerminate();
+	return EXIT_SUCCESS;
+}
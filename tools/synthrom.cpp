@@ -0,0 +1,87 @@
+/*******************************************************************
+*   synthrom.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Writes a synthetic ROM from 'synth.cpp' to a file, for running outside
+// the benchmarks. Options are key=value:
+//   mapper=0|1|4|24  seed=N  length=N  rendering=0|1  vram=N  dma=N  banks=N
+//   mix=load,store,alu,shift,branch,transfer,stack,flag
+//   modes=abs,absx,absy,acc,imm,impl,indx,ind,indy,rel,zp,zpx,zpy
+//   opcode=XX     a loop of one opcode (hex) instead
+//
+// Usage: synthrom <output file> [options]
+
+#include "../NES.h"
+
+// comma separated weights into 'out'
+static bool parseWeights(const char* text, float* out, int count) {
+	for (int i = 0; i < count; ++i) {
+		char* end;
+		out[i] = strtof(text, &end);
+		if (end == text) return false;
+		if (i + 1 < count && *end++ != ',') return false;
+		text = end;
+	}
+	return *text == '\0';
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cout << "Usage: synthrom <output file> [mapper=N] [seed=N] [length=N] [rendering=0|1] [vram=N] [dma=N] [banks=N] [mix=w,...] [modes=w,...] [opcode=XX]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	SynthConfig config;
+	int opcode = -1;
+	for (int i = 2; i < argc; ++i) {
+		const char* value = strchr(argv[i], '=');
+		if (!value) {
+			std::cerr << "ERROR: option " << argv[i] << " is not key=value." << std::endl;
+			return EXIT_FAILURE;
+		}
+		const std::string key(argv[i], value++ - argv[i]);
+		bool ok = true;
+		if (key == "mapper") config.mapper = static_cast<uint8_t>(atoi(value));
+		else if (key == "seed") config.seed = strtoull(value, nullptr, 10);
+		else if (key == "length") config.length = atoi(value);
+		else if (key == "rendering") config.rendering = atoi(value) != 0;
+		else if (key == "vram") config.vram_writes = atoi(value);
+		else if (key == "dma") config.oam_dmas = atoi(value);
+		else if (key == "banks") config.bank_writes = atoi(value);
+		else if (key == "mix") ok = parseWeights(value, config.mix, SYNTH_CLASSES);
+		else if (key == "modes") ok = parseWeights(value, config.modes + 1, 13);
+		else if (key == "opcode") opcode = static_cast<int>(strtol(value, nullptr, 16)) & 0xFF;
+		else ok = false;
+		if (!ok) {
+			std::cerr << "ERROR: bad option " << argv[i] << "." << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<uint8_t> image;
+	if (opcode >= 0) {
+		int count = 256;
+		if (!generateOpcodeROM(static_cast<uint8_t>(opcode), &count, &image)) {
+			std::cerr << "ERROR: KNES does not implement opcode " << instructions[opcode].name << " ($" << std::hex << opcode << ")." << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	else if (!generateROM(config, &image)) {
+		return EXIT_FAILURE;
+	}
+
+	FILE* f = fopen(argv[1], "wb");
+	if (!f || fwrite(image.data(), 1, image.size(), f) != image.size()) {
+		std::cerr << "ERROR: failed to write " << argv[1] << "." << std::endl;
+		if (f) fclose(f);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+	return EXIT_SUCCESS;
+}
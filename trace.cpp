@@ -0,0 +1,207 @@
+/*******************************************************************
+*   trace.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// PPU traces: every CPU access to the PPU from power-on, with a hash of
+// every finished frame, saved and loaded for 'bench/ppubench'.
+
+#include "NES.h"
+
+constexpr uint32_t TRACE_MAGIC = 0x54504E4B; // "KNPT"
+constexpr uint32_t TRACE_VERSION = 1;
+
+struct TraceHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t rom_hash;
+	uint64_t end_tick;
+	uint64_t event_count;
+	uint64_t frame_count;
+};
+
+uint64_t hashFrame(const uint32_t* frame) {
+	return hashBytes(HASH_SEED, reinterpret_cast<const uint8_t*>(frame), 256 * 240 * 4);
+}
+
+bool savePPUTrace(const PPUTrace* trace, const char* path) {
+	FILE* fp = fopen(path, "wb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to open PPU trace file for writing!" << std::endl;
+		return false;
+	}
+
+	TraceHeader header;
+	header.magic = TRACE_MAGIC;
+	header.version = TRACE_VERSION;
+	header.rom_hash = trace->rom_hash;
+	header.end_tick = trace->end_tick;
+	header.event_count = trace->events.size();
+	header.frame_count = trace->frames.size();
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (ok && !trace->events.empty()) {
+		ok = fwrite(trace->events.data(), sizeof(TraceEvent), trace->events.size(), fp) == trace->events.size();
+	}
+	if (ok && !trace->frames.empty()) {
+		ok = fwrite(trace->frames.data(), sizeof(uint64_t), trace->frames.size(), fp) == trace->frames.size();
+	}
+	fclose(fp);
+	if (!ok) {
+		std::cerr << "ERROR: failed to write PPU trace!" << std::endl;
+	}
+	return ok;
+}
+
+bool loadPPUTrace(PPUTrace* trace, const char* path) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: failed to open PPU trace file!" << std::endl;
+		return false;
+	}
+
+	TraceHeader header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+		std::cerr << "ERROR: invalid PPU trace file!" << std::endl;
+		fclose(fp);
+		return false;
+	}
+
+	trace->rom_hash = header.rom_hash;
+	trace->end_tick = header.end_tick;
+	trace->events.resize(header.event_count);
+	trace->frames.resize(header.frame_count);
+	bool ok = true;
+	if (header.event_count != 0) {
+		ok = fread(trace->events.data(), sizeof(TraceEvent), trace->events.size(), fp) == trace->events.size();
+	}
+	if (ok && header.frame_count != 0) {
+		ok = fread(trace->frames.data(), sizeof(uint64_t), trace->frames.size(), fp) == trace->frames.size();
+	}
+	fclose(fp);
+	if (!ok) {
+		std::cerr << "ERROR: failed to read PPU trace!" << std::endl;
+	}
+	return ok;
+}
+
+static void putVGM32(std::vector<uint8_t>& out, size_t offset, uint32_t value) {
+	for (int i = 0; i < 4; ++i) {
+		out[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+}
+
+static void waitVGM(std::vector<uint8_t>& out, uint64_t samples) {
+	while (samples > 0) {
+		if (samples <= 16) {
+			out.push_back(static_cast<uint8_t>(0x70 + samples - 1));
+			return;
+		}
+		else if (samples == 735 || samples == 882) {
+			out.push_back(samples == 735 ? 0x62 : 0x63);
+			return;
+		}
+		const uint64_t n = samples < 0xFFFF ? samples : 0xFFFF;
+		out.push_back(0x61);
+		out.push_back(static_cast<uint8_t>(n));
+		out.push_back(static_cast<uint8_t>(n >> 8));
+		samples -= n;
+	}
+}
+
+// A run of DMC sample bytes for the player's copy of $8000-$FFFF,
+// to go out just before event 'before'.
+struct DMCBlock {
+	size_t before;
+	uint16_t address;
+	std::vector<uint8_t> data;
+};
+
+// Writes the log as a VGM 1.61 file for the NES APU. VGM counts time in
+// 44.1 kHz samples, so writes are rounded down to the sample they fall in.
+// Each run of DMC fetches that the player's memory doesn't already hold
+// goes out as a data block ahead of the register write that started it.
+bool saveAPULog(const APULog* log, const char* path) {
+	const std::vector<TraceEvent>& events = log->events;
+
+	std::vector<DMCBlock> blocks;
+	std::vector<uint8_t> image(0x8000);
+	std::vector<bool> known(0x8000, false);
+	size_t last_write = 0;
+	for (size_t i = 0; i < events.size(); ++i) {
+		const TraceEvent& e = events[i];
+		if (e.kind != TraceRead) {
+			last_write = i;
+			continue;
+		}
+		const int a = e.address & 0x7FFF;
+		if (known[a] && image[a] == e.value) continue;
+
+		DMCBlock block;
+		block.before = last_write;
+		block.address = e.address;
+		uint16_t next = e.address;
+		for (size_t j = i; j < events.size() && next >= 0x8000; ++j) {
+			if (events[j].kind != TraceRead) continue;
+			if (events[j].address != next) break;
+			block.data.push_back(events[j].value);
+			image[next & 0x7FFF] = events[j].value;
+			known[next & 0x7FFF] = true;
+			++next;
+		}
+		blocks.push_back(block);
+	}
+
+	std::vector<uint8_t> out(0x100, 0);
+	out[0] = 'V';
+	out[1] = 'g';
+	out[2] = 'm';
+	out[3] = ' ';
+	putVGM32(out, 0x08, 0x161);
+	putVGM32(out, 0x24, 60);
+	putVGM32(out, 0x34, 0x100 - 0x34);
+	putVGM32(out, 0x84, static_cast<uint32_t>(CPU_FREQ));
+
+	uint64_t sample = 0;
+	size_t b = 0;
+	for (size_t i = 0; i < events.size(); ++i) {
+		const TraceEvent& e = events[i];
+		const uint64_t s = static_cast<uint64_t>(static_cast<double>(e.tick) / SAMPLE_RATE);
+		waitVGM(out, s - sample);
+		sample = s;
+		for (; b < blocks.size() && blocks[b].before == i; ++b) {
+			const DMCBlock& block = blocks[b];
+			out.push_back(0x67);
+			out.push_back(0x66);
+			out.push_back(0xC2);
+			out.resize(out.size() + 4);
+			putVGM32(out, out.size() - 4, static_cast<uint32_t>(block.data.size() + 2));
+			out.push_back(static_cast<uint8_t>(block.address));
+			out.push_back(static_cast<uint8_t>(block.address >> 8));
+			out.insert(out.end(), block.data.begin(), block.data.end());
+		}
+		if (e.kind == TraceWrite) {
+			out.push_back(0xB4);
+			out.push_back(static_cast<uint8_t>(e.address - 0x4000));
+			out.push_back(e.value);
+		}
+	}
+	const uint64_t end = static_cast<uint64_t>(static_cast<double>(log->end_cycle) / SAMPLE_RATE);
+	waitVGM(out, end - sample);
+	out.push_back(0x66);
+	putVGM32(out, 0x04, static_cast<uint32_t>(out.size() - 4));
+	putVGM32(out, 0x18, static_cast<uint32_t>(end));
+
+	FILE* fp = fopen(path, "wb");
+	if (fp == nullptr || fwrite(out.data(), out.size(), 1, fp) != 1) {
+		std::cerr << "ERROR: failed to write APU log!" << std::endl;
+		if (fp != nullptr) fclose(fp);
+		return false;
+	}
+	fclose(fp);
+	return true;
+}
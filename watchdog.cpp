@@ -0,0 +1,85 @@
+/*******************************************************************
+*   watchdog.cpp
+*   KNES
+*
+*	Author: Kareem Omar
+*	kareem.omar@uah.edu
+*	https://github.com/komrad36
+*
+*	Last updated Dec 18, 2016
+*******************************************************************/
+// Catches consoles that have stopped doing anything useful, so a batch
+// worker can give up on them instead of running them forever:
+//
+// - a jam: the CPU sits on an opcode that doesn't move PC on, such as KIL
+//   or one of the unofficial opcodes KNES doesn't implement
+// - a hang: no writes to the PPU, APU or controllers for a long run of
+//   frames, as when spinning on a condition that will never hold. Writes
+//   to PRG-RAM or mapper registers don't count as getting anywhere
+// - no vblank: NMI off and $2002 never read as vblank for a long run of
+//   frames, so the game can't be waiting for the next frame
+//
+// Call watchdogFrame() once per frame, after emulateFrame().
+
+#include "NES.h"
+
+void resetWatchdog(Watchdog* w, const NES* nes) {
+	w->last_vblanks = nes->vblanks_seen;
+	w->last_io = nes->io_writes;
+	w->idle_frames = 0;
+	w->blind_frames = 0;
+	w->jam_frames = 0;
+	w->reason = WatchdogOK;
+	w->state.clear();
+}
+
+bool watchdogFrame(Watchdog* w, NES* nes) {
+	if (w->reason != WatchdogOK) return true;
+
+	w->blind_frames = nes->vblanks_seen == w->last_vblanks ? w->blind_frames + 1 : 0;
+	w->last_vblanks = nes->vblanks_seen;
+	if (w->blind_frames >= w->max_blind_frames) {
+		w->reason = WatchdogNoVBlank;
+	}
+
+	w->idle_frames = nes->io_writes == w->last_io ? w->idle_frames + 1 : 0;
+	w->last_io = nes->io_writes;
+	if (w->idle_frames >= w->max_idle_frames) {
+		w->reason = WatchdogHang;
+	}
+
+	// interrupts keep running on a jammed CPU, but return to the jam, and a
+	// frame ends well after the NMI handler has. Only peek at ROM and RAM
+	// so as not to set off a register read.
+	const uint16_t pc = nes->cpu->PC;
+	const uint8_t opcode = (pc < 0x2000 || pc >= 0x6000) ? readByte(nes, pc) : 0xEA;
+	w->jam_frames = instructions[opcode].size == 0 ? w->jam_frames + 1 : 0;
+	if (w->jam_frames >= 2) {
+		w->reason = WatchdogJam;
+	}
+
+	if (w->reason == WatchdogOK) return false;
+	w->cpu = *nes->cpu;
+	w->opcode = opcode;
+	w->frame = nes->ppu->frame;
+	saveState(nes, &w->state);
+	return true;
+}
+
+void reportWatchdog(const Watchdog* w) {
+	static const char* const reasons[] = { "ok", "CPU jammed", "no I/O", "no vblank" };
+	char registers[64];
+	snprintf(registers, sizeof(registers), "PC=$%04X A=$%02X X=$%02X Y=$%02X SP=$%02X P=$%02X",
+		w->cpu.PC, w->cpu.A, w->cpu.X, w->cpu.Y, w->cpu.SP, w->cpu.flags);
+	std::cerr << "ERROR: watchdog: " << reasons[w->reason] << " in frame " << w->frame << ", " << registers;
+	if (w->reason == WatchdogJam) {
+		std::cerr << " on " << instructions[w->opcode].name;
+	}
+	else if (w->reason == WatchdogHang) {
+		std::cerr << " for " << w->idle_frames << " frames";
+	}
+	else if (w->reason == WatchdogNoVBlank) {
+		std::cerr << " for " << w->blind_frames << " frames";
+	}
+	std::cerr << std::endl;
+}